@@ -0,0 +1,360 @@
+/*
+ * Batch.cpp
+ *
+ *  Created on: Oct 15, 2026
+ */
+
+#include <sys/stat.h>
+#include <algorithm>
+#include <cctype>
+#include <deque>
+#include <fstream>
+#include <map>
+#include "Batch.h"
+#include "SIFTKernels.h"
+
+BatchResult::BatchResult()
+{
+	keypoints = 0;
+	ms = 0;
+	ok = false;
+}
+
+
+
+BatchStats::BatchStats()
+{
+	images = 0;
+	failed = 0;
+	large = 0;
+	keypoints = 0;
+	seconds = 0;
+}
+
+
+
+/**
+ * Extracted images per second of wall time
+ *
+ * @return	Returns the image throughput
+ */
+double BatchStats::imagesPerSecond() const
+{
+	return seconds > 0 ? (images - failed) / seconds : 0;
+}
+
+
+
+/**
+ * Extracted keypoints per second of wall time
+ *
+ * @return	Returns the keypoint throughput
+ */
+double BatchStats::keypointsPerSecond() const
+{
+	return seconds > 0 ? keypoints / seconds : 0;
+}
+
+
+
+/**
+ * One deque of image indices per worker. A worker
+ * pops from the front of its own deque and, once it
+ * is empty, steals from the back of the others
+ */
+class WorkStealingQueues
+{
+private:
+	vector<deque<int> > queues;
+	Mutex* locks;
+
+	WorkStealingQueues(const WorkStealingQueues&);
+	WorkStealingQueues& operator=(const WorkStealingQueues&);
+
+public:
+	WorkStealingQueues(int workers, int items) :
+			queues(workers), locks(new Mutex[workers])
+	{
+		for (int i = 0; i < items; i++)
+			queues[i % workers].push_back(i);
+	}
+
+	~WorkStealingQueues()
+	{
+		delete[] locks;
+	}
+
+	bool pop(int worker, int& item)
+	{
+		int workers = queues.size();
+
+		for (int k = 0; k < workers; k++)
+		{
+			int victim = (worker + k) % workers;
+			AutoLock lock(locks[victim]);
+
+			if (!queues[victim].empty())
+			{
+				if (k == 0)
+				{
+					item = queues[victim].front();
+					queues[victim].pop_front();
+				}
+				else
+				{
+					item = queues[victim].back();
+					queues[victim].pop_back();
+				}
+				return true;
+			}
+		}
+
+		return false;
+	}
+};
+
+
+
+/**
+ * Worker loop of the small images, one worker
+ * per task with its own detector and workspace.
+ * Large images are handed back through deferred
+ */
+class SIFTBatch::WorkerInvoker : public ParallelLoopBody
+{
+public:
+	WorkerInvoker(SIFTBatch* _batch, const vector<string>& _paths, WorkStealingQueues& _queues,
+			vector<BatchResult>& _results, vector<uchar>& _deferred) :
+			batch(_batch), paths(_paths), queues(_queues), results(_results), deferred(_deferred)
+	{
+	}
+
+	void operator()(const Range& range) const
+	{
+		for (int w = range.start; w < range.end; w++)
+		{
+			SIFT detector;
+			SIFTWorkspace workspace;
+			int item;
+
+			while (queues.pop(w, item))
+			{
+				Mat image = imread(paths[item], 1);
+				results[item].path = paths[item];
+				results[item].size = image.size();
+
+				if (image.total() > batch->largeMegapixels * 1e6)
+					deferred[item] = 1;
+				else
+					batch->extractImage(detector, workspace, image, results[item]);
+			}
+		}
+	}
+
+private:
+	SIFTBatch* batch;
+	const vector<string>& paths;
+	WorkStealingQueues& queues;
+	vector<BatchResult>& results;
+	vector<uchar>& deferred;
+};
+
+
+
+SIFTBatch::SIFTBatch(int threads, double largeMP)
+{
+	nThreads = max(threads, 1);
+	largeMegapixels = largeMP;
+}
+
+
+
+/**
+ * Writes the features of every image to a feature
+ * file named after the image in the given directory.
+ * Images of the same name in different folders get
+ * their index in the input appended, so none of them
+ * overwrites another. An empty directory disables
+ * writing
+ *
+ * @param directory		Output directory
+ */
+void SIFTBatch::setOutputDirectory(const string& directory)
+{
+	outputDirectory = directory;
+}
+
+
+
+/**
+ * Expands the input into image paths. A directory
+ * lists its image files, any other file is read as
+ * one path per line
+ *
+ * @param input		Directory or text file of paths
+ * @param paths		Image paths, sorted for directories
+ *
+ * @return	false if the input could not be read
+ */
+bool SIFTBatch::listImages(const string& input, vector<string>& paths)
+{
+	const char* extensions[] = { ".jpg", ".jpeg", ".png", ".bmp", ".tif", ".tiff", ".ppm", ".pgm", ".webp" };
+	struct stat info;
+
+	if (stat(input.c_str(), &info) != 0)
+		return false;
+
+	if (info.st_mode & S_IFDIR)
+	{
+		vector<string> files;
+		glob(input + "/*", files, false);
+
+		for (size_t i = 0; i < files.size(); i++)
+		{
+			string name = files[i];
+			size_t dot = name.rfind('.');
+			if (dot == string::npos)
+				continue;
+
+			string extension = name.substr(dot);
+			for (size_t c = 0; c < extension.size(); c++)
+				extension[c] = tolower(extension[c]);
+
+			for (size_t e = 0; e < sizeof(extensions) / sizeof(extensions[0]); e++)
+				if (extension == extensions[e])
+					paths.push_back(name);
+		}
+
+		sort(paths.begin(), paths.end());
+		return true;
+	}
+
+	ifstream list(input.c_str());
+	string line;
+	while (getline(list, line))
+	{
+		if (!line.empty() && line[line.size() - 1] == '\r')
+			line.erase(line.size() - 1);
+		if (!line.empty())
+			paths.push_back(line);
+	}
+
+	return true;
+}
+
+
+
+/**
+ * Names the feature file of every image after the
+ * image, in the output directory. A name shared by
+ * images of different folders, a/img.jpg and
+ * b/img.jpg, gets the input index appended to every
+ * image that has it: img.jpg.0.sift, img.jpg.1.sift
+ *
+ * @param paths		Image paths
+ * @param results	Results, their output is set
+ */
+void SIFTBatch::outputPaths(const vector<string>& paths, vector<BatchResult>& results)
+{
+	if (outputDirectory.empty())
+		return;
+
+	vector<string> names(paths.size());
+	map<string, int> uses;
+	for (size_t i = 0; i < paths.size(); i++)
+	{
+		names[i] = paths[i].substr(paths[i].find_last_of("/\\") + 1);
+		uses[names[i]]++;
+	}
+
+	for (size_t i = 0; i < paths.size(); i++)
+	{
+		string name = names[i];
+		if (uses[name] > 1)
+		{
+			char index[24];
+			sprintf(index, ".%lu", (unsigned long) i);
+			name += index;
+		}
+
+		results[i].output = outputDirectory + "/" + name + ".sift";
+	}
+}
+
+
+
+/**
+ * Extracts the keypoints and descriptors of one
+ * image, writes its feature file if an output
+ * directory is set and fills its result
+ *
+ * @param detector		Detector of the calling worker
+ * @param workspace		Workspace of the calling worker
+ * @param image			The decoded image
+ * @param result		Result of the image
+ */
+void SIFTBatch::extractImage(SIFT& detector, SIFTWorkspace& workspace, Mat& image, BatchResult& result)
+{
+	if (image.empty())
+		return;
+
+	int64 start = getTickCount();
+	vector<KeyPoint> keypoints;
+	Mat descriptors;
+	detector.findSiftInterestPoint(image, keypoints, workspace);
+	detector.computeDescriptors(descriptors, CV_8U);
+
+	result.ok = true;
+	if (!result.output.empty())
+		result.ok = FeatureFile::save(result.output, keypoints, descriptors, image.size(), result.path);
+
+	result.keypoints = keypoints.size();
+	result.ms = (getTickCount() - start) * 1000.0 / getTickFrequency();
+}
+
+
+
+/**
+ * Extracts the features of every image. Small images
+ * run first on the work stealing workers, then the
+ * large ones run one at a time on every thread
+ *
+ * @param paths		Image paths
+ * @param results	One result per path, in path order
+ * @param stats		Totals of the run
+ */
+void SIFTBatch::run(const vector<string>& paths, vector<BatchResult>& results, BatchStats& stats)
+{
+	int64 start = getTickCount();
+	int workers = min(nThreads, max((int) paths.size(), 1));
+	vector<uchar> deferred(paths.size(), 0);
+
+	results.assign(paths.size(), BatchResult());
+	stats = BatchStats();
+	outputPaths(paths, results);
+
+	WorkStealingQueues queues(workers, paths.size());
+	runParallel(Range(0, workers), WorkerInvoker(this, paths, queues, results, deferred), nThreads);
+
+	SIFT detector;
+	SIFTWorkspace workspace;
+	detector.setThreadCount(nThreads);
+
+	for (size_t i = 0; i < paths.size(); i++)
+	{
+		if (deferred[i])
+		{
+			Mat image = imread(paths[i], 1);
+			extractImage(detector, workspace, image, results[i]);
+			stats.large++;
+		}
+	}
+
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		stats.images++;
+		stats.failed += results[i].ok ? 0 : 1;
+		stats.keypoints += results[i].keypoints;
+	}
+	stats.seconds = (getTickCount() - start) / getTickFrequency();
+}
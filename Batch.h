@@ -0,0 +1,84 @@
+/*
+ * Batch.h
+ *
+ *  Created on: Oct 15, 2026
+ */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "SIFT.h"
+#include "FeatureFile.h"
+
+#define SIFT_BATCH_LARGE_MP					8
+
+/** Outcome of the extraction of one image **/
+struct BatchResult
+{
+	string path;
+	string output;
+	Size size;
+	int keypoints;
+	double ms;
+	bool ok;
+
+	BatchResult();
+};
+
+/** Totals of a batch run **/
+struct BatchStats
+{
+	int images;
+	int failed;
+	int large;
+	size_t keypoints;
+	double seconds;
+
+	BatchStats();
+
+	/** Extracted images per second of wall time **/
+	double imagesPerSecond() const;
+
+	/** Extracted keypoints per second of wall time **/
+	double keypointsPerSecond() const;
+};
+
+/**
+ * Extracts SIFT features from many images. Small
+ * images are spread over per worker queues that
+ * steal from each other when they run dry, each
+ * image on a single thread. Images above the large
+ * threshold are taken out of the queues and run one
+ * after another with every worker on the same image.
+ * The thread count caps how many OpenCV pool threads
+ * run at once, the pool size is left alone
+ */
+class SIFTBatch
+{
+private:
+	int nThreads;
+	double largeMegapixels;
+	string outputDirectory;
+
+	class WorkerInvoker;
+
+	/** Sets the feature file path of every result, unique within the batch **/
+	void outputPaths(const vector<string>& paths, vector<BatchResult>& results);
+
+	/** Extracts the features of one image with the given detector **/
+	void extractImage(SIFT& detector, SIFTWorkspace& workspace, Mat& image, BatchResult& result);
+
+public:
+	SIFTBatch(int threads = getNumberOfCPUs(), double largeMP = SIFT_BATCH_LARGE_MP);
+
+	/** Writes the features of every image as <directory>/<image name>.sift, <image name>.<index>.sift if shared **/
+	void setOutputDirectory(const string& directory);
+
+	/** Expands a directory or a text file of paths into image paths **/
+	static bool listImages(const string& input, vector<string>& paths);
+
+	/** Extracts the features of every image **/
+	void run(const vector<string>& paths, vector<BatchResult>& results, BatchStats& stats);
+};
+
+#endif
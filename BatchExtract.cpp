@@ -0,0 +1,52 @@
+/*
+ * BatchExtract.cpp
+ *
+ *  Created on: Oct 15, 2026
+ */
+
+#include "Batch.h"
+
+static void help()
+{
+	cout << "\nThis program extracts SIFT features from many images\n";
+	cout << "Provide a directory of images or a text file with one image path per line.\n";
+	cout << "Features are written to the output directory when one is given.\n";
+	cout << "Call:\n"
+			"    ./BatchExtract [directory|list.txt] [threads] [output directory]\n";
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2 || argc > 4)
+	{
+		help();
+		return 1;
+	}
+
+	vector<string> paths;
+	if (!SIFTBatch::listImages(argv[1], paths))
+	{
+		cout << "\n Durn, couldn't read " << argv[1] << endl;
+		return 1;
+	}
+
+	int threads = argc > 2 ? atoi(argv[2]) : getNumberOfCPUs();
+	SIFTBatch batch(threads);
+	if (argc > 3)
+		batch.setOutputDirectory(argv[3]);
+	vector<BatchResult> results;
+	BatchStats stats;
+	batch.run(paths, results, stats);
+
+	for (size_t i = 0; i < results.size(); i++)
+		if (!results[i].ok)
+			cout << "Durn, couldn't process image filename " << results[i].path << endl;
+
+	printf("images      %d (%d failed, %d large)\n", stats.images, stats.failed, stats.large);
+	printf("keypoints   %lu\n", (unsigned long) stats.keypoints);
+	printf("seconds     %.2f\n", stats.seconds);
+	printf("images/s    %.2f\n", stats.imagesPerSecond());
+	printf("keypoints/s %.0f\n", stats.keypointsPerSecond());
+
+	return 0;
+}
@@ -0,0 +1,1687 @@
+/*
+ * Benchmark.cpp
+ *
+ *  Created on: Oct 15, 2026
+ */
+
+#include <algorithm>
+#include <map>
+#include <sys/resource.h>
+#include "SIFT.h"
+#include "SIFTKernels.h"
+#include "FeatureFile.h"
+#include "Matcher.h"
+#include "KDForest.h"
+#include "IVFPQ.h"
+#include "VocabularyTree.h"
+
+static void help()
+{
+	cout << "\nThis program benchmarks the stages of the SIFT detector\n";
+	cout << "on deterministic synthetic images.\n";
+	cout << "Call:\n"
+			"    ./Benchmark <mode> [threads]\n";
+	cout << "\nModes: \n"
+			"\tpyramid - direct vs incremental Gaussian pyramid on 1, 4, 12 and 24 MP\n"
+			"\tfused   - Gaussian then DOG pyramid vs the fused tile by tile build on 1, 4, 12 and 24 MP\n"
+			"\tthreads - serial vs multi-threaded findSiftInterestPoint on 12 MP\n"
+			"\textrema - ns per pixel of the scalar, SSE2 and AVX extremum kernels\n"
+			"\tedges   - candidates/s of the single and batched contrast and edge tests\n"
+			"\tvideo   - per-frame latency and memory of a reused workspace on 1080p\n"
+			"\treuse   - descriptors of two images on one detector vs fresh detectors\n"
+			"\tstream  - dirty tile streaming vs the full detector on a fixed 1080p camera\n"
+			"\troi     - region extraction time against region area on 12 MP\n"
+			"\tprofile - per-stage time and per-octave candidate counts on 12 MP, as JSON and trace\n"
+			"\tsuite   - JSON lines of every stage on noise, checkerboard and blob images [threads] [repeats]\n"
+			"\tbudget  - detection and descriptor time under keypoint budgets on 12 MP noise\n"
+			"\tfixed   - 16 bit fixed point vs float pipeline: time, memory and keypoint repeatability\n"
+			"\tgradients - per keypoint gradient windows vs the gradient pyramid on 4 MP images\n"
+			"\tatan    - accuracy, speed and orientation impact of the fast gradient kernels\n"
+			"\tdownsample - fused blur and decimation vs blur then strided copies\n"
+			"\tfeatures - feature file round trip and mapped load throughput\n"
+			"\tmatch   - 10k x 10k brute force matching, serial and threaded\n"
+			"\tindex   - KD-forest recall@1 and queries/s against brute force\n"
+			"\tivfpq   - IVF-PQ memory per vector, recall and queries/s, in memory and mapped\n"
+			"\tvocab   - vocabulary tree quantization throughput and query latency [threads] [images]\n";
+}
+
+/**
+ * Generates a deterministic grayscale float image
+ * of noise and blobs with a 4:3 aspect ratio
+ *
+ * @param megapixels	Image size in megapixels
+ * @param seed			Random generator seed
+ *
+ * @return	Returns the image normalized to [0, 1]
+ */
+static Mat syntheticImage(double megapixels, uint64 seed = 0x5149f7)
+{
+	int rows = cvRound(sqrt(megapixels * 1e6 * 3 / 4));
+	int cols = cvRound(rows * 4.0 / 3);
+	RNG rng(seed);
+
+	Mat image(rows, cols, CV_8UC1);
+	rng.fill(image, RNG::UNIFORM, Scalar(96), Scalar(160));
+	int blobs = cvRound(megapixels * 200);
+	for (int i = 0; i < blobs; i++)
+	{
+		Point center(rng.uniform(0, cols), rng.uniform(0, rows));
+		circle(image, center, rng.uniform(2, 24), Scalar(rng.uniform(0, 256)), -1, CV_AA);
+	}
+
+	Mat result;
+	image.convertTo(result, CV_32F, 1.0 / 255);
+	return result;
+}
+
+/** Synthetic image families of the benchmark suite **/
+enum Pattern
+{
+	PATTERN_NOISE = 0,
+	PATTERN_CHECKERBOARD = 1,
+	PATTERN_BLOBS = 2,
+	PATTERN_COUNT = 3
+};
+
+/**
+ * Generates a deterministic grayscale float image
+ * of one pattern family with a 4:3 aspect ratio:
+ * uniform noise, a checkerboard of 32 pixel squares
+ * or the blobs of syntheticImage
+ *
+ * @param pattern		Pattern family
+ * @param megapixels	Image size in megapixels
+ *
+ * @return	Returns the image normalized to [0, 1]
+ */
+static Mat syntheticPattern(int pattern, double megapixels)
+{
+	if (pattern == PATTERN_BLOBS)
+		return syntheticImage(megapixels);
+
+	int rows = cvRound(sqrt(megapixels * 1e6 * 3 / 4));
+	int cols = cvRound(rows * 4.0 / 3);
+	Mat image(rows, cols, CV_8UC1);
+
+	if (pattern == PATTERN_NOISE)
+	{
+		RNG rng(0x6e6f6973);
+		rng.fill(image, RNG::UNIFORM, Scalar(0), Scalar(256));
+	}
+	else
+	{
+		for (int y = 0; y < rows; y++)
+		{
+			uchar* row = image.ptr<uchar>(y);
+			for (int x = 0; x < cols; x++)
+				row[x] = ((x / 32 + y / 32) & 1) ? 192 : 64;
+		}
+	}
+
+	Mat result;
+	image.convertTo(result, CV_32F, 1.0 / 255);
+	return result;
+}
+
+/** Converts a synthetic image to the BGR frame findSiftInterestPoint expects **/
+static Mat syntheticFrame(double megapixels)
+{
+	Mat gray, frame;
+	syntheticImage(megapixels).convertTo(gray, CV_8U, 255);
+	cvtColor(gray, frame, CV_GRAY2BGR);
+	return frame;
+}
+
+/** Returns the wall time since the given tick count in milliseconds **/
+static double elapsedMs(int64 start)
+{
+	return (getTickCount() - start) * 1000.0 / getTickFrequency();
+}
+
+/**
+ * Compares the direct and the incremental Gaussian
+ * pyramid construction on growing image sizes
+ */
+static void benchPyramid()
+{
+	const double sizes[] = { 1, 4, 12, 24 };
+	const int repeats = 3;
+
+	printf("%6s %12s %12s %8s %14s\n", "MP", "direct ms", "incr ms", "speedup", "max |dDoG|");
+	for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+	{
+		Mat image = syntheticImage(sizes[s]);
+		double best[2] = { 1e30, 1e30 };
+		vector<vector<Mat> > dog[2];
+
+		for (int mode = 0; mode < 2; mode++)
+		{
+			SIFT detector;
+			detector.setIncrementalBlur(mode == 1);
+
+			for (int r = 0; r < repeats; r++)
+			{
+				vector<vector<Mat> > pyr;
+				int64 start = getTickCount();
+				detector.buildGaussianPyramid(image, pyr);
+				best[mode] = min(best[mode], elapsedMs(start));
+
+				if (r == repeats - 1)
+					detector.buildDogPyr(pyr, dog[mode]);
+			}
+		}
+
+		double maxDiff = 0;
+		for (size_t i = 0; i < dog[0].size(); i++)
+			for (size_t j = 0; j < dog[0][i].size(); j++)
+				maxDiff = max(maxDiff, norm(dog[0][i][j], dog[1][i][j], NORM_INF));
+
+		printf("%6.0f %12.1f %12.1f %7.2fx %14.3g\n", sizes[s], best[0], best[1], best[0] / best[1], maxDiff);
+	}
+}
+
+/**
+ * Compares building the Guassian then the DOG pyramid
+ * with the fused tile by tile build, both blurring
+ * from the octave bases, on growing image sizes
+ */
+static void benchFused()
+{
+	const double sizes[] = { 1, 4, 12, 24 };
+	const int repeats = 3;
+
+	printf("%6s %12s %12s %8s %14s\n", "MP", "separate ms", "fused ms", "speedup", "max |dDoG|");
+	for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+	{
+		Mat image = syntheticImage(sizes[s]);
+		double best[2] = { 1e30, 1e30 };
+		Pyramid pyr[2];
+
+		for (int mode = 0; mode < 2; mode++)
+		{
+			SIFT detector;
+			pyr[mode].create(image.size(), SIFT_OCTVES, SIFT_INTVLS);
+
+			for (int r = 0; r < repeats; r++)
+			{
+				int64 start = getTickCount();
+				if (mode == 1)
+				{
+					detector.buildFusedPyramid(image, pyr[mode]);
+				}
+				else
+				{
+					detector.buildGaussianPyramid(image, pyr[mode]);
+					detector.buildDogPyr(pyr[mode].gauss, pyr[mode].dog);
+				}
+				best[mode] = min(best[mode], elapsedMs(start));
+			}
+		}
+
+		double maxDiff = 0;
+		for (size_t i = 0; i < pyr[0].dog.size(); i++)
+			for (size_t j = 0; j < pyr[0].dog[i].size(); j++)
+				maxDiff = max(maxDiff, norm(pyr[0].dog[i][j], pyr[1].dog[i][j], NORM_INF));
+
+		printf("%6.0f %12.1f %12.1f %7.2fx %14.3g\n", sizes[s], best[0], best[1], best[0] / best[1], maxDiff);
+	}
+}
+
+/** Returns true if both keypoint lists are identical **/
+static bool sameKeypoints(vector<KeyPoint>& a, vector<KeyPoint>& b)
+{
+	if (a.size() != b.size())
+		return false;
+
+	for (size_t i = 0; i < a.size(); i++)
+		if (a[i].pt.x != b[i].pt.x || a[i].pt.y != b[i].pt.y || a[i].size != b[i].size
+				|| a[i].angle != b[i].angle || a[i].octave != b[i].octave)
+			return false;
+
+	return true;
+}
+
+/**
+ * Compares serial and multi-threaded extraction
+ * in wall time and output, end to end and for the
+ * extrema scan alone
+ *
+ * @param threads	Number of threads of the parallel run
+ */
+static void benchThreads(int threads)
+{
+	Mat frame = syntheticFrame(12);
+	Mat image = syntheticImage(12);
+	vector<KeyPoint> keypoints[2], extrema[2];
+	double elapsed[2], extremaElapsed[2];
+
+	SIFT builder;
+	vector<vector<Mat> > pyr, dog_pyr;
+	builder.buildGaussianPyramid(image, pyr);
+	builder.buildDogPyr(pyr, dog_pyr);
+
+	for (int mode = 0; mode < 2; mode++)
+	{
+		SIFT detector;
+		detector.setThreadCount(mode == 0 ? 1 : threads);
+
+		int64 start = getTickCount();
+		detector.findSiftInterestPoint(frame, keypoints[mode]);
+		elapsed[mode] = elapsedMs(start);
+
+		start = getTickCount();
+		detector.getScaleSpaceExtrema(dog_pyr, extrema[mode]);
+		extremaElapsed[mode] = elapsedMs(start);
+	}
+
+	printf("%-10s %8s %12s %12s %8s %10s\n", "stage", "threads", "serial ms", "parallel ms", "speedup", "identical");
+	printf("%-10s %8d %12.1f %12.1f %7.2fx %10s\n", "extrema", threads, extremaElapsed[0], extremaElapsed[1],
+			extremaElapsed[0] / extremaElapsed[1], sameKeypoints(extrema[0], extrema[1]) ? "yes" : "NO");
+	printf("%-10s %8d %12.1f %12.1f %7.2fx %10s\n", "total", threads, elapsed[0], elapsed[1],
+			elapsed[0] / elapsed[1], sameKeypoints(keypoints[0], keypoints[1]) ? "yes" : "NO");
+}
+
+/**
+ * Times the 26-neighbour extremum kernel on every
+ * supported path over the first octave of a 12 MP
+ * DOG pyramid and checks the masks agree
+ */
+static void benchExtrema()
+{
+	const char* names[] = { "scalar", "sse2", "avx" };
+	const int repeats = 5;
+	Mat image = syntheticImage(12);
+
+	SIFT detector;
+	vector<vector<Mat> > pyr, dog_pyr;
+	detector.buildGaussianPyramid(image, pyr);
+	detector.buildDogPyr(pyr, dog_pyr);
+
+	vector<Mat>& octave = dog_pyr[0];
+	int rows = octave[0].rows, cols = octave[0].cols;
+	double pixels = (double) (octave.size() - 2) * (rows - 2) * (cols - 2);
+	Mat masks[3];
+
+	printf("%8s %10s %8s\n", "path", "ns/pixel", "matches");
+	for (int p = KERNEL_SCALAR; p <= KERNEL_AVX; p++)
+	{
+		if (!kernelPathSupported((KernelPath) p))
+			continue;
+
+		masks[p] = Mat::zeros(octave.size() - 2, rows * cols, CV_8U);
+		double best = 1e30;
+		for (int r = 0; r < repeats; r++)
+		{
+			int64 start = getTickCount();
+			for (size_t j = 1; j + 1 < octave.size(); j++)
+			{
+				for (int y = 1; y < rows - 1; y++)
+				{
+					const float* neighbours[9];
+					for (int k = 0; k < 9; k++)
+						neighbours[k] = octave[j - 1 + k / 3].ptr<float>(y - 1 + k % 3);
+
+					extremaRow(neighbours, masks[p].ptr<uchar>(j - 1) + y * cols, 1, cols - 1, (KernelPath) p);
+				}
+			}
+			best = min(best, elapsedMs(start));
+		}
+
+		bool same = countNonZero(masks[p] != masks[KERNEL_SCALAR]) == 0;
+		printf("%8s %10.3f %8s\n", names[p], best * 1e6 / pixels, same ? "yes" : "NO");
+	}
+}
+
+/**
+ * Times the contrast and edge tests of the raw
+ * extremas of a 12 MP DOG pyramid: one point at a
+ * time with classifyPoint, in batches with
+ * classifyPoints, and the batched test alone on
+ * every supported path. Reports candidates/s and
+ * checks the verdicts agree
+ */
+static void benchEdges()
+{
+	const char* names[] = { "scalar", "sse2", "avx" };
+	const int repeats = 5;
+	Mat image = syntheticImage(12);
+
+	SIFT detector;
+	vector<vector<Mat> > pyr, dog_pyr;
+	detector.buildGaussianPyramid(image, pyr);
+	detector.buildDogPyr(pyr, dog_pyr);
+
+	/* Raw extremas of every interval, before any test */
+	vector<Mat*> levels;
+	vector<vector<KeyPoint> > candidates;
+	int total = 0;
+	for (size_t i = 0; i < dog_pyr.size(); i++)
+	{
+		vector<Mat>& octave = dog_pyr[i];
+		vector<uchar> mask(octave[0].cols);
+		for (size_t j = 1; j + 1 < octave.size(); j++)
+		{
+			vector<KeyPoint> level;
+			for (int y = SIFT_IMG_BORDER; y < octave[0].rows - SIFT_IMG_BORDER; y++)
+			{
+				const float* neighbours[9];
+				for (int k = 0; k < 9; k++)
+					neighbours[k] = octave[j - 1 + k / 3].ptr<float>(y - 1 + k % 3);
+
+				extremaRow(neighbours, &mask[0], SIFT_IMG_BORDER, octave[0].cols - SIFT_IMG_BORDER);
+				for (int x = SIFT_IMG_BORDER; x < octave[0].cols - SIFT_IMG_BORDER; x++)
+					if (mask[x])
+						level.push_back(KeyPoint(x, y, 0));
+			}
+			levels.push_back(&octave[j]);
+			candidates.push_back(level);
+			total += level.size();
+		}
+	}
+
+	vector<vector<uchar> > single(levels.size()), batched(levels.size());
+	double bestSingle = 1e30, bestBatched = 1e30;
+	for (int r = 0; r < repeats; r++)
+	{
+		int64 start = getTickCount();
+		for (size_t l = 0; l < levels.size(); l++)
+		{
+			single[l].resize(candidates[l].size());
+			for (size_t z = 0; z < candidates[l].size(); z++)
+				single[l][z] = detector.classifyPoint(Point(candidates[l][z].pt.x, candidates[l][z].pt.y), *levels[l]);
+		}
+		bestSingle = min(bestSingle, elapsedMs(start));
+
+		start = getTickCount();
+		for (size_t l = 0; l < levels.size(); l++)
+			detector.classifyPoints(*levels[l], candidates[l], batched[l]);
+		bestBatched = min(bestBatched, elapsedMs(start));
+	}
+
+	/* The terms of the batched tests, gathered once for the kernel timings */
+	vector<float> values(4 * total);
+	float* terms[4];
+	for (int k = 0; k < 4; k++)
+		terms[k] = &values[k * total];
+
+	int z = 0;
+	for (size_t l = 0; l < levels.size(); l++)
+	{
+		const Mat& dog = *levels[l];
+		for (size_t c = 0; c < candidates[l].size(); c++, z++)
+		{
+			int y = candidates[l][c].pt.y, x = candidates[l][c].pt.x;
+			float v = dog.at<float>(y, x);
+			terms[0][z] = v;
+			terms[1][z] = dog.at<float>(y, x + 1) + dog.at<float>(y, x - 1) - 2 * v;
+			terms[2][z] = dog.at<float>(y + 1, x) + dog.at<float>(y - 1, x) - 2 * v;
+			terms[3][z] = (dog.at<float>(y + 1, x + 1) - dog.at<float>(y + 1, x - 1) - dog.at<float>(y - 1, x + 1)
+					+ dog.at<float>(y - 1, x - 1)) * 0.25f;
+		}
+	}
+
+	bool same = true;
+	int kept = 0;
+	for (size_t l = 0; l < levels.size(); l++)
+	{
+		same = same && single[l] == batched[l];
+		kept += count(batched[l].begin(), batched[l].end(), (uchar) POINT_KEPT);
+	}
+
+	printf("%d candidates, %d kept\n\n", total, kept);
+	printf("%-10s %10s %14s %8s\n", "test", "ms", "Mcandidates/s", "matches");
+	printf("%-10s %10.2f %14.1f %8s\n", "single", bestSingle, total / bestSingle / 1e3, "-");
+	printf("%-10s %10.2f %14.1f %8s\n", "batched", bestBatched, total / bestBatched / 1e3, same ? "yes" : "NO");
+
+	vector<uchar> verdicts[3];
+	for (int p = KERNEL_SCALAR; p <= KERNEL_AVX; p++)
+	{
+		if (!kernelPathSupported((KernelPath) p))
+			continue;
+
+		verdicts[p].resize(total);
+		double best = 1e30;
+		for (int r = 0; r < repeats; r++)
+		{
+			int64 start = getTickCount();
+			edgeTests(terms, &verdicts[p][0], total, SIFT_CONTR_THR, SIFT_CURV_THR, SIFT_DETER_THR, (KernelPath) p);
+			best = min(best, elapsedMs(start));
+		}
+
+		printf("%-10s %10.2f %14.1f %8s\n", names[p], best, total / best / 1e3,
+				verdicts[p] == verdicts[KERNEL_SCALAR] ? "yes" : "NO");
+	}
+}
+
+/**
+ * Runs a reused workspace over a 1080p sequence of
+ * a panning synthetic scene and reports the frame
+ * latency and the workspace memory
+ */
+static void benchVideo()
+{
+	const int nFrames = 120;
+	Mat scene = syntheticFrame(3);
+	Rect window(0, 0, 1920, 1080);
+
+	SIFT detector;
+	SIFTWorkspace workspace;
+	vector<KeyPoint> keypoints;
+	size_t firstBytes = 0;
+
+	for (int f = 0; f < nFrames; f++)
+	{
+		window.x = f % (scene.cols - window.width);
+		Mat frame = scene(window);
+		detector.findSiftInterestPoint(frame, keypoints, workspace);
+
+		if (f == 0)
+			firstBytes = workspace.stats.bytes;
+	}
+
+	SIFTStats& stats = workspace.stats;
+	printf("%8s %10s %10s %10s %14s %14s %8s\n", "frames", "mean ms", "max ms", "last ms", "first MB", "last MB",
+			"allocs");
+	printf("%8d %10.2f %10.2f %10.2f %14.2f %14.2f %8d\n", stats.frames, stats.meanMs, stats.maxMs, stats.lastMs,
+			firstBytes / 1048576.0, stats.bytes / 1048576.0, stats.reallocations);
+}
+
+/**
+ * Extracts two images in both orders with one
+ * detector, without a workspace and with a reused
+ * one, and compares the keypoints and descriptors
+ * to those of a fresh detector per image. Without
+ * a workspace the rows of both images accumulate
+ * and are split after the rows of the first one
+ */
+static void benchReuse()
+{
+	Mat images[2] = { syntheticFrame(2), syntheticFrame(1) };
+	vector<KeyPoint> fresh[2][2];
+	Mat freshRows[2][2];
+
+	/* Path 0 is the default workspace, path 1 a workspace of the caller */
+	for (int k = 0; k < 2; k++)
+	{
+		SIFT detector, workspaceDetector;
+		SIFTWorkspace workspace;
+		detector.findSiftInterestPoint(images[k], fresh[0][k]);
+		detector.computeDescriptors(freshRows[0][k]);
+		workspaceDetector.findSiftInterestPoint(images[k], fresh[1][k], workspace);
+		workspaceDetector.computeDescriptors(freshRows[1][k]);
+	}
+
+	printf("%-10s %-6s %10s %10s %10s\n", "path", "order", "keypoints", "identical", "max diff");
+	for (int order = 0; order < 2; order++)
+	{
+		int first = order, second = 1 - order;
+		vector<KeyPoint> keypoints[2];
+		Mat rows[2];
+
+		SIFT accumulating;
+		accumulating.findSiftInterestPoint(images[first], keypoints[0]);
+		accumulating.findSiftInterestPoint(images[second], keypoints[1]);
+		accumulating.computeDescriptors(rows[0]);
+		int split = min(freshRows[0][first].rows, rows[0].rows);
+		rows[1] = rows[0].rowRange(split, rows[0].rows);
+		rows[0] = rows[0].rowRange(0, split);
+
+		for (int path = 0; path < 2; path++)
+		{
+			if (path == 1)
+			{
+				SIFT reused;
+				SIFTWorkspace workspace;
+				reused.findSiftInterestPoint(images[first], keypoints[0], workspace);
+				reused.computeDescriptors(rows[0]);
+				reused.findSiftInterestPoint(images[second], keypoints[1], workspace);
+				reused.computeDescriptors(rows[1]);
+			}
+
+			bool same = sameKeypoints(keypoints[0], fresh[path][first])
+					&& sameKeypoints(keypoints[1], fresh[path][second]) && rows[0].rows == freshRows[path][first].rows
+					&& rows[1].rows == freshRows[path][second].rows;
+			double diff = -1;
+			if (same)
+				diff = max(norm(rows[0], freshRows[path][first], NORM_INF),
+						norm(rows[1], freshRows[path][second], NORM_INF));
+
+			printf("%-10s %d, %-3d %10d %10s %10g\n", path == 0 ? "default" : "workspace", first, second,
+					rows[0].rows + rows[1].rows, same && diff == 0 ? "yes" : "NO", diff);
+		}
+	}
+}
+
+/**
+ * Runs the streaming detector and the full detector
+ * over a 1080p fixed camera sequence where a small
+ * object crosses a static synthetic scene. Reports
+ * the frame latency of both, the dirty tiles, the
+ * fraction of the pyramid work that was redone and
+ * the frames whose keypoints differ
+ */
+static void benchStream()
+{
+	const int nFrames = 120;
+	Mat scene = syntheticFrame(3)(Rect(0, 0, 1920, 1080));
+
+	SIFT full, streaming;
+	SIFTWorkspace workspace;
+	SIFTStream stream(0);
+	vector<KeyPoint> expected, keypoints;
+	int mismatches = 0;
+
+	for (int f = 0; f < nFrames; f++)
+	{
+		Mat frame = scene.clone();
+		Point center(100 + f * 14, 540 + cvRound(200 * sin(f * 0.05)));
+		circle(frame, center, 24, Scalar(40, 40, 40), -1);
+		rectangle(frame, Rect(center.x - 6, center.y - 40, 12, 16), Scalar(220, 220, 220), -1);
+
+		full.findSiftInterestPoint(frame, expected, workspace);
+		streaming.findSiftInterestPoint(frame, keypoints, stream);
+
+		if (!sameKeypoints(expected, keypoints))
+			mismatches++;
+	}
+
+	SIFTStreamStats& stats = stream.stats;
+	printf("%8s %10s %10s %8s %10s %10s %10s %10s\n", "frames", "full ms", "stream ms", "speedup", "dirty", "work",
+			"keyframes", "mismatch");
+	printf("%8d %10.2f %10.2f %7.2fx %9.1f%% %9.1f%% %10d %10d\n", stats.frames, workspace.stats.meanMs,
+			stream.workspace.stats.meanMs, workspace.stats.meanMs / stream.workspace.stats.meanMs,
+			100.0 * stats.dirtyTiles / stats.tiles, 100 * stats.work(), stats.keyframes, mismatches);
+}
+
+/**
+ * Times the region extraction on a 12 MP image with
+ * 4 rectangles covering a growing part of it, next
+ * to the whole image
+ */
+static void benchRegions()
+{
+	const double fractions[] = { 0.01, 0.05, 0.25, 1 };
+	Mat frame = syntheticFrame(12);
+
+	SIFT detector;
+	vector<KeyPoint> keypoints;
+	int64 start = getTickCount();
+	detector.findSiftInterestPoint(frame, keypoints);
+	double fullMs = elapsedMs(start);
+
+	printf("%10s %10s %12s %10s\n", "area", "ms", "keypoints", "vs full");
+	for (size_t f = 0; f < sizeof(fractions) / sizeof(fractions[0]); f++)
+	{
+		/* 4 rectangles of the image aspect ratio, one per quadrant */
+		Size size(cvRound(frame.cols / 2 * sqrt(fractions[f])), cvRound(frame.rows / 2 * sqrt(fractions[f])));
+		vector<Rect> regions;
+		for (int q = 0; q < 4; q++)
+			regions.push_back(Rect(q % 2 * frame.cols / 2, q / 2 * frame.rows / 2, size.width, size.height));
+
+		start = getTickCount();
+		detector.findSiftInterestPoint(frame, keypoints, regions);
+		double ms = elapsedMs(start);
+
+		printf("%9.0f%% %10.1f %12d %9.1f%%\n", fractions[f] * 100, ms, (int) keypoints.size(), 100 * ms / fullMs);
+	}
+}
+
+/**
+ * Profiles the detector over a few runs on a 12 MP
+ * image, prints the time of every stage and the
+ * fate of the candidates of every octave and writes
+ * sift_profile.json and sift_trace.json
+ *
+ * @param threads	Number of threads of the detector
+ */
+static void benchProfile(int threads)
+{
+	const int repeats = 3;
+	Mat frame = syntheticFrame(12);
+
+	SIFT detector;
+	SIFTProfile profile(true);
+	vector<KeyPoint> keypoints;
+	SIFTWorkspace workspace;
+	detector.setThreadCount(threads);
+	detector.setProfile(&profile);
+
+	for (int r = 0; r < repeats; r++)
+		detector.findSiftInterestPoint(frame, keypoints, workspace);
+
+	double total = 0;
+	for (int s = 0; s < STAGE_COUNT; s++)
+		if (s != STAGE_CLEAN)
+			total += profile.stageMs[s];
+
+	printf("%-12s %10s %8s\n", "stage", "mean ms", "share");
+	for (int s = 0; s < STAGE_COUNT; s++)
+		printf("%-12s %10.2f %7.1f%%\n", SIFTProfile::stageName(s), profile.stageMs[s] / profile.frames,
+				100 * profile.stageMs[s] / total);
+
+	printf("\n%6s %12s %12s %12s %10s %10s %10s\n", "octave", "tested", "contrast", "curvature", "unstable", "kept",
+			"oriented");
+	for (size_t i = 0; i < profile.octaves.size(); i++)
+	{
+		const OctaveCounters& c = profile.octaves[i];
+		printf("%6d %12lld %12lld %12lld %10lld %10lld %10lld\n", (int) i, (long long) c.tested / profile.frames,
+				(long long) c.lowContrast / profile.frames, (long long) c.edges / profile.frames,
+				(long long) c.unstable / profile.frames, (long long) c.kept / profile.frames,
+				(long long) c.oriented / profile.frames);
+	}
+
+	bool written = profile.writeJson("sift_profile.json") && profile.writeTrace("sift_trace.json");
+	printf("\n%s sift_profile.json and sift_trace.json\n", written ? "wrote" : "could not write");
+}
+
+/**
+ * Fraction of the reference keypoints found again
+ * by another run: same octave and interval, within
+ * a pixel. Matched keypoints with the same angle
+ * are counted in sameAngle
+ *
+ * @param reference		Keypoints of the reference run
+ * @param other			Keypoints of the compared run
+ * @param sameAngle		Output number of matches with the same angle
+ *
+ * @return	Returns the number of reference keypoints matched
+ */
+static int repeatedKeypoints(const vector<KeyPoint>& reference, const vector<KeyPoint>& other, int& sameAngle)
+{
+	map<int64, float> angles;
+	for (size_t k = 0; k < other.size(); k++)
+	{
+		int64 key = (((int64) other[k].octave * 64 + other[k].class_id) << 40)
+				| ((int64) cvRound(other[k].pt.y) << 20) | cvRound(other[k].pt.x);
+		angles[key] = other[k].angle;
+	}
+
+	/* The same position first, then the 8 neighbours */
+	const int offsets[9][2] = { { 0, 0 }, { -1, -1 }, { 0, -1 }, { 1, -1 }, { -1, 0 }, { 1, 0 }, { -1, 1 },
+			{ 0, 1 }, { 1, 1 } };
+	int repeated = 0;
+	sameAngle = 0;
+
+	for (size_t k = 0; k < reference.size(); k++)
+	{
+		int x = cvRound(reference[k].pt.x), y = cvRound(reference[k].pt.y);
+		int64 level = ((int64) reference[k].octave * 64 + reference[k].class_id) << 40;
+		map<int64, float>::const_iterator match = angles.end();
+
+		for (int d = 0; d < 9 && match == angles.end(); d++)
+		{
+			int dx = offsets[d][0], dy = offsets[d][1];
+			if (x + dx >= 0 && y + dy >= 0)
+				match = angles.find(level | ((int64) (y + dy) << 20) | (x + dx));
+		}
+
+		if (match != angles.end())
+		{
+			repeated++;
+			sameAngle += match->second == reference[k].angle;
+		}
+	}
+
+	return repeated;
+}
+
+/**
+ * Accuracy and speed report of the 16 bit fixed point
+ * pipeline against the float one on 4 MP images of
+ * every suite pattern: best time of a few runs,
+ * pyramid memory and the repeatability of the float
+ * keypoints
+ *
+ * @param threads	Number of threads of the detectors
+ */
+static void benchFixed(int threads)
+{
+	const char* patterns[] = { "noise", "checkerboard", "blobs" };
+	const int repeats = 3;
+
+	printf("%-13s %10s %10s %8s %10s %10s %10s %10s %10s %10s\n", "pattern", "float ms", "fixed ms", "speedup",
+			"float MB", "fixed MB", "float kp", "fixed kp", "repeated", "same angle");
+	for (int p = 0; p < PATTERN_COUNT; p++)
+	{
+		Mat frame;
+		syntheticPattern(p, 4).convertTo(frame, CV_8U, 255);
+
+		vector<KeyPoint> keypoints[2];
+		double best[2] = { 1e30, 1e30 };
+		double megabytes[2];
+
+		for (int mode = 0; mode < 2; mode++)
+		{
+			SIFT detector;
+			SIFTWorkspace workspace;
+			detector.setThreadCount(threads);
+			detector.setFixedPoint(mode == 1);
+
+			for (int r = 0; r < repeats; r++)
+			{
+				keypoints[mode].clear();
+				int64 start = getTickCount();
+				detector.findSiftInterestPoint(frame, keypoints[mode], workspace);
+				best[mode] = min(best[mode], elapsedMs(start));
+			}
+			megabytes[mode] = workspace.pyramid.bytes() / (1024.0 * 1024.0);
+		}
+
+		int sameAngle;
+		int repeated = repeatedKeypoints(keypoints[0], keypoints[1], sameAngle);
+		double total = max((double) keypoints[0].size(), 1.0);
+
+		printf("%-13s %10.1f %10.1f %7.2fx %10.1f %10.1f %10d %10d %9.1f%% %9.1f%%\n", patterns[p], best[0], best[1],
+				best[0] / best[1], megabytes[0], megabytes[1], (int) keypoints[0].size(), (int) keypoints[1].size(),
+				100 * repeated / total, 100 * sameAngle / total);
+	}
+}
+
+/**
+ * Compares orienting and describing every keypoint
+ * from its own gradient window against cutting the
+ * windows out of a gradient pyramid, on 4 MP noise,
+ * checkerboard and blob images. Reports the
+ * orientation stage and descriptor times, the
+ * pyramid memory and checks both give the same
+ * angles and descriptors
+ */
+static void benchGradients(int threads)
+{
+	const char* patterns[] = { "noise", "checkerboard", "blobs" };
+	const int repeats = 3;
+
+	printf("%-13s %10s %12s %12s %10s %10s %10s %8s\n", "pattern", "keypoints", "window ms", "pyramid ms",
+			"speedup", "descr ms", "extra MB", "same");
+	for (int p = 0; p < PATTERN_COUNT; p++)
+	{
+		Mat frame;
+		syntheticPattern(p, 4).convertTo(frame, CV_8U, 255);
+
+		vector<KeyPoint> keypoints[2];
+		Mat descriptors[2];
+		double orientMs[2] = { 1e30, 1e30 }, descriptorMs[2] = { 1e30, 1e30 };
+		size_t bytes[2];
+
+		for (int mode = 0; mode < 2; mode++)
+		{
+			SIFT detector;
+			SIFTWorkspace workspace;
+			detector.setThreadCount(threads);
+			detector.setGradientPyramid(mode == 1);
+
+			for (int r = 0; r < repeats; r++)
+			{
+				SIFTProfile profile(false);
+				detector.setProfile(&profile);
+				keypoints[mode].clear();
+				detector.findSiftInterestPoint(frame, keypoints[mode], workspace);
+				orientMs[mode] = min(orientMs[mode], profile.stageMs[STAGE_ORIENTATION]);
+
+				int64 start = getTickCount();
+				detector.computeDescriptors(descriptors[mode]);
+				descriptorMs[mode] = min(descriptorMs[mode], elapsedMs(start));
+				detector.setProfile(NULL);
+			}
+			bytes[mode] = workspace.pyramid.bytes();
+		}
+
+		bool same = sameKeypoints(keypoints[0], keypoints[1]) && descriptors[0].rows == descriptors[1].rows
+				&& countNonZero(descriptors[0] != descriptors[1]) == 0;
+
+		printf("%-13s %10d %12.2f %12.2f %9.2fx %10.2f %10.1f %8s\n", patterns[p], (int) keypoints[0].size(),
+				orientMs[0], orientMs[1], orientMs[0] / orientMs[1], descriptorMs[1],
+				(bytes[1] - bytes[0]) / (1024.0 * 1024.0), same ? "yes" : "NO");
+	}
+}
+
+/**
+ * Largest errors of the fast gradient kernel on
+ * a path against the exact one: angle error in
+ * degrees, taken around the circle, and magnitude
+ * error relative to the exact magnitude
+ *
+ * @param rows			3 rows of cols + 2 samples: above, row, below
+ * @param cols			Number of gradients
+ * @param path			Kernel path of the fast kernel
+ * @param angleError	Output largest angle error
+ * @param magnitudeError	Output largest relative magnitude error
+ */
+static void fastGradientErrors(const vector<float>& rows, int cols, KernelPath path, double& angleError,
+		double& magnitudeError)
+{
+	const float* above = &rows[1];
+	const float* row = &rows[cols + 3];
+	const float* below = &rows[2 * cols + 5];
+	vector<float> magnitude[2], angle[2];
+
+	for (int k = 0; k < 2; k++)
+	{
+		magnitude[k].resize(cols);
+		angle[k].resize(cols);
+	}
+	gradientRow(above, row, below, &magnitude[0][0], &angle[0][0], 0, cols, KERNEL_SCALAR);
+	fastGradientRow(above, row, below, &magnitude[1][0], &angle[1][0], 0, cols, path);
+
+	angleError = magnitudeError = 0;
+	for (int z = 0; z < cols; z++)
+	{
+		double d = fabs((double) angle[1][z] - angle[0][z]);
+		angleError = max(angleError, min(d, 360 - d));
+		if (magnitude[0][z] > 0)
+			magnitudeError = max(magnitudeError, fabs((double) magnitude[1][z] - magnitude[0][z]) / magnitude[0][z]);
+	}
+}
+
+/**
+ * Reports the accuracy and speed of the fast gradient
+ * kernels, then their impact on the orientations: the
+ * largest angle and relative magnitude errors on
+ * random gradients, the ns per pixel of the exact and
+ * fast kernels on every supported path, and on 4 MP
+ * noise, checkerboard and blob images the keypoints
+ * whose angle changed, the largest angle change and
+ * the share of descriptor elements that differ
+ *
+ * @param threads	Number of threads of the detectors
+ */
+static void benchAtan(int threads)
+{
+	const char* names[] = { "scalar", "sse2", "avx" };
+	const char* patterns[] = { "noise", "checkerboard", "blobs" };
+	const int cols = 1 << 16, repeats = 20;
+
+	/* Random gradients, over a wide range of magnitudes */
+	vector<float> rows(3 * (cols + 2));
+	RNG rng(0x6174616e);
+	for (size_t z = 0; z < rows.size(); z++)
+		rows[z] = rng.uniform(-1.f, 1.f) * (float) pow(10.0, rng.uniform(-6.0, 2.0));
+
+	const float* above = &rows[1];
+	const float* row = &rows[cols + 3];
+	const float* below = &rows[2 * cols + 5];
+	vector<float> magnitude(cols), angle(cols);
+
+	printf("%-10s %12s %12s %12s %12s\n", "path", "exact ns/px", "fast ns/px", "angle err", "mag err");
+	for (int p = KERNEL_SCALAR; p <= KERNEL_AVX; p++)
+	{
+		if (!kernelPathSupported((KernelPath) p))
+			continue;
+
+		double best[2] = { 1e30, 1e30 };
+		for (int r = 0; r < repeats; r++)
+		{
+			int64 start = getTickCount();
+			gradientRow(above, row, below, &magnitude[0], &angle[0], 0, cols, (KernelPath) p);
+			best[0] = min(best[0], elapsedMs(start));
+
+			start = getTickCount();
+			fastGradientRow(above, row, below, &magnitude[0], &angle[0], 0, cols, (KernelPath) p);
+			best[1] = min(best[1], elapsedMs(start));
+		}
+
+		double angleError, magnitudeError;
+		fastGradientErrors(rows, cols, (KernelPath) p, angleError, magnitudeError);
+		printf("%-10s %12.3f %12.3f %12.2e %12.2e\n", names[p], best[0] * 1e6 / cols, best[1] * 1e6 / cols,
+				angleError, magnitudeError);
+	}
+
+	printf("\n%-13s %10s %10s %10s %12s %12s\n", "pattern", "exact kp", "fast kp", "changed", "max change",
+			"descr diff");
+	for (int p = 0; p < PATTERN_COUNT; p++)
+	{
+		Mat frame;
+		syntheticPattern(p, 4).convertTo(frame, CV_8U, 255);
+
+		vector<KeyPoint> keypoints[2];
+		Mat descriptors[2];
+		for (int mode = 0; mode < 2; mode++)
+		{
+			SIFT detector;
+			detector.setThreadCount(threads);
+			detector.setFastGradients(mode == 1);
+			detector.findSiftInterestPoint(frame, keypoints[mode]);
+			detector.computeDescriptors(descriptors[mode]);
+		}
+
+		/* An angle near a histogram bin edge may change peak, then the keypoints no longer pair up */
+		if (keypoints[0].size() != keypoints[1].size() || descriptors[0].rows != descriptors[1].rows)
+		{
+			printf("%-13s %10d %10d %10s %12s %12s\n", patterns[p], (int) keypoints[0].size(),
+					(int) keypoints[1].size(), "-", "-", "-");
+			continue;
+		}
+
+		int changed = 0;
+		double maxChange = 0;
+		for (size_t k = 0; k < keypoints[0].size(); k++)
+		{
+			double d = fabs((double) keypoints[1][k].angle - keypoints[0][k].angle);
+			d = min(d, 360 - d);
+			changed += d > 0;
+			maxChange = max(maxChange, d);
+		}
+
+		double elements = max((double) descriptors[0].total(), 1.0);
+		printf("%-13s %10d %10d %9.2f%% %12.2e %11.3f%%\n", patterns[p], (int) keypoints[0].size(),
+				(int) keypoints[1].size(), 100.0 * changed / max((int) keypoints[0].size(), 1), maxChange,
+				100 * countNonZero(descriptors[0] != descriptors[1]) / elements);
+	}
+}
+
+/**
+ * Times detection and descriptors on a 12 MP noise
+ * image, which has a lot of extremas, under shrinking
+ * keypoint budgets, with and without a selection grid
+ *
+ * @param threads	Number of threads of the detector
+ */
+static void benchBudget(int threads)
+{
+	const int budgets[] = { 0, 20000, 5000, 1000 };
+	Mat frame;
+	syntheticPattern(PATTERN_NOISE, 12).convertTo(frame, CV_8U, 255);
+
+	printf("%8s %6s %12s %12s %12s %12s\n", "budget", "grid", "detect ms", "descr ms", "keypoints", "cells used");
+	for (size_t b = 0; b < sizeof(budgets) / sizeof(budgets[0]); b++)
+	{
+		for (int grid = 0; grid < 2; grid++)
+		{
+			if (budgets[b] == 0 && grid == 1)
+				continue;
+
+			SIFT detector;
+			SIFTWorkspace workspace;
+			vector<KeyPoint> keypoints;
+			Mat descriptors;
+			detector.setThreadCount(threads);
+			detector.setKeypointBudget(budgets[b], grid ? Size(16, 12) : Size());
+
+			int64 start = getTickCount();
+			detector.findSiftInterestPoint(frame, keypoints, workspace);
+			double detectMs = elapsedMs(start);
+
+			start = getTickCount();
+			detector.computeDescriptors(descriptors);
+			double descriptorMs = elapsedMs(start);
+
+			/* Occupancy of a 16 x 12 grid, the spread of the keypoints */
+			Mat cells = Mat::zeros(12, 16, CV_8U);
+			for (size_t k = 0; k < keypoints.size(); k++)
+			{
+				int x = (int) keypoints[k].pt.x << keypoints[k].octave;
+				int y = (int) keypoints[k].pt.y << keypoints[k].octave;
+				cells.at<uchar>(min(y * 12 / frame.rows, 11), min(x * 16 / frame.cols, 15)) = 1;
+			}
+
+			printf("%8d %6s %12.1f %12.1f %12d %12d\n", budgets[b], grid ? "16x12" : "-", detectMs, descriptorMs,
+					(int) keypoints.size(), countNonZero(cells));
+		}
+	}
+}
+
+/** Peak resident set size of the process in megabytes **/
+static double peakRssMb()
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss / 1024.0;
+}
+
+/**
+ * Prints one JSON line with the median and the 95th
+ * percentile of the timings of a stage
+ *
+ * @param pattern		Pattern name
+ * @param size			Image size
+ * @param stage			Stage name
+ * @param times			Milliseconds of every repeat, sorted in place
+ * @param keypoints		Keypoints or descriptors out of the stage, -1 if none
+ */
+static void printSuiteLine(const char* pattern, Size size, const char* stage, vector<double>& times, int keypoints)
+{
+	sort(times.begin(), times.end());
+	int n = times.size();
+	double median = n % 2 ? times[n / 2] : (times[n / 2 - 1] + times[n / 2]) / 2;
+	double p95 = times[max((int) ceil(0.95 * n) - 1, 0)];
+
+	printf("{\"pattern\":\"%s\",\"width\":%d,\"height\":%d,\"megapixels\":%.2f,\"stage\":\"%s\","
+			"\"repeats\":%d,\"median_ms\":%.3f,\"p95_ms\":%.3f,\"mpix_per_s\":%.2f,\"keypoints\":%d,"
+			"\"peak_rss_mb\":%.1f}\n", pattern, size.width, size.height, size.area() / 1e6, stage, n, median, p95,
+			size.area() / 1e3 / median, keypoints, peakRssMb());
+	fflush(stdout);
+}
+
+/**
+ * Times every public stage of the detector and the
+ * end to end path on the noise, checkerboard and
+ * blob images from VGA to 12 MP. Every timing is
+ * repeated after a warm up run. Prints one JSON
+ * object per line: a header with the build and the
+ * machine, then one line per pattern, size and
+ * stage. The peak RSS only grows, sizes are run in
+ * increasing order so it tracks the largest one
+ *
+ * @param threads	Number of threads of the detector
+ * @param repeats	Timed runs per stage
+ */
+static void benchSuite(int threads, int repeats)
+{
+	const char* patterns[] = { "noise", "checkerboard", "blobs" };
+	const char* paths[] = { "scalar", "sse2", "avx", "avx2" };
+	const double sizes[] = { 0.3, 1, 4, 12 };
+	const char* stages[] = { "pyramid", "dog", "extrema", "orientation", "descriptors", "end_to_end" };
+	const int nStages = sizeof(stages) / sizeof(stages[0]);
+	repeats = max(repeats, 1);
+
+	printf("{\"suite\":\"sift\",\"version\":1,\"opencv\":\"%s\",\"kernels\":\"%s\",\"threads\":%d,"
+			"\"repeats\":%d}\n", CV_VERSION, paths[bestKernelPath()], threads, repeats);
+
+	for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+	{
+		for (int p = 0; p < PATTERN_COUNT; p++)
+		{
+			Mat image = syntheticPattern(p, sizes[s]);
+			Mat frame, gray;
+			image.convertTo(gray, CV_8U, 255);
+			cvtColor(gray, frame, CV_GRAY2BGR);
+
+			vector<vector<double> > times(nStages);
+			int found[nStages] = { -1, -1, 0, 0, 0, 0 };
+
+			for (int r = 0; r <= repeats; r++)
+			{
+				/* A fresh detector per run, orientation appends to its windows */
+				SIFT detector;
+				detector.setThreadCount(threads);
+				vector<vector<Mat> > pyr, dog_pyr;
+				vector<KeyPoint> keypoints;
+				Mat descriptors;
+				double ms[nStages];
+
+				int64 start = getTickCount();
+				detector.buildGaussianPyramid(image, pyr);
+				ms[0] = elapsedMs(start);
+
+				start = getTickCount();
+				detector.buildDogPyr(pyr, dog_pyr);
+				ms[1] = elapsedMs(start);
+
+				start = getTickCount();
+				detector.getScaleSpaceExtrema(dog_pyr, keypoints);
+				ms[2] = elapsedMs(start);
+				found[2] = keypoints.size();
+
+				start = getTickCount();
+				detector.computeOrientationHist(dog_pyr, keypoints);
+				ms[3] = elapsedMs(start);
+				found[3] = keypoints.size();
+
+				start = getTickCount();
+				detector.computeDescriptors(descriptors);
+				ms[4] = elapsedMs(start);
+				found[4] = descriptors.rows;
+
+				SIFT endToEnd;
+				endToEnd.setThreadCount(threads);
+				start = getTickCount();
+				endToEnd.findSiftInterestPoint(frame, keypoints);
+				endToEnd.computeDescriptors(descriptors);
+				ms[5] = elapsedMs(start);
+				found[5] = descriptors.rows;
+
+				if (r > 0)
+					for (int k = 0; k < nStages; k++)
+						times[k].push_back(ms[k]);
+			}
+
+			for (int k = 0; k < nStages; k++)
+				printSuiteLine(patterns[p], image.size(), stages[k], times[k], found[k]);
+		}
+	}
+}
+
+/**
+ * The original downsampling: a full size blur then
+ * column and row copies through a temporary image
+ *
+ * @param image		The input image to downsample
+ *
+ * @return	Returns the resized image
+ */
+static Mat stridedDownSample(Mat& image)
+{
+	Mat blurredImage;
+	GaussianBlur(image, blurredImage, Size(0, 0), INTERPOLATION_SIGMA, 0);
+
+	Mat temp = Mat(Size(blurredImage.cols / 2, blurredImage.rows), image.type());
+	for (int i = 0; i < temp.cols; i++)
+		blurredImage.col(i * 2).copyTo(temp.col(i));
+
+	Mat resizedImage = Mat(Size(temp.cols, temp.rows / 2), image.type());
+	for (int i = 0; i < resizedImage.rows; i++)
+		temp.row(i * 2).copyTo(resizedImage.row(i));
+
+	return resizedImage;
+}
+
+/**
+ * Compares the fused blur and decimation kernel with
+ * the blur then strided copies downsampling
+ */
+static void benchDownSample()
+{
+	const double sizes[] = { 1, 4, 12, 24 };
+	const int repeats = 5;
+
+	printf("%6s %12s %12s %8s %14s\n", "MP", "strided ms", "fused ms", "speedup", "max |diff|");
+	for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+	{
+		Mat image = syntheticImage(sizes[s]);
+		Mat strided, fused;
+		vector<float> rowBuffer(image.cols);
+		double best[2] = { 1e30, 1e30 };
+
+		for (int r = 0; r < repeats; r++)
+		{
+			int64 start = getTickCount();
+			strided = stridedDownSample(image);
+			best[0] = min(best[0], elapsedMs(start));
+
+			start = getTickCount();
+			blurDecimate(image, fused, INTERPOLATION_SIGMA, &rowBuffer[0]);
+			best[1] = min(best[1], elapsedMs(start));
+		}
+
+		printf("%6.0f %12.2f %12.2f %7.2fx %14.3g\n", sizes[s], best[0], best[1], best[0] / best[1],
+				norm(strided, fused, NORM_INF));
+	}
+}
+
+/**
+ * Writes random feature files, checks they read
+ * back identical and times opening them all with
+ * a pass over every descriptor
+ */
+static void benchFeatureFiles()
+{
+	const int nFiles = 200, nFeatures = 4000;
+	RNG rng(0x5149f7);
+	vector<KeyPoint> keypoints;
+	Mat descriptors(nFeatures, SIFT_DESCR_LENGTH, CV_8U);
+
+	for (int i = 0; i < nFeatures; i++)
+		keypoints.push_back(KeyPoint(rng.uniform(0.f, 640.f), rng.uniform(0.f, 480.f), rng.uniform(1, 6),
+				rng.uniform(0.f, 360.f), rng.uniform(0.f, 1.f), rng.uniform(0, 4)));
+	rng.fill(descriptors, RNG::UNIFORM, Scalar(0), Scalar(256));
+
+	char path[64];
+	int64 start = getTickCount();
+	for (int f = 0; f < nFiles; f++)
+	{
+		sprintf(path, "bench_features_%d.sift", f);
+		FeatureFile::save(path, keypoints, descriptors, Size(640, 480), path);
+	}
+	double saveMs = elapsedMs(start);
+
+	FeatureFile file;
+	vector<KeyPoint> loaded;
+	bool roundTrip = file.open("bench_features_0.sift") && file.count() == nFeatures
+			&& file.imageSize() == Size(640, 480) && file.metadata() == "bench_features_0.sift";
+	if (roundTrip)
+	{
+		file.getKeypoints(loaded);
+		roundTrip = countNonZero(file.descriptors() != descriptors) == 0;
+		for (int i = 0; i < nFeatures && roundTrip; i++)
+			roundTrip = loaded[i].pt.x == keypoints[i].pt.x && loaded[i].pt.y == keypoints[i].pt.y
+					&& loaded[i].size == keypoints[i].size && loaded[i].angle == keypoints[i].angle
+					&& loaded[i].response == keypoints[i].response && loaded[i].octave == keypoints[i].octave;
+	}
+	file.close();
+
+	size_t checksum = 0, bytes = 0;
+	start = getTickCount();
+	for (int f = 0; f < nFiles; f++)
+	{
+		sprintf(path, "bench_features_%d.sift", f);
+		if (!file.open(path))
+			continue;
+
+		Mat rows = file.descriptors();
+		for (int i = 0; i < rows.rows; i++)
+			checksum += rows.ptr(i)[0];
+		bytes += rows.total() + file.count() * sizeof(FeatureKeypoint);
+		file.close();
+	}
+	double loadMs = elapsedMs(start);
+
+	for (int f = 0; f < nFiles; f++)
+	{
+		sprintf(path, "bench_features_%d.sift", f);
+		remove(path);
+	}
+
+	printf("round trip  %s\n", roundTrip ? "ok" : "FAILED");
+	printf("save        %.1f ms for %d files\n", saveMs, nFiles);
+	printf("load        %.1f ms, %.0f files/s, %.0f features/s, %.0f MB/s (checksum %lu)\n", loadMs,
+			nFiles * 1000.0 / loadMs, (double) nFiles * nFeatures * 1000.0 / loadMs, bytes / 1048.576 / loadMs,
+			(unsigned long) checksum);
+}
+
+/**
+ * Generates descriptor-like rows: random cluster
+ * centres plus noise, clamped to the uint8 range
+ *
+ * @param rows			Number of rows
+ * @param centres		Cluster centres, generated if empty
+ * @param rng			Random generator
+ *
+ * @return	Returns rows x SIFT_DESCR_LENGTH float descriptors
+ */
+static Mat syntheticDescriptors(int rows, Mat& centres, RNG& rng)
+{
+	if (centres.empty())
+	{
+		centres.create(256, SIFT_DESCR_LENGTH, CV_32F);
+		rng.fill(centres, RNG::UNIFORM, Scalar(0), Scalar(128));
+	}
+
+	Mat descriptors(rows, SIFT_DESCR_LENGTH, CV_32F);
+	rng.fill(descriptors, RNG::NORMAL, Scalar(0), Scalar(12));
+	for (int i = 0; i < rows; i++)
+	{
+		const float* centre = centres.ptr<float>(rng.uniform(0, centres.rows));
+		float* row = descriptors.ptr<float>(i);
+		for (int d = 0; d < SIFT_DESCR_LENGTH; d++)
+			row[d] = min(max(row[d] + centre[d], 0.f), 255.f);
+	}
+
+	return descriptors;
+}
+
+/**
+ * Matches 10k query descriptors against 10k train
+ * descriptors with the ratio test and cross check
+ *
+ * @param threads	Number of threads of the parallel run
+ */
+static void benchMatch(int threads)
+{
+	const int n = 10000;
+	RNG rng(0x5149f7);
+	Mat centres;
+	Mat train = syntheticDescriptors(n, centres, rng);
+	Mat query = syntheticDescriptors(n, centres, rng);
+
+	printf("%8s %10s %12s %14s %10s\n", "threads", "ms", "queries/s", "Gdistances/s", "matches");
+	int counts[] = { 1, threads };
+	for (int i = 0; i < 2; i++)
+	{
+		SIFTMatcher matcher(SIFT_MATCH_RATIO, true, counts[i]);
+		vector<DMatch> matches;
+
+		int64 start = getTickCount();
+		matcher.match(query, train, matches);
+		double ms = elapsedMs(start);
+
+		printf("%8d %10.1f %12.0f %14.3f %10lu\n", counts[i], ms, n * 1000.0 / ms, 2.0 * n * n / ms / 1e6,
+				(unsigned long) matches.size());
+	}
+}
+
+/**
+ * Builds a KD-forest over 200k descriptors and
+ * searches 2000 perturbed database rows with a
+ * growing check budget. Recall@1 is measured
+ * against the brute force matcher
+ *
+ * @param threads	Number of threads of the parallel runs
+ */
+static void benchIndex(int threads)
+{
+	const int n = 200000, nQueries = 2000;
+	RNG rng(0x5149f7);
+	Mat centres;
+	Mat database = syntheticDescriptors(n, centres, rng);
+	Mat query(nQueries, SIFT_DESCR_LENGTH, CV_32F);
+	rng.fill(query, RNG::NORMAL, Scalar(0), Scalar(8));
+	for (int i = 0; i < nQueries; i++)
+	{
+		const float* source = database.ptr<float>(rng.uniform(0, n));
+		float* row = query.ptr<float>(i);
+		for (int d = 0; d < SIFT_DESCR_LENGTH; d++)
+			row[d] += source[d];
+	}
+
+	SIFTMatcher matcher(1, false, threads);
+	vector<DMatch> exact;
+	int64 start = getTickCount();
+	matcher.match(query, database, exact);
+	double bruteMs = elapsedMs(start);
+
+	KDForest forest(SIFT_KD_TREES, SIFT_KD_CHECKS, threads);
+	start = getTickCount();
+	forest.build(database);
+	double buildMs = elapsedMs(start);
+
+	printf("brute force %.1f ms, %.0f queries/s\n", bruteMs, nQueries * 1000.0 / bruteMs);
+	printf("build       %.1f ms for %d descriptors, %d trees\n", buildMs, n, SIFT_KD_TREES);
+	printf("%8s %10s %14s %14s\n", "checks", "recall@1", "queries/s", "queries/s MT");
+
+	int checks[] = { 32, 64, 128, 256, 512, 1024 };
+	for (int c = 0; c < 6; c++)
+	{
+		forest.setChecks(checks[c]);
+		vector<vector<DMatch> > matches;
+		double ms[2];
+
+		for (int run = 0; run < 2; run++)
+		{
+			forest.setThreadCount(run == 0 ? 1 : threads);
+			start = getTickCount();
+			forest.knnMatch(query, matches, 1);
+			ms[run] = elapsedMs(start);
+		}
+
+		int hits = 0;
+		for (int i = 0; i < nQueries; i++)
+			hits += !matches[i].empty() && matches[i][0].trainIdx == exact[i].trainIdx;
+
+		printf("%8d %10.3f %14.0f %14.0f\n", checks[c], hits / (double) nQueries, nQueries * 1000.0 / ms[0],
+				nQueries * 1000.0 / ms[1]);
+	}
+
+	const char* path = "bench_index.kdf";
+	vector<vector<DMatch> > built, loaded;
+	forest.setChecks(SIFT_KD_CHECKS);
+	forest.knnMatch(query, built, 2);
+	forest.save(path);
+
+	KDForest mapped(SIFT_KD_TREES, SIFT_KD_CHECKS, threads);
+	start = getTickCount();
+	bool ok = mapped.load(path);
+	double loadMs = elapsedMs(start);
+	if (ok)
+		mapped.knnMatch(query, loaded, 2);
+	remove(path);
+
+	for (int i = 0; ok && i < nQueries; i++)
+	{
+		ok = built[i].size() == loaded[i].size();
+		for (size_t k = 0; ok && k < built[i].size(); k++)
+			ok = built[i][k].trainIdx == loaded[i][k].trainIdx;
+	}
+	printf("save/load   %s, load %.1f ms\n", ok ? "ok" : "FAILED", loadMs);
+}
+
+/**
+ * Trains IVF-PQ indexes with 8 and 16 byte codes
+ * over 200k descriptors and searches 2000
+ * perturbed database rows with a growing number
+ * of probes, from memory and from a mapped file.
+ * Recall is measured against the brute force
+ * matcher
+ *
+ * @param threads	Number of threads of the parallel runs
+ */
+static void benchIVFPQ(int threads)
+{
+	const int n = 200000, nQueries = 2000, nSamples = 50000, lists = 256;
+	RNG rng(0x5149f7);
+	Mat centres;
+	Mat database = syntheticDescriptors(n, centres, rng);
+	Mat query(nQueries, SIFT_DESCR_LENGTH, CV_32F);
+	rng.fill(query, RNG::NORMAL, Scalar(0), Scalar(8));
+	for (int i = 0; i < nQueries; i++)
+	{
+		const float* source = database.ptr<float>(rng.uniform(0, n));
+		float* row = query.ptr<float>(i);
+		for (int d = 0; d < SIFT_DESCR_LENGTH; d++)
+			row[d] += source[d];
+	}
+
+	SIFTMatcher matcher(1, false, threads);
+	vector<DMatch> exact;
+	matcher.match(query, database, exact);
+
+	int codeBytes[] = { 8, 16 };
+	for (int m = 0; m < 2; m++)
+	{
+		IVFPQIndex index(SIFT_IVF_PROBES, threads);
+		int64 start = getTickCount();
+		index.train(database.rowRange(0, nSamples), lists, codeBytes[m]);
+		double trainMs = elapsedMs(start);
+
+		start = getTickCount();
+		index.add(database);
+		double addMs = elapsedMs(start);
+
+		const char* path = "bench_index.ivf";
+		index.save(path);
+		IVFPQIndex mapped(SIFT_IVF_PROBES, threads);
+		bool loaded = mapped.load(path);
+
+		printf("\n%d byte codes, %d lists: train %.1f ms, add %.0f vectors/s, %.2f bytes per vector, load %s\n",
+				codeBytes[m], lists, trainMs, n * 1000.0 / addMs, index.listBytes() / (double) index.size(),
+				loaded ? "ok" : "FAILED");
+		printf("%8s %10s %10s %14s %14s %14s\n", "probes", "recall@1", "recall@10", "queries/s", "queries/s MT",
+				"mapped MT");
+
+		int probes[] = { 1, 4, 16, 64 };
+		for (int p = 0; p < 4; p++)
+		{
+			vector<vector<DMatch> > matches, mappedMatches;
+			double ms[3];
+
+			index.setProbes(probes[p]);
+			mapped.setProbes(probes[p]);
+			for (int run = 0; run < 3; run++)
+			{
+				index.setThreadCount(run == 0 ? 1 : threads);
+				start = getTickCount();
+				if (run < 2)
+					index.knnMatch(query, matches, 10);
+				else if (loaded)
+					mapped.knnMatch(query, mappedMatches, 10);
+				ms[run] = elapsedMs(start);
+			}
+
+			int hits1 = 0, hits10 = 0;
+			for (int i = 0; i < nQueries; i++)
+			{
+				for (size_t k = 0; k < matches[i].size(); k++)
+				{
+					if (matches[i][k].trainIdx != exact[i].trainIdx)
+						continue;
+					hits1 += k == 0;
+					hits10++;
+				}
+			}
+
+			printf("%8d %10.3f %10.3f %14.0f %14.0f %14.0f\n", probes[p], hits1 / (double) nQueries,
+					hits10 / (double) nQueries, nQueries * 1000.0 / ms[0], nQueries * 1000.0 / ms[1],
+					nQueries * 1000.0 / ms[2]);
+		}
+
+		mapped.release();
+		remove(path);
+	}
+}
+
+/**
+ * Trains a 10^4 word vocabulary tree, times the
+ * quantization of descriptors and the queries of
+ * a database of synthetic images. Images are 300
+ * words with a skewed word distribution, a query
+ * keeps 70% of the words of a database image
+ *
+ * @param threads	Number of threads of the parallel runs
+ * @param nImages	Number of database images
+ */
+static void benchVocabulary(int threads, int nImages)
+{
+	const int nSamples = 50000, nFeatures = 300, nQueries = 200, queryFeatures = 1000;
+	RNG rng(0x5149f7);
+	Mat centres;
+	Mat samples = syntheticDescriptors(nSamples, centres, rng);
+
+	VocabularyTree tree(10, 4, threads);
+	int64 start = getTickCount();
+	tree.train(samples);
+	printf("train       %.1f ms, %d words\n", elapsedMs(start), tree.words());
+
+	vector<int> wordIds;
+	for (int run = 0; run < 2; run++)
+	{
+		tree.setThreadCount(run == 0 ? 1 : threads);
+		start = getTickCount();
+		tree.quantize(samples, wordIds);
+		double ms = elapsedMs(start);
+		printf("quantize    %d threads: %.0f descriptors/s\n", run == 0 ? 1 : threads, nSamples * 1000.0 / ms);
+	}
+
+	Mat queryDescriptors = samples.rowRange(0, queryFeatures);
+	start = getTickCount();
+	for (int q = 0; q < nQueries; q++)
+		tree.quantize(queryDescriptors, wordIds);
+	double quantizeMs = elapsedMs(start) / nQueries;
+
+	vector<vector<int> > images(nImages);
+	start = getTickCount();
+	for (int i = 0; i < nImages; i++)
+	{
+		images[i].resize(nFeatures);
+		for (int f = 0; f < nFeatures; f++)
+			images[i][f] = (int) (pow(rng.uniform(0.f, 1.f), 2.f) * tree.words());
+		tree.addImage(images[i]);
+	}
+	double addMs = elapsedMs(start);
+	start = getTickCount();
+	tree.updateWeights();
+	printf("database    %d images, add %.1f ms, weights %.1f ms\n", nImages, addMs, elapsedMs(start));
+
+	vector<double> latencies;
+	int hits = 0;
+	for (int q = 0; q < nQueries; q++)
+	{
+		int source = rng.uniform(0, nImages);
+		vector<int> queryWords(images[source]);
+		for (int f = 0; f < nFeatures; f++)
+			if (rng.uniform(0.f, 1.f) < 0.3f)
+				queryWords[f] = rng.uniform(0, tree.words());
+
+		vector<pair<int, float> > results;
+		start = getTickCount();
+		tree.query(queryWords, results, 10);
+		latencies.push_back(elapsedMs(start));
+		hits += !results.empty() && results[0].first == source;
+	}
+
+	sort(latencies.begin(), latencies.end());
+	double scoreMs = latencies[latencies.size() / 2];
+	printf("query       quantize %d descriptors %.2f ms + score median %.2f ms, p95 %.2f ms = %.2f ms\n",
+			queryFeatures, quantizeMs, scoreMs, latencies[latencies.size() * 95 / 100], quantizeMs + scoreMs);
+	printf("top-1       %.3f\n", hits / (double) nQueries);
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		help();
+		return 1;
+	}
+
+	string mode = argv[1];
+	if (mode == "pyramid")
+	{
+		benchPyramid();
+	}
+	else if (mode == "fused")
+	{
+		benchFused();
+	}
+	else if (mode == "threads")
+	{
+		benchThreads(argc > 2 ? atoi(argv[2]) : getNumberOfCPUs());
+	}
+	else if (mode == "extrema")
+	{
+		benchExtrema();
+	}
+	else if (mode == "edges")
+	{
+		benchEdges();
+	}
+	else if (mode == "video")
+	{
+		benchVideo();
+	}
+	else if (mode == "reuse")
+	{
+		benchReuse();
+	}
+	else if (mode == "stream")
+	{
+		benchStream();
+	}
+	else if (mode == "roi")
+	{
+		benchRegions();
+	}
+	else if (mode == "profile")
+	{
+		benchProfile(argc > 2 ? atoi(argv[2]) : getNumberOfCPUs());
+	}
+	else if (mode == "suite")
+	{
+		benchSuite(argc > 2 ? atoi(argv[2]) : getNumberOfCPUs(), argc > 3 ? atoi(argv[3]) : 5);
+	}
+	else if (mode == "budget")
+	{
+		benchBudget(argc > 2 ? atoi(argv[2]) : getNumberOfCPUs());
+	}
+	else if (mode == "fixed")
+	{
+		benchFixed(argc > 2 ? atoi(argv[2]) : getNumberOfCPUs());
+	}
+	else if (mode == "gradients")
+	{
+		benchGradients(argc > 2 ? atoi(argv[2]) : getNumberOfCPUs());
+	}
+	else if (mode == "atan")
+	{
+		benchAtan(argc > 2 ? atoi(argv[2]) : getNumberOfCPUs());
+	}
+	else if (mode == "downsample")
+	{
+		benchDownSample();
+	}
+	else if (mode == "features")
+	{
+		benchFeatureFiles();
+	}
+	else if (mode == "match")
+	{
+		benchMatch(argc > 2 ? atoi(argv[2]) : getNumberOfCPUs());
+	}
+	else if (mode == "index")
+	{
+		benchIndex(argc > 2 ? atoi(argv[2]) : getNumberOfCPUs());
+	}
+	else if (mode == "ivfpq")
+	{
+		benchIVFPQ(argc > 2 ? atoi(argv[2]) : getNumberOfCPUs());
+	}
+	else if (mode == "vocab")
+	{
+		benchVocabulary(argc > 2 ? atoi(argv[2]) : getNumberOfCPUs(), argc > 3 ? atoi(argv[3]) : 100000);
+	}
+	else
+	{
+		help();
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,363 @@
+/*
+ * FeatureFile.cpp
+ *
+ *  Created on: Oct 15, 2026
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "FeatureFile.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+MappedFile::MappedFile()
+{
+	base = NULL;
+	length = 0;
+}
+
+
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+
+
+/**
+ * Maps a whole file read only. Without mmap the
+ * file is read into a buffer instead
+ *
+ * @param path		File path
+ *
+ * @return	false if the file cannot be read
+ */
+bool MappedFile::open(const string& path)
+{
+	close();
+
+#ifndef _WIN32
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size == 0)
+	{
+		::close(fd);
+		return false;
+	}
+
+	void* mapped = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (mapped == MAP_FAILED)
+		return false;
+
+	base = (uchar*) mapped;
+	length = info.st_size;
+#else
+	FILE* f = fopen(path.c_str(), "rb");
+	if (!f)
+		return false;
+
+	fseek(f, 0, SEEK_END);
+	long fileSize = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	if (fileSize <= 0)
+	{
+		fclose(f);
+		return false;
+	}
+
+	buffer.create(1, fileSize, CV_8U);
+	size_t read = fread(buffer.ptr(), 1, fileSize, f);
+	fclose(f);
+	if (read != (size_t) fileSize)
+	{
+		buffer.release();
+		return false;
+	}
+
+	base = buffer.ptr();
+	length = fileSize;
+#endif
+
+	return true;
+}
+
+
+
+/**
+ * Unmaps the file
+ */
+void MappedFile::close()
+{
+#ifndef _WIN32
+	if (base)
+		munmap(base, length);
+#endif
+
+	buffer.release();
+	base = NULL;
+	length = 0;
+}
+
+
+
+/**
+ * First byte of the file
+ *
+ * @return	Returns NULL if no file is open
+ */
+const uchar* MappedFile::data() const
+{
+	return base;
+}
+
+
+
+/**
+ * Size of the file in bytes
+ *
+ * @return	Returns 0 if no file is open
+ */
+size_t MappedFile::size() const
+{
+	return length;
+}
+
+
+
+FeatureFile::FeatureFile()
+{
+	header = NULL;
+}
+
+
+
+/** Pads the file with zeros up to the next aligned offset **/
+static uint64 padTo(FILE* f, uint64 offset)
+{
+	static const char zeros[FEATURE_FILE_ALIGN] = { 0 };
+	uint64 aligned = alignSize(offset, FEATURE_FILE_ALIGN);
+
+	fwrite(zeros, 1, aligned - offset, f);
+	return aligned;
+}
+
+
+
+/**
+ * Writes keypoints, descriptors and optional image
+ * metadata to a versioned binary feature file
+ *
+ * @param path			File path
+ * @param keypoints		Keypoints, one per descriptor row
+ * @param descriptors	Descriptor rows, CV_32F or CV_8U
+ * @param imageSize		Size of the source image
+ * @param metadata		Free form metadata, like the source path
+ *
+ * @return	false if the file cannot be written
+ */
+bool FeatureFile::save(const string& path, const vector<KeyPoint>& keypoints, const Mat& descriptors,
+		Size imageSize, const string& metadata)
+{
+	CV_Assert(descriptors.empty() || (int) keypoints.size() == descriptors.rows);
+	CV_Assert(descriptors.empty() || descriptors.type() == CV_32F || descriptors.type() == CV_8U);
+
+	FeatureFileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, FEATURE_FILE_MAGIC, sizeof(header.magic));
+
+	size_t rowBytes = descriptors.cols * descriptors.elemSize();
+	header.version = FEATURE_FILE_VERSION;
+	header.headerSize = sizeof(FeatureFileHeader);
+	header.count = keypoints.size();
+	header.descriptorLength = descriptors.cols;
+	header.descriptorType = descriptors.empty() ? CV_8U : descriptors.type();
+	header.imageWidth = imageSize.width;
+	header.imageHeight = imageSize.height;
+	header.keypointSize = sizeof(FeatureKeypoint);
+	header.keypointOffset = alignSize(sizeof(FeatureFileHeader), FEATURE_FILE_ALIGN);
+	header.descriptorOffset = alignSize(header.keypointOffset + (uint64) header.count * sizeof(FeatureKeypoint),
+			FEATURE_FILE_ALIGN);
+	header.metadataOffset = alignSize(header.descriptorOffset + (uint64) header.count * rowBytes, FEATURE_FILE_ALIGN);
+	header.metadataSize = metadata.size();
+	header.fileSize = header.metadataOffset + header.metadataSize;
+
+	FILE* f = fopen(path.c_str(), "wb");
+	if (!f)
+		return false;
+
+	fwrite(&header, sizeof(header), 1, f);
+	uint64 offset = padTo(f, sizeof(header));
+
+	for (size_t i = 0; i < keypoints.size(); i++)
+	{
+		FeatureKeypoint record;
+		record.x = keypoints[i].pt.x;
+		record.y = keypoints[i].pt.y;
+		record.size = keypoints[i].size;
+		record.angle = keypoints[i].angle;
+		record.response = keypoints[i].response;
+		record.octave = keypoints[i].octave;
+		record.classId = keypoints[i].class_id;
+		record.reserved = 0;
+		fwrite(&record, sizeof(record), 1, f);
+	}
+	offset = padTo(f, offset + keypoints.size() * sizeof(FeatureKeypoint));
+
+	for (int i = 0; i < descriptors.rows; i++)
+		fwrite(descriptors.ptr(i), 1, rowBytes, f);
+	padTo(f, offset + (uint64) descriptors.rows * rowBytes);
+
+	fwrite(metadata.data(), 1, metadata.size(), f);
+
+	bool ok = !ferror(f);
+	ok = fclose(f) == 0 && ok;
+	return ok;
+}
+
+
+
+/**
+ * Maps a feature file and validates its header
+ * and block bounds
+ *
+ * @param path		File path
+ *
+ * @return	false if the file is missing, truncated or of another version
+ */
+bool FeatureFile::open(const string& path)
+{
+	close();
+
+	if (!file.open(path) || file.size() < sizeof(FeatureFileHeader))
+		return false;
+
+	const FeatureFileHeader* h = (const FeatureFileHeader*) file.data();
+	size_t elemSize = h->descriptorType == CV_32F ? sizeof(float) : 1;
+	bool valid = memcmp(h->magic, FEATURE_FILE_MAGIC, sizeof(h->magic)) == 0
+			&& h->version == FEATURE_FILE_VERSION
+			&& h->headerSize == sizeof(FeatureFileHeader)
+			&& h->keypointSize == sizeof(FeatureKeypoint)
+			&& (h->descriptorType == CV_32F || h->descriptorType == CV_8U)
+			&& h->fileSize == file.size()
+			&& h->keypointOffset + (uint64) h->count * sizeof(FeatureKeypoint) <= h->descriptorOffset
+			&& h->descriptorOffset + (uint64) h->count * h->descriptorLength * elemSize <= h->metadataOffset
+			&& h->metadataOffset + h->metadataSize <= h->fileSize;
+
+	if (!valid)
+	{
+		file.close();
+		return false;
+	}
+
+	header = h;
+	return true;
+}
+
+
+
+/**
+ * Unmaps the file
+ */
+void FeatureFile::close()
+{
+	file.close();
+	header = NULL;
+}
+
+
+
+/**
+ * Number of keypoints and descriptors
+ *
+ * @return	Returns 0 if no file is open
+ */
+int FeatureFile::count() const
+{
+	return header ? header->count : 0;
+}
+
+
+
+/**
+ * Keypoint records of the mapped file
+ *
+ * @return	Returns count() records, valid until close()
+ */
+const FeatureKeypoint* FeatureFile::keypoints() const
+{
+	return header ? (const FeatureKeypoint*) (file.data() + header->keypointOffset) : NULL;
+}
+
+
+
+/**
+ * Converts the keypoint records to KeyPoints
+ *
+ * @param keypoints		Keypoints vector
+ *
+ * @return	Replaces keypoints with the records of the file
+ */
+void FeatureFile::getKeypoints(vector<KeyPoint>& keypoints) const
+{
+	const FeatureKeypoint* records = this->keypoints();
+
+	keypoints.resize(count());
+	for (int i = 0; i < count(); i++)
+		keypoints[i] = KeyPoint(records[i].x, records[i].y, records[i].size, records[i].angle,
+				records[i].response, records[i].octave, records[i].classId);
+}
+
+
+
+/**
+ * Descriptor rows as a matrix header over the
+ * mapped file. The data must not be written and
+ * is valid until close()
+ *
+ * @return	Returns count() x descriptorLength rows
+ */
+Mat FeatureFile::descriptors() const
+{
+	if (!header || header->count == 0)
+		return Mat();
+
+	return Mat(header->count, header->descriptorLength, header->descriptorType,
+			(void*) (file.data() + header->descriptorOffset));
+}
+
+
+
+/**
+ * Size of the image the features were extracted from
+ *
+ * @return	Returns an empty size if not recorded
+ */
+Size FeatureFile::imageSize() const
+{
+	return header ? Size(header->imageWidth, header->imageHeight) : Size();
+}
+
+
+
+/**
+ * Metadata string stored with the features
+ *
+ * @return	Returns an empty string if none was stored
+ */
+string FeatureFile::metadata() const
+{
+	if (!header)
+		return string();
+
+	return string((const char*) file.data() + header->metadataOffset, header->metadataSize);
+}
@@ -0,0 +1,126 @@
+/*
+ * FeatureFile.h
+ *
+ *  Created on: Oct 15, 2026
+ */
+
+#ifndef FEATURE_FILE_H
+#define FEATURE_FILE_H
+
+#include "opencv2/opencv.hpp"
+
+using namespace std;
+using namespace cv;
+
+#define FEATURE_FILE_MAGIC					"SIFTFEAT"
+#define FEATURE_FILE_VERSION				1
+#define FEATURE_FILE_ALIGN					64
+
+/**
+ * Header at offset 0 of a feature file. Blocks are
+ * stored in native byte order at 64 byte aligned
+ * offsets: keypoint records, descriptor rows and
+ * an optional metadata string
+ */
+struct FeatureFileHeader
+{
+	char magic[8];
+	unsigned int version;
+	unsigned int headerSize;
+	unsigned int count;
+	unsigned int descriptorLength;
+	unsigned int descriptorType;
+	unsigned int imageWidth;
+	unsigned int imageHeight;
+	unsigned int keypointSize;
+	uint64 keypointOffset;
+	uint64 descriptorOffset;
+	uint64 metadataOffset;
+	uint64 metadataSize;
+	uint64 fileSize;
+};
+
+/** On disk record of a keypoint **/
+struct FeatureKeypoint
+{
+	float x, y;
+	float size;
+	float angle;
+	float response;
+	int octave;
+	int classId;
+	int reserved;
+};
+
+/** Read only view of a whole file, memory mapped where available **/
+class MappedFile
+{
+private:
+	uchar* base;
+	size_t length;
+	Mat buffer;
+
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+
+public:
+	MappedFile();
+	~MappedFile();
+
+	/** Maps the file, returns false if it cannot be read **/
+	bool open(const string& path);
+
+	/** Unmaps the file **/
+	void close();
+
+	/** First byte of the file **/
+	const uchar* data() const;
+
+	/** Size of the file in bytes **/
+	size_t size() const;
+};
+
+/**
+ * A feature file opened for reading. Keypoints and
+ * descriptors are served straight from the mapped
+ * file without parsing or copying
+ */
+class FeatureFile
+{
+private:
+	MappedFile file;
+	const FeatureFileHeader* header;
+
+public:
+	FeatureFile();
+
+	/** Writes keypoints, descriptors and optional image metadata to a file **/
+	static bool save(const string& path, const vector<KeyPoint>& keypoints, const Mat& descriptors,
+			Size imageSize = Size(), const string& metadata = string());
+
+	/** Maps and validates a feature file **/
+	bool open(const string& path);
+
+	/** Unmaps the file **/
+	void close();
+
+	/** Number of keypoints and descriptors **/
+	int count() const;
+
+	/** Keypoint records of the mapped file **/
+	const FeatureKeypoint* keypoints() const;
+
+	/** Converts the keypoint records to KeyPoints **/
+	void getKeypoints(vector<KeyPoint>& keypoints) const;
+
+	/** Descriptor rows as a matrix header over the mapped file **/
+	Mat descriptors() const;
+
+	/** Size of the image the features were extracted from **/
+	Size imageSize() const;
+
+	/** Metadata string stored with the features **/
+	string metadata() const;
+};
+
+#endif
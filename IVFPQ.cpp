@@ -0,0 +1,635 @@
+/*
+ * IVFPQ.cpp
+ *
+ *  Created on: Oct 15, 2026
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <float.h>
+#include <algorithm>
+#include "IVFPQ.h"
+#include "SIFTKernels.h"
+
+/**
+ * Finds the list and the PQ code of a range of
+ * rows per task
+ */
+class IVFPQIndex::EncodeInvoker : public ParallelLoopBody
+{
+public:
+	EncodeInvoker(const IVFPQIndex& _index, const Mat& _rows, vector<int>& _lists, vector<uchar>& _codes) :
+			index(_index), rows(_rows), lists(_lists), codes(_codes)
+	{
+	}
+
+	void operator()(const Range& range) const
+	{
+		vector<float> residual(rows.cols);
+
+		for (int i = range.start; i < range.end; i++)
+			lists[i] = index.encode(rows.ptr<float>(i), &residual[0], &codes[i * index.nSub]);
+	}
+
+private:
+	const IVFPQIndex& index;
+	const Mat& rows;
+	vector<int>& lists;
+	vector<uchar>& codes;
+};
+
+
+
+/**
+ * Searches a block of query rows per task, every
+ * task has its own distance tables
+ */
+class IVFPQIndex::SearchInvoker : public ParallelLoopBody
+{
+public:
+	SearchInvoker(const IVFPQIndex& _index, const Mat& _query, int _k, vector<vector<DMatch> >& _matches) :
+			index(_index), query(_query), k(_k), matches(_matches)
+	{
+	}
+
+	void operator()(const Range& range) const
+	{
+		vector<float> scratch;
+		vector<pair<float, int> > probes;
+		vector<int> best(k);
+		vector<float> distances(k);
+
+		for (int block = range.start; block < range.end; block++)
+		{
+			int qStart = block * SIFT_IVF_QUERY_BLOCK;
+			int qEnd = min(qStart + SIFT_IVF_QUERY_BLOCK, query.rows);
+
+			for (int q = qStart; q < qEnd; q++)
+			{
+				int found = index.search(query.ptr<float>(q), k, &best[0], &distances[0], scratch, probes);
+
+				matches[q].resize(found);
+				for (int i = 0; i < found; i++)
+					matches[q][i] = DMatch(q, best[i], sqrt(max(distances[i], 0.f)));
+			}
+		}
+	}
+
+private:
+	const IVFPQIndex& index;
+	const Mat& query;
+	int k;
+	vector<vector<DMatch> >& matches;
+};
+
+
+
+IVFPQIndex::IVFPQIndex(int probes, int threads)
+{
+	nSub = 0;
+	total = 0;
+	setProbes(probes);
+	setThreadCount(threads);
+}
+
+
+
+/**
+ * Sets the number of lists, nearest coarse
+ * centroids first, a query scans
+ *
+ * @param probes	Number of lists scanned per query
+ */
+void IVFPQIndex::setProbes(int probes)
+{
+	nProbes = max(probes, 1);
+}
+
+
+
+/**
+ * Sets the largest number of OpenCV pool threads
+ * rows are encoded and query rows are searched on
+ * at once, see runParallel
+ *
+ * @param threads	Number of threads, 1 for serial
+ */
+void IVFPQIndex::setThreadCount(int threads)
+{
+	nThreads = max(threads, 1);
+}
+
+
+
+/**
+ * Learns the coarse quantizer by k-means over the
+ * samples and one codebook of SIFT_PQ_CENTROIDS
+ * centroids per sub-quantizer by k-means over the
+ * residuals of the samples. The index is emptied
+ *
+ * @param samples			Training rows, CV_32F or CV_8U
+ * @param lists				Number of coarse centroids
+ * @param subquantizers		Number of code bytes, must divide the row length
+ */
+void IVFPQIndex::train(const Mat& samples, int lists, int subquantizers)
+{
+	CV_Assert(samples.type() == CV_32F || samples.type() == CV_8U);
+	CV_Assert(subquantizers > 0 && samples.cols % subquantizers == 0);
+	CV_Assert(samples.rows >= max(lists, SIFT_PQ_CENTROIDS));
+
+	release();
+
+	Mat rows, labels;
+	samples.convertTo(rows, CV_32F);
+	TermCriteria criteria(TermCriteria::COUNT + TermCriteria::EPS, SIFT_IVF_ITERATIONS, 1e-3);
+	kmeans(rows, lists, labels, criteria, 1, KMEANS_PP_CENTERS, coarse);
+
+	for (int i = 0; i < rows.rows; i++)
+	{
+		float* row = rows.ptr<float>(i);
+		const float* centroid = coarse.ptr<float>(labels.at<int>(i));
+		for (int d = 0; d < rows.cols; d++)
+			row[d] -= centroid[d];
+	}
+
+	nSub = subquantizers;
+	int subDims = rows.cols / nSub;
+	codebooks.create(nSub * SIFT_PQ_CENTROIDS, subDims, CV_32F);
+	for (int j = 0; j < nSub; j++)
+	{
+		Mat residuals = rows.colRange(j * subDims, (j + 1) * subDims).clone();
+		Mat subLabels, centroids;
+		kmeans(residuals, SIFT_PQ_CENTROIDS, subLabels, criteria, 1, KMEANS_PP_CENTERS, centroids);
+
+		Mat codebook = codebooks.rowRange(j * SIFT_PQ_CENTROIDS, (j + 1) * SIFT_PQ_CENTROIDS);
+		centroids.copyTo(codebook);
+	}
+
+	listCodes.assign(lists, vector<uchar>());
+	listIds.assign(lists, vector<int>());
+	bindLists();
+}
+
+
+
+/**
+ * Finds the nearest coarse centroid of a row and
+ * quantizes the residual to it, one codebook per
+ * sub-quantizer
+ *
+ * @param row			Float row
+ * @param residual		Scratch of the row length
+ * @param code			nSub code bytes
+ *
+ * @return	Returns the list of the row
+ */
+int IVFPQIndex::encode(const float* row, float* residual, uchar* code) const
+{
+	KernelPath path = bestKernelPath();
+	int list = 0;
+	float nearest = FLT_MAX;
+
+	for (int l = 0; l < coarse.rows; l++)
+	{
+		float distance = squaredDistance(row, coarse.ptr<float>(l), coarse.cols, path);
+		if (distance < nearest)
+		{
+			nearest = distance;
+			list = l;
+		}
+	}
+
+	const float* centroid = coarse.ptr<float>(list);
+	for (int d = 0; d < coarse.cols; d++)
+		residual[d] = row[d] - centroid[d];
+
+	int subDims = codebooks.cols;
+	for (int j = 0; j < nSub; j++)
+	{
+		int best = 0;
+		nearest = FLT_MAX;
+
+		for (int c = 0; c < SIFT_PQ_CENTROIDS; c++)
+		{
+			float distance = squaredDistance(residual + j * subDims, codebooks.ptr<float>(j * SIFT_PQ_CENTROIDS + c),
+					subDims, path);
+			if (distance < nearest)
+			{
+				nearest = distance;
+				best = c;
+			}
+		}
+		code[j] = best;
+	}
+
+	return list;
+}
+
+
+
+/**
+ * Encodes descriptor rows and appends them to
+ * their lists. Ids are given in order, starting
+ * at the current size of the index. A loaded
+ * index is read only
+ *
+ * @param descriptors	Descriptor rows, CV_32F or CV_8U
+ *
+ * @return	Returns the id of the first row
+ */
+int IVFPQIndex::add(const Mat& descriptors)
+{
+	CV_Assert(!coarse.empty() && !file.data());
+	CV_Assert(descriptors.type() == CV_32F || descriptors.type() == CV_8U);
+	CV_Assert(descriptors.empty() || descriptors.cols == coarse.cols);
+	CV_Assert((int64) total + descriptors.rows <= INT_MAX);
+
+	int first = total;
+	if (descriptors.empty())
+		return first;
+
+	Mat rows = descriptors;
+	if (descriptors.type() != CV_32F)
+		descriptors.convertTo(rows, CV_32F);
+
+	vector<int> lists(rows.rows);
+	vector<uchar> codes(rows.rows * nSub);
+	EncodeInvoker invoker(*this, rows, lists, codes);
+
+	runParallel(Range(0, rows.rows), invoker, nThreads);
+
+	for (int i = 0; i < rows.rows; i++)
+	{
+		vector<uchar>& listCode = listCodes[lists[i]];
+		vector<int>& ids = listIds[lists[i]];
+		int lane = ids.size() % SIFT_PQ_BLOCK;
+
+		if (lane == 0)
+			listCode.resize(listCode.size() + nSub * SIFT_PQ_BLOCK, 0);
+
+		uchar* block = &listCode[listCode.size() - nSub * SIFT_PQ_BLOCK];
+		for (int j = 0; j < nSub; j++)
+			block[j * SIFT_PQ_BLOCK + lane] = codes[i * nSub + j];
+		ids.push_back(total + i);
+	}
+
+	total += rows.rows;
+	bindLists();
+	return first;
+}
+
+
+
+/**
+ * Points the list accessors at the in-memory lists
+ */
+void IVFPQIndex::bindLists()
+{
+	int lists = listIds.size();
+
+	listSizes.resize(lists);
+	codePtrs.resize(lists);
+	idPtrs.resize(lists);
+	for (int l = 0; l < lists; l++)
+	{
+		listSizes[l] = listIds[l].size();
+		codePtrs[l] = listCodes[l].empty() ? NULL : &listCodes[l][0];
+		idPtrs[l] = listIds[l].empty() ? NULL : &listIds[l][0];
+	}
+}
+
+
+
+/**
+ * Asymmetric distance search. The query is not
+ * quantized: per probed list a table holds the
+ * squared distance of the query residual to every
+ * codebook centroid, and the distance to a stored
+ * vector is the sum of nSub table entries
+ *
+ * @param query			Float query row
+ * @param k				Number of neighbours
+ * @param best			k ids of the nearest vectors
+ * @param distances		k approximate squared distances, ascending
+ * @param scratch		Scratch tables of the calling thread
+ * @param probes		Scratch list order of the calling thread
+ *
+ * @return	Returns the number of neighbours found, at most k
+ */
+int IVFPQIndex::search(const float* query, int k, int* best, float* distances, vector<float>& scratch,
+		vector<pair<float, int> >& probes) const
+{
+	KernelPath path = bestKernelPath();
+	int dims = coarse.cols, subDims = codebooks.cols;
+
+	scratch.resize(nSub * SIFT_PQ_CENTROIDS + dims + SIFT_PQ_SCAN_BLOCKS * SIFT_PQ_BLOCK);
+	float* table = &scratch[0];
+	float* residual = table + nSub * SIFT_PQ_CENTROIDS;
+	float* scanned = residual + dims;
+
+	probes.resize(coarse.rows);
+	for (int l = 0; l < coarse.rows; l++)
+		probes[l] = make_pair(squaredDistance(query, coarse.ptr<float>(l), dims, path), l);
+
+	int nProbed = min(nProbes, coarse.rows);
+	partial_sort(probes.begin(), probes.begin() + nProbed, probes.end());
+
+	int found = 0;
+	for (int p = 0; p < nProbed; p++)
+	{
+		int list = probes[p].second;
+		int size = listSizes[list];
+		if (size == 0)
+			continue;
+
+		const float* centroid = coarse.ptr<float>(list);
+		for (int d = 0; d < dims; d++)
+			residual[d] = query[d] - centroid[d];
+		for (int j = 0; j < nSub; j++)
+			for (int c = 0; c < SIFT_PQ_CENTROIDS; c++)
+				table[j * SIFT_PQ_CENTROIDS + c] = squaredDistance(residual + j * subDims,
+						codebooks.ptr<float>(j * SIFT_PQ_CENTROIDS + c), subDims, path);
+
+		int nBlocks = (size + SIFT_PQ_BLOCK - 1) / SIFT_PQ_BLOCK;
+		for (int b = 0; b < nBlocks; b += SIFT_PQ_SCAN_BLOCKS)
+		{
+			int scanBlocks = min(SIFT_PQ_SCAN_BLOCKS, nBlocks - b);
+			int first = b * SIFT_PQ_BLOCK;
+			int count = min(scanBlocks * SIFT_PQ_BLOCK, size - first);
+
+			adcDistances(table, nSub, codePtrs[list] + b * nSub * SIFT_PQ_BLOCK, scanBlocks, scanned, path);
+
+			for (int v = 0; v < count; v++)
+			{
+				float distance = scanned[v];
+				if (found == k && distance >= distances[k - 1])
+					continue;
+
+				int pos = found < k ? found++ : k - 1;
+				for (; pos > 0 && distances[pos - 1] > distance; pos--)
+				{
+					distances[pos] = distances[pos - 1];
+					best[pos] = best[pos - 1];
+				}
+				distances[pos] = distance;
+				best[pos] = idPtrs[list][first + v];
+			}
+		}
+	}
+
+	return found;
+}
+
+
+
+/**
+ * Finds the k approximate nearest indexed vectors
+ * of every query row
+ *
+ * @param query		Query descriptors, CV_32F or CV_8U rows
+ * @param matches	Per query row up to k matches, nearest first. trainIdx is
+ * 					the id given by add, distance the approximate L2 distance
+ * @param k			Number of neighbours
+ *
+ * @return	Replaces matches
+ */
+void IVFPQIndex::knnMatch(const Mat& query, vector<vector<DMatch> >& matches, int k) const
+{
+	CV_Assert(query.type() == CV_32F || query.type() == CV_8U);
+	CV_Assert(query.empty() || coarse.empty() || query.cols == coarse.cols);
+	CV_Assert(k >= 1);
+
+	matches.assign(query.rows, vector<DMatch>());
+	if (query.empty() || total == 0)
+		return;
+
+	Mat queryRows = query;
+	if (query.type() != CV_32F)
+		query.convertTo(queryRows, CV_32F);
+
+	int nBlocks = (query.rows + SIFT_IVF_QUERY_BLOCK - 1) / SIFT_IVF_QUERY_BLOCK;
+	SearchInvoker invoker(*this, queryRows, k, matches);
+
+	runParallel(Range(0, nBlocks), invoker, nThreads);
+}
+
+
+
+/**
+ * Frees the index and unmaps a loaded index file
+ */
+void IVFPQIndex::release()
+{
+	coarse.release();
+	codebooks.release();
+	listCodes.clear();
+	listIds.clear();
+	listSizes.clear();
+	codePtrs.clear();
+	idPtrs.clear();
+	file.close();
+	nSub = 0;
+	total = 0;
+}
+
+
+
+/**
+ * Number of indexed vectors
+ *
+ * @return	Returns 0 if nothing is indexed
+ */
+int IVFPQIndex::size() const
+{
+	return total;
+}
+
+
+
+/**
+ * Bytes of codes and ids held by the lists, the
+ * memory a vector costs on top of the centroids
+ *
+ * @return	Returns the code blocks, padding included, plus 4 bytes per id
+ */
+size_t IVFPQIndex::listBytes() const
+{
+	size_t bytes = 0;
+	for (size_t l = 0; l < listSizes.size(); l++)
+	{
+		size_t blocks = (listSizes[l] + SIFT_PQ_BLOCK - 1) / SIFT_PQ_BLOCK;
+		bytes += blocks * nSub * SIFT_PQ_BLOCK + listSizes[l] * sizeof(int);
+	}
+
+	return bytes;
+}
+
+
+
+/** Pads the file with zeros up to the next aligned offset **/
+static uint64 padTo(FILE* f, uint64 offset)
+{
+	static const char zeros[FEATURE_FILE_ALIGN] = { 0 };
+	uint64 aligned = alignSize(offset, FEATURE_FILE_ALIGN);
+
+	fwrite(zeros, 1, aligned - offset, f);
+	return aligned;
+}
+
+
+
+/**
+ * Writes the centroids, the codebooks and every
+ * list to a versioned binary file that load()
+ * maps back
+ *
+ * @param path		File path
+ *
+ * @return	false if the index is not trained or the file cannot be written
+ */
+bool IVFPQIndex::save(const string& path) const
+{
+	if (coarse.empty())
+		return false;
+
+	int lists = coarse.rows;
+	size_t blockBytes = nSub * SIFT_PQ_BLOCK;
+
+	IVFPQHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, IVF_PQ_MAGIC, sizeof(header.magic));
+	header.version = IVF_PQ_VERSION;
+	header.headerSize = sizeof(IVFPQHeader);
+	header.dims = coarse.cols;
+	header.lists = lists;
+	header.subquantizers = nSub;
+	header.centroids = SIFT_PQ_CENTROIDS;
+	header.blockSize = SIFT_PQ_BLOCK;
+	header.entrySize = sizeof(IVFPQListEntry);
+	header.count = total;
+	header.coarseOffset = alignSize(sizeof(IVFPQHeader), FEATURE_FILE_ALIGN);
+	header.codebookOffset = alignSize(header.coarseOffset + (uint64) lists * coarse.cols * sizeof(float),
+			FEATURE_FILE_ALIGN);
+	header.directoryOffset = alignSize(header.codebookOffset + (uint64) codebooks.rows * codebooks.cols * sizeof(float),
+			FEATURE_FILE_ALIGN);
+
+	vector<IVFPQListEntry> directory(lists);
+	uint64 offset = alignSize(header.directoryOffset + (uint64) lists * sizeof(IVFPQListEntry), FEATURE_FILE_ALIGN);
+	for (int l = 0; l < lists; l++)
+	{
+		uint64 blocks = (listSizes[l] + SIFT_PQ_BLOCK - 1) / SIFT_PQ_BLOCK;
+		directory[l].codeOffset = offset;
+		directory[l].idOffset = alignSize(offset + blocks * blockBytes, FEATURE_FILE_ALIGN);
+		directory[l].size = listSizes[l];
+		offset = alignSize(directory[l].idOffset + (uint64) listSizes[l] * sizeof(int), FEATURE_FILE_ALIGN);
+	}
+	header.fileSize = offset;
+
+	FILE* f = fopen(path.c_str(), "wb");
+	if (!f)
+		return false;
+
+	fwrite(&header, sizeof(header), 1, f);
+	offset = padTo(f, sizeof(header));
+
+	for (int l = 0; l < lists; l++)
+		fwrite(coarse.ptr<float>(l), sizeof(float), coarse.cols, f);
+	offset = padTo(f, offset + (uint64) lists * coarse.cols * sizeof(float));
+
+	for (int i = 0; i < codebooks.rows; i++)
+		fwrite(codebooks.ptr<float>(i), sizeof(float), codebooks.cols, f);
+	offset = padTo(f, offset + (uint64) codebooks.rows * codebooks.cols * sizeof(float));
+
+	fwrite(&directory[0], sizeof(IVFPQListEntry), lists, f);
+	offset = padTo(f, offset + (uint64) lists * sizeof(IVFPQListEntry));
+
+	for (int l = 0; l < lists; l++)
+	{
+		size_t codeBytes = (listSizes[l] + SIFT_PQ_BLOCK - 1) / SIFT_PQ_BLOCK * blockBytes;
+		if (codeBytes > 0)
+			fwrite(codePtrs[l], 1, codeBytes, f);
+		offset = padTo(f, offset + codeBytes);
+
+		if (listSizes[l] > 0)
+			fwrite(idPtrs[l], sizeof(int), listSizes[l], f);
+		offset = padTo(f, offset + listSizes[l] * sizeof(int));
+	}
+
+	bool ok = !ferror(f);
+	ok = fclose(f) == 0 && ok;
+	return ok;
+}
+
+
+
+/**
+ * Maps an index file and validates its header
+ * and block bounds. Centroids and codebooks are
+ * copied, the lists stay in the mapping and are
+ * paged in as queries probe them
+ *
+ * @param path		File path
+ *
+ * @return	false if the file is missing, truncated or of another version
+ */
+bool IVFPQIndex::load(const string& path)
+{
+	release();
+
+	if (!file.open(path) || file.size() < sizeof(IVFPQHeader))
+	{
+		release();
+		return false;
+	}
+
+	const uchar* base = file.data();
+	const IVFPQHeader* h = (const IVFPQHeader*) base;
+	bool valid = memcmp(h->magic, IVF_PQ_MAGIC, sizeof(h->magic)) == 0
+			&& h->version == IVF_PQ_VERSION
+			&& h->headerSize == sizeof(IVFPQHeader)
+			&& h->entrySize == sizeof(IVFPQListEntry)
+			&& h->centroids == SIFT_PQ_CENTROIDS
+			&& h->blockSize == SIFT_PQ_BLOCK
+			&& h->lists > 0 && h->subquantizers > 0 && h->dims % h->subquantizers == 0
+			&& h->count <= INT_MAX
+			&& h->fileSize == file.size()
+			&& h->coarseOffset + (uint64) h->lists * h->dims * sizeof(float) <= h->codebookOffset
+			&& h->codebookOffset + (uint64) h->centroids * h->dims * sizeof(float) <= h->directoryOffset
+			&& h->directoryOffset + (uint64) h->lists * sizeof(IVFPQListEntry) <= h->fileSize;
+
+	const IVFPQListEntry* directory = (const IVFPQListEntry*) (base + h->directoryOffset);
+	uint64 count = 0;
+	for (unsigned int l = 0; valid && l < h->lists; l++)
+	{
+		uint64 blocks = (directory[l].size + SIFT_PQ_BLOCK - 1) / SIFT_PQ_BLOCK;
+		valid = directory[l].codeOffset + blocks * h->subquantizers * SIFT_PQ_BLOCK <= h->fileSize
+				&& directory[l].idOffset + directory[l].size * sizeof(int) <= h->fileSize
+				&& directory[l].idOffset % sizeof(int) == 0;
+		count += directory[l].size;
+	}
+
+	if (!valid || count != h->count)
+	{
+		release();
+		return false;
+	}
+
+	int subDims = h->dims / h->subquantizers;
+	coarse = Mat(h->lists, h->dims, CV_32F, (void*) (base + h->coarseOffset)).clone();
+	codebooks = Mat(h->subquantizers * SIFT_PQ_CENTROIDS, subDims, CV_32F, (void*) (base + h->codebookOffset)).clone();
+	nSub = h->subquantizers;
+	total = h->count;
+
+	listSizes.resize(h->lists);
+	codePtrs.resize(h->lists);
+	idPtrs.resize(h->lists);
+	for (unsigned int l = 0; l < h->lists; l++)
+	{
+		listSizes[l] = directory[l].size;
+		codePtrs[l] = base + directory[l].codeOffset;
+		idPtrs[l] = (const int*) (base + directory[l].idOffset);
+	}
+
+	return true;
+}
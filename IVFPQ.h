@@ -0,0 +1,137 @@
+/*
+ * IVFPQ.h
+ *
+ *  Created on: Oct 15, 2026
+ */
+
+#ifndef IVF_PQ_H
+#define IVF_PQ_H
+
+#include "opencv2/opencv.hpp"
+#include "FeatureFile.h"
+
+using namespace std;
+using namespace cv;
+
+#define IVF_PQ_MAGIC						"SIFTIVPQ"
+#define IVF_PQ_VERSION						1
+#define SIFT_IVF_LISTS						1024
+#define SIFT_IVF_PROBES						16
+#define SIFT_IVF_ITERATIONS					20
+#define SIFT_IVF_QUERY_BLOCK				16
+#define SIFT_PQ_SUBQUANTIZERS				8
+#define SIFT_PQ_CENTROIDS					256
+#define SIFT_PQ_BLOCK						8
+#define SIFT_PQ_SCAN_BLOCKS					256
+
+/**
+ * Header at offset 0 of an IVF-PQ index file.
+ * Blocks are stored in native byte order at 64
+ * byte aligned offsets: coarse centroids, PQ
+ * codebooks, the list directory, then the codes
+ * and ids of every list
+ */
+struct IVFPQHeader
+{
+	char magic[8];
+	unsigned int version;
+	unsigned int headerSize;
+	unsigned int dims;
+	unsigned int lists;
+	unsigned int subquantizers;
+	unsigned int centroids;
+	unsigned int blockSize;
+	unsigned int entrySize;
+	uint64 count;
+	uint64 coarseOffset;
+	uint64 codebookOffset;
+	uint64 directoryOffset;
+	uint64 fileSize;
+};
+
+/** Directory entry of an inverted list **/
+struct IVFPQListEntry
+{
+	uint64 codeOffset;
+	uint64 idOffset;
+	uint64 size;
+};
+
+/**
+ * Inverted file index with product quantization.
+ * A k-means coarse quantizer assigns every vector
+ * to a list, the residual to the list centroid is
+ * stored as one byte per sub-quantizer. Codes of
+ * a list are interleaved in blocks of 8 vectors,
+ * so a query scans them with one table lookup per
+ * sub-quantizer for 8 vectors. A loaded index
+ * serves its lists from the mapped file, only the
+ * centroids are kept in memory
+ */
+class IVFPQIndex
+{
+private:
+	int nProbes;
+	int nThreads;
+	int nSub;
+	int total;
+	Mat coarse;
+	Mat codebooks;
+	vector<vector<uchar> > listCodes;
+	vector<vector<int> > listIds;
+	vector<int> listSizes;
+	vector<const uchar*> codePtrs;
+	vector<const int*> idPtrs;
+	MappedFile file;
+
+	class EncodeInvoker;
+	class SearchInvoker;
+
+	IVFPQIndex(const IVFPQIndex&);
+	IVFPQIndex& operator=(const IVFPQIndex&);
+
+	/** Points the list accessors at the in-memory lists **/
+	void bindLists();
+
+	/** Nearest coarse centroid and PQ code of a row **/
+	int encode(const float* row, float* residual, uchar* code) const;
+
+	/** The k approximate nearest ids of one query, nearest first **/
+	int search(const float* query, int k, int* best, float* distances, vector<float>& scratch,
+			vector<pair<float, int> >& probes) const;
+
+public:
+	IVFPQIndex(int probes = SIFT_IVF_PROBES, int threads = 1);
+
+	/** Number of lists scanned per query, more probes give a higher recall **/
+	void setProbes(int probes);
+
+	/** Most pool threads vectors are encoded and queries searched on at once **/
+	void setThreadCount(int threads);
+
+	/** Learns the coarse centroids and the PQ codebooks and empties the index **/
+	void train(const Mat& samples, int lists = SIFT_IVF_LISTS, int subquantizers = SIFT_PQ_SUBQUANTIZERS);
+
+	/** Encodes and appends descriptor rows, returns the id of the first one **/
+	int add(const Mat& descriptors);
+
+	/** Writes the trained index and its lists to a file **/
+	bool save(const string& path) const;
+
+	/** Maps an index file, the lists are served from the mapping **/
+	bool load(const string& path);
+
+	/** Frees the index **/
+	void release();
+
+	/** Number of indexed vectors **/
+	int size() const;
+
+	/** Bytes of codes and ids of the lists, padding included **/
+	size_t listBytes() const;
+
+	/** The k approximate nearest indexed vectors of every query row **/
+	void knnMatch(const Mat& query, vector<vector<DMatch> >& matches, int k) const;
+};
+
+#endif
@@ -0,0 +1,748 @@
+/*
+ * KDForest.cpp
+ *
+ *  Created on: Oct 15, 2026
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <float.h>
+#include <algorithm>
+#include "KDForest.h"
+#include "SIFTKernels.h"
+
+/**
+ * Builds one randomized tree per task. Trees are
+ * seeded by their index, so the forest does not
+ * depend on the thread count
+ */
+class KDForest::BuildInvoker : public ParallelLoopBody
+{
+public:
+	BuildInvoker(const KDForest& _forest, vector<vector<KDNode> >& _trees, vector<vector<int> >& _orders) :
+			forest(_forest), trees(_trees), orders(_orders)
+	{
+	}
+
+	void operator()(const Range& range) const
+	{
+		int count = forest.data.rows;
+
+		for (int t = range.start; t < range.end; t++)
+		{
+			RNG rng(0x4b44 + t);
+			vector<int>& order = orders[t];
+
+			order.resize(count);
+			for (int i = 0; i < count; i++)
+				order[i] = i;
+			for (int i = count - 1; i > 0; i--)
+				std::swap(order[i], order[rng.uniform(0, i + 1)]);
+
+			trees[t].clear();
+			trees[t].reserve(2 * count / SIFT_KD_LEAF_SIZE + 1);
+			forest.divide(trees[t], &order[0], 0, count, rng);
+		}
+	}
+
+private:
+	const KDForest& forest;
+	vector<vector<KDNode> >& trees;
+	vector<vector<int> >& orders;
+};
+
+
+
+/**
+ * Searches a block of query rows per task, every
+ * task has its own heap and visited set
+ */
+class KDForest::SearchInvoker : public ParallelLoopBody
+{
+public:
+	SearchInvoker(const KDForest& _forest, const Mat& _query, int _k, vector<vector<DMatch> >& _matches) :
+			forest(_forest), query(_query), k(_k), matches(_matches)
+	{
+	}
+
+	void operator()(const Range& range) const
+	{
+		vector<Branch> heap;
+		vector<int> visited;
+		vector<int> best(k);
+		vector<float> distances(k);
+
+		for (int block = range.start; block < range.end; block++)
+		{
+			int qStart = block * SIFT_KD_QUERY_BLOCK;
+			int qEnd = min(qStart + SIFT_KD_QUERY_BLOCK, query.rows);
+
+			for (int q = qStart; q < qEnd; q++)
+			{
+				int found = forest.search(query.ptr<float>(q), k, &best[0], &distances[0], heap, visited);
+
+				matches[q].resize(found);
+				for (int i = 0; i < found; i++)
+				{
+					int source, row;
+					forest.locate(best[i], source, row);
+					matches[q][i] = DMatch(q, best[i], source, sqrt(distances[i]));
+				}
+			}
+		}
+	}
+
+private:
+	const KDForest& forest;
+	const Mat& query;
+	int k;
+	vector<vector<DMatch> >& matches;
+};
+
+
+
+KDForest::KDForest(int trees, int checks, int threads)
+{
+	nTrees = max(trees, 1);
+	setChecks(checks);
+	setThreadCount(threads);
+}
+
+
+
+/**
+ * Sets the search budget, a query stops once it
+ * has computed this many distances
+ *
+ * @param checks	Number of descriptors checked per query
+ */
+void KDForest::setChecks(int checks)
+{
+	maxChecks = max(checks, 1);
+}
+
+
+
+/**
+ * Sets the largest number of OpenCV pool threads
+ * trees are built and query rows are searched on
+ * at once, see runParallel
+ *
+ * @param threads	Number of threads, 1 for serial
+ */
+void KDForest::setThreadCount(int threads)
+{
+	nThreads = max(threads, 1);
+}
+
+
+
+/**
+ * Indexes the rows of a descriptor matrix. The
+ * rows are copied into the index as floats
+ *
+ * @param descriptors	Descriptor rows, CV_32F or CV_8U
+ */
+void KDForest::build(const Mat& descriptors)
+{
+	CV_Assert(descriptors.type() == CV_32F || descriptors.type() == CV_8U);
+
+	release();
+	descriptors.convertTo(data, CV_32F);
+	sourceStarts.push_back(0);
+	sourceNames.push_back(string());
+
+	buildTrees();
+}
+
+
+
+/**
+ * Indexes the descriptors of a set of feature
+ * files, every file becomes a source of the index
+ *
+ * @param featureFiles		Feature file paths
+ *
+ * @return	false if a file cannot be opened or the descriptor lengths differ
+ */
+bool KDForest::build(const vector<string>& featureFiles)
+{
+	release();
+
+	int total = 0, length = 0;
+	for (size_t i = 0; i < featureFiles.size(); i++)
+	{
+		FeatureFile features;
+		if (!features.open(featureFiles[i]))
+			return false;
+
+		Mat descriptors = features.descriptors();
+		if (descriptors.empty())
+			continue;
+		if (length != 0 && descriptors.cols != length)
+			return false;
+
+		length = descriptors.cols;
+		total += descriptors.rows;
+	}
+
+	data.create(total, length, CV_32F);
+	int start = 0;
+	for (size_t i = 0; i < featureFiles.size(); i++)
+	{
+		FeatureFile features;
+		if (!features.open(featureFiles[i]))
+		{
+			release();
+			return false;
+		}
+
+		sourceStarts.push_back(start);
+		sourceNames.push_back(featureFiles[i]);
+
+		Mat descriptors = features.descriptors();
+		if (descriptors.empty())
+			continue;
+
+		Mat rows = data.rowRange(start, start + descriptors.rows);
+		descriptors.convertTo(rows, CV_32F);
+		start += descriptors.rows;
+	}
+
+	buildTrees();
+	return true;
+}
+
+
+
+/**
+ * Builds the trees over the rows of data and
+ * concatenates them into one node array and one
+ * point order array
+ */
+void KDForest::buildTrees()
+{
+	nodes.clear();
+	roots.clear();
+	indices.clear();
+	if (data.rows == 0)
+		return;
+
+	vector<vector<KDNode> > trees(nTrees);
+	vector<vector<int> > orders(nTrees);
+	BuildInvoker invoker(*this, trees, orders);
+
+	runParallel(Range(0, nTrees), invoker, nThreads);
+
+	for (int t = 0; t < nTrees; t++)
+	{
+		int nodeBase = nodes.size();
+		int orderBase = indices.size();
+
+		roots.push_back(nodeBase);
+		for (size_t i = 0; i < trees[t].size(); i++)
+		{
+			KDNode node = trees[t][i];
+			int base = node.dim < 0 ? orderBase : nodeBase;
+			node.left += base;
+			node.right += base;
+			nodes.push_back(node);
+		}
+		indices.insert(indices.end(), orders[t].begin(), orders[t].end());
+	}
+}
+
+
+
+/**
+ * Splits the points [begin, end) of a tree order
+ * at the mean of one of the SIFT_KD_TOP_DIMS
+ * dimensions of highest variance, estimated from
+ * the first SIFT_KD_SAMPLES points of the range
+ *
+ * @param tree		Nodes of the tree, the subtree is appended
+ * @param order		Point order of the tree, partitioned in place
+ * @param begin		First point of the range
+ * @param end		End of the range
+ * @param rng		Random generator of the tree
+ *
+ * @return	Returns the index of the subtree root in tree
+ */
+int KDForest::divide(vector<KDNode>& tree, int* order, int begin, int end, RNG& rng) const
+{
+	int node = tree.size();
+	tree.push_back(KDNode());
+
+	if (end - begin <= SIFT_KD_LEAF_SIZE)
+	{
+		tree[node].dim = -1;
+		tree[node].split = 0;
+		tree[node].left = begin;
+		tree[node].right = end;
+		return node;
+	}
+
+	int samples = min(end - begin, SIFT_KD_SAMPLES);
+	vector<double> mean(data.cols, 0.0), variance(data.cols, 0.0);
+	for (int i = begin; i < begin + samples; i++)
+	{
+		const float* row = data.ptr<float>(order[i]);
+		for (int d = 0; d < data.cols; d++)
+		{
+			mean[d] += row[d];
+			variance[d] += row[d] * row[d];
+		}
+	}
+	for (int d = 0; d < data.cols; d++)
+	{
+		mean[d] /= samples;
+		variance[d] = variance[d] / samples - mean[d] * mean[d];
+	}
+
+	/* Keeps the highest variance dimensions sorted, highest first */
+	int top[SIFT_KD_TOP_DIMS];
+	int nTop = 0;
+	for (int d = 0; d < data.cols; d++)
+	{
+		int pos = nTop < SIFT_KD_TOP_DIMS ? nTop++ : SIFT_KD_TOP_DIMS;
+		for (; pos > 0 && variance[top[pos - 1]] < variance[d]; pos--)
+			if (pos < SIFT_KD_TOP_DIMS)
+				top[pos] = top[pos - 1];
+		if (pos < SIFT_KD_TOP_DIMS)
+			top[pos] = d;
+	}
+
+	int dim = top[rng.uniform(0, nTop)];
+	float split = mean[dim];
+
+	int middle = begin;
+	for (int i = begin; i < end; i++)
+		if (data.ptr<float>(order[i])[dim] < split)
+			std::swap(order[i], order[middle++]);
+
+	/* All points on one side, equal along dim, are split in halves */
+	if (middle == begin || middle == end)
+		middle = (begin + end) / 2;
+
+	int left = divide(tree, order, begin, middle, rng);
+	int right = divide(tree, order, middle, end, rng);
+
+	tree[node].dim = dim;
+	tree[node].split = split;
+	tree[node].left = left;
+	tree[node].right = right;
+	return node;
+}
+
+
+
+/**
+ * Best bin first search of all trees together.
+ * Unexplored branches go into one heap keyed by
+ * the squared distance to their splitting planes,
+ * the nearest is descended next until maxChecks
+ * distances have been computed. A descriptor seen
+ * in several trees is checked once
+ *
+ * @param query			Float query row
+ * @param k				Number of neighbours
+ * @param best			k indices of the nearest rows
+ * @param distances		k squared distances, ascending
+ * @param heap			Scratch heap of the calling thread
+ * @param visited		Scratch hash set of the calling thread
+ *
+ * @return	Returns the number of neighbours found, at most k
+ */
+int KDForest::search(const float* query, int k, int* best, float* distances, vector<Branch>& heap,
+		vector<int>& visited) const
+{
+	KernelPath path = bestKernelPath();
+
+	/* Checks stop within a leaf of max(maxChecks, k), so the set stays at most half full */
+	size_t tableSize = 64;
+	while (tableSize < 2 * (size_t) (max(maxChecks, k) + SIFT_KD_LEAF_SIZE))
+		tableSize *= 2;
+	visited.assign(tableSize, -1);
+	unsigned int mask = tableSize - 1;
+
+	heap.clear();
+	for (size_t t = 0; t < roots.size(); t++)
+	{
+		Branch root = { 0, roots[t] };
+		heap.push_back(root);
+	}
+
+	int found = 0, checks = 0;
+	while (!heap.empty())
+	{
+		if (found == k && (checks >= maxChecks || heap.front().distance >= distances[k - 1]))
+			break;
+
+		Branch branch = heap.front();
+		pop_heap(heap.begin(), heap.end());
+		heap.pop_back();
+
+		const KDNode* node = &nodes[branch.node];
+		while (node->dim >= 0)
+		{
+			float diff = query[node->dim] - node->split;
+			Branch other = { branch.distance + diff * diff, diff < 0 ? node->right : node->left };
+
+			if (found < k || other.distance < distances[k - 1])
+			{
+				heap.push_back(other);
+				push_heap(heap.begin(), heap.end());
+			}
+			node = &nodes[diff < 0 ? node->left : node->right];
+		}
+
+		for (int p = node->left; p < node->right; p++)
+		{
+			int index = indices[p];
+			unsigned int slot = ((unsigned int) index * 2654435761u) & mask;
+			while (visited[slot] >= 0 && visited[slot] != index)
+				slot = (slot + 1) & mask;
+			if (visited[slot] == index)
+				continue;
+			visited[slot] = index;
+
+			float distance = squaredDistance(query, data.ptr<float>(index), data.cols, path);
+			checks++;
+
+			if (found == k && distance >= distances[k - 1])
+				continue;
+
+			int pos = found < k ? found++ : k - 1;
+			for (; pos > 0 && distances[pos - 1] > distance; pos--)
+			{
+				distances[pos] = distances[pos - 1];
+				best[pos] = best[pos - 1];
+			}
+			distances[pos] = distance;
+			best[pos] = index;
+		}
+	}
+
+	return found;
+}
+
+
+
+/**
+ * Finds the k approximate nearest indexed rows of
+ * every query row
+ *
+ * @param query		Query descriptors, CV_32F or CV_8U rows
+ * @param matches	Per query row up to k matches, nearest first. trainIdx is
+ * 					the row of the index, imgIdx its source, distance is L2
+ * @param k			Number of neighbours
+ *
+ * @return	Replaces matches
+ */
+void KDForest::knnMatch(const Mat& query, vector<vector<DMatch> >& matches, int k) const
+{
+	CV_Assert(query.type() == CV_32F || query.type() == CV_8U);
+	CV_Assert(query.empty() || data.empty() || query.cols == data.cols);
+	CV_Assert(k >= 1);
+
+	matches.assign(query.rows, vector<DMatch>());
+	if (query.empty() || data.empty())
+		return;
+
+	Mat queryRows = query;
+	if (query.type() != CV_32F)
+		query.convertTo(queryRows, CV_32F);
+
+	int nBlocks = (query.rows + SIFT_KD_QUERY_BLOCK - 1) / SIFT_KD_QUERY_BLOCK;
+	SearchInvoker invoker(*this, queryRows, k, matches);
+
+	runParallel(Range(0, nBlocks), invoker, nThreads);
+}
+
+
+
+/**
+ * Matches every query row to its approximate
+ * nearest indexed row and filters the matches
+ * with Lowe's ratio test
+ *
+ * @param query		Query descriptors, CV_32F or CV_8U rows
+ * @param matches	Kept matches in query order, see knnMatch
+ * @param ratio		Maximum ratio of the best to the second best distance, 1 disables it
+ *
+ * @return	Replaces matches
+ */
+void KDForest::match(const Mat& query, vector<DMatch>& matches, float ratio) const
+{
+	vector<vector<DMatch> > candidates;
+	knnMatch(query, candidates, 2);
+
+	matches.clear();
+	for (size_t q = 0; q < candidates.size(); q++)
+	{
+		if (candidates[q].empty())
+			continue;
+		if (ratio < 1 && candidates[q].size() > 1 && candidates[q][0].distance >= ratio * candidates[q][1].distance)
+			continue;
+
+		matches.push_back(candidates[q][0]);
+	}
+}
+
+
+
+/**
+ * Frees the index and unmaps a loaded index file
+ */
+void KDForest::release()
+{
+	data.release();
+	file.close();
+	nodes.clear();
+	roots.clear();
+	indices.clear();
+	sourceStarts.clear();
+	sourceNames.clear();
+}
+
+
+
+/**
+ * Number of indexed descriptors
+ *
+ * @return	Returns 0 if nothing is indexed
+ */
+int KDForest::size() const
+{
+	return data.rows;
+}
+
+
+
+/**
+ * Length of the indexed descriptors
+ *
+ * @return	Returns 0 if nothing is indexed
+ */
+int KDForest::dims() const
+{
+	return data.cols;
+}
+
+
+
+/**
+ * Number of sources of the index, one per feature
+ * file, or one if built from a matrix
+ *
+ * @return	Returns 0 if nothing is indexed
+ */
+int KDForest::sourceCount() const
+{
+	return sourceStarts.size();
+}
+
+
+
+/**
+ * Name of a source
+ *
+ * @param source	Source index
+ *
+ * @return	Returns the feature file path, empty for a matrix
+ */
+string KDForest::sourceName(int source) const
+{
+	return sourceNames[source];
+}
+
+
+
+/**
+ * Source and row within the source of an indexed
+ * descriptor, the descriptor of a feature file
+ * is found by its row
+ *
+ * @param index		Row of the index
+ * @param source	Source of the row
+ * @param row		Row within the source
+ */
+void KDForest::locate(int index, int& source, int& row) const
+{
+	source = upper_bound(sourceStarts.begin(), sourceStarts.end(), index) - sourceStarts.begin() - 1;
+	row = index - sourceStarts[source];
+}
+
+
+
+/** Pads the file with zeros up to the next aligned offset **/
+static uint64 padTo(FILE* f, uint64 offset)
+{
+	static const char zeros[FEATURE_FILE_ALIGN] = { 0 };
+	uint64 aligned = alignSize(offset, FEATURE_FILE_ALIGN);
+
+	fwrite(zeros, 1, aligned - offset, f);
+	return aligned;
+}
+
+
+
+/**
+ * Writes the index, descriptors included, to a
+ * versioned binary file that load() maps back
+ *
+ * @param path		File path
+ *
+ * @return	false if the file cannot be written
+ */
+bool KDForest::save(const string& path) const
+{
+	string names;
+	for (size_t i = 0; i < sourceNames.size(); i++)
+		names += sourceNames[i] + "\n";
+
+	KDForestHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, KD_FOREST_MAGIC, sizeof(header.magic));
+
+	size_t rowBytes = data.cols * sizeof(float);
+	header.version = KD_FOREST_VERSION;
+	header.headerSize = sizeof(KDForestHeader);
+	header.count = data.rows;
+	header.dims = data.cols;
+	header.trees = roots.size();
+	header.nodeCount = nodes.size();
+	header.nodeSize = sizeof(KDNode);
+	header.sourceCount = sourceStarts.size();
+	header.dataOffset = alignSize(sizeof(KDForestHeader), FEATURE_FILE_ALIGN);
+	header.nodeOffset = alignSize(header.dataOffset + (uint64) data.rows * rowBytes, FEATURE_FILE_ALIGN);
+	header.rootOffset = alignSize(header.nodeOffset + (uint64) nodes.size() * sizeof(KDNode), FEATURE_FILE_ALIGN);
+	header.indexOffset = alignSize(header.rootOffset + roots.size() * sizeof(int), FEATURE_FILE_ALIGN);
+	header.sourceOffset = alignSize(header.indexOffset + (uint64) indices.size() * sizeof(int), FEATURE_FILE_ALIGN);
+	header.namesOffset = alignSize(header.sourceOffset + sourceStarts.size() * sizeof(int), FEATURE_FILE_ALIGN);
+	header.namesSize = names.size();
+	header.fileSize = header.namesOffset + header.namesSize;
+
+	FILE* f = fopen(path.c_str(), "wb");
+	if (!f)
+		return false;
+
+	fwrite(&header, sizeof(header), 1, f);
+	uint64 offset = padTo(f, sizeof(header));
+
+	for (int i = 0; i < data.rows; i++)
+		fwrite(data.ptr<float>(i), 1, rowBytes, f);
+	offset = padTo(f, offset + (uint64) data.rows * rowBytes);
+
+	if (!nodes.empty())
+		fwrite(&nodes[0], sizeof(KDNode), nodes.size(), f);
+	offset = padTo(f, offset + (uint64) nodes.size() * sizeof(KDNode));
+
+	if (!roots.empty())
+		fwrite(&roots[0], sizeof(int), roots.size(), f);
+	offset = padTo(f, offset + roots.size() * sizeof(int));
+
+	if (!indices.empty())
+		fwrite(&indices[0], sizeof(int), indices.size(), f);
+	offset = padTo(f, offset + (uint64) indices.size() * sizeof(int));
+
+	if (!sourceStarts.empty())
+		fwrite(&sourceStarts[0], sizeof(int), sourceStarts.size(), f);
+	padTo(f, offset + sourceStarts.size() * sizeof(int));
+
+	fwrite(names.data(), 1, names.size(), f);
+
+	bool ok = !ferror(f);
+	ok = fclose(f) == 0 && ok;
+	return ok;
+}
+
+
+
+/**
+ * Maps an index file and validates its header,
+ * block bounds and tree links. divide adds the
+ * children after their parent, so inner nodes must
+ * only link forward, which keeps a corrupt file
+ * from sending search around a cycle. Descriptors
+ * are served from the mapping, the trees are copied
+ *
+ * @param path		File path
+ *
+ * @return	false if the file is missing, truncated, corrupt or of another version
+ */
+bool KDForest::load(const string& path)
+{
+	release();
+
+	if (!file.open(path) || file.size() < sizeof(KDForestHeader))
+	{
+		release();
+		return false;
+	}
+
+	const uchar* base = file.data();
+	const KDForestHeader* h = (const KDForestHeader*) base;
+	bool valid = memcmp(h->magic, KD_FOREST_MAGIC, sizeof(h->magic)) == 0
+			&& h->version == KD_FOREST_VERSION
+			&& h->headerSize == sizeof(KDForestHeader)
+			&& h->nodeSize == sizeof(KDNode)
+			&& (h->trees > 0 || h->count == 0)
+			&& h->fileSize == file.size()
+			&& h->dataOffset + (uint64) h->count * h->dims * sizeof(float) <= h->nodeOffset
+			&& h->nodeOffset + (uint64) h->nodeCount * sizeof(KDNode) <= h->rootOffset
+			&& h->rootOffset + (uint64) h->trees * sizeof(int) <= h->indexOffset
+			&& h->indexOffset + (uint64) h->trees * h->count * sizeof(int) <= h->sourceOffset
+			&& h->sourceOffset + (uint64) h->sourceCount * sizeof(int) <= h->namesOffset
+			&& h->namesOffset + h->namesSize <= h->fileSize;
+
+	if (!valid)
+	{
+		release();
+		return false;
+	}
+
+	const KDNode* fileNodes = (const KDNode*) (base + h->nodeOffset);
+	const int* fileRoots = (const int*) (base + h->rootOffset);
+	const int* fileIndices = (const int*) (base + h->indexOffset);
+	const int* fileStarts = (const int*) (base + h->sourceOffset);
+	nodes.assign(fileNodes, fileNodes + h->nodeCount);
+	roots.assign(fileRoots, fileRoots + h->trees);
+	indices.assign(fileIndices, fileIndices + (size_t) h->trees * h->count);
+	sourceStarts.assign(fileStarts, fileStarts + h->sourceCount);
+
+	for (size_t i = 0; i < roots.size() && valid; i++)
+		valid = roots[i] >= 0 && roots[i] < (int) nodes.size();
+	for (size_t i = 0; i < nodes.size() && valid; i++)
+	{
+		const KDNode& node = nodes[i];
+		if (node.dim < 0)
+			valid = node.left >= 0 && node.left <= node.right && node.right <= (int) indices.size();
+		else
+			valid = node.dim < (int) h->dims && node.left > (int) i && node.left < (int) nodes.size()
+					&& node.right > (int) i && node.right < (int) nodes.size();
+	}
+	for (size_t i = 0; i < indices.size() && valid; i++)
+		valid = indices[i] >= 0 && indices[i] < (int) h->count;
+
+	string names((const char*) base + h->namesOffset, h->namesSize);
+	for (size_t start = 0; start < names.size();)
+	{
+		size_t end = names.find('\n', start);
+		if (end == string::npos)
+			end = names.size();
+		sourceNames.push_back(names.substr(start, end - start));
+		start = end + 1;
+	}
+
+	if (!valid || sourceNames.size() != sourceStarts.size())
+	{
+		release();
+		return false;
+	}
+
+	if (h->trees > 0)
+		nTrees = h->trees;
+	data = Mat(h->count, h->dims, CV_32F, (void*) (base + h->dataOffset));
+	return true;
+}
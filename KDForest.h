@@ -0,0 +1,161 @@
+/*
+ * KDForest.h
+ *
+ *  Created on: Oct 15, 2026
+ */
+
+#ifndef KD_FOREST_H
+#define KD_FOREST_H
+
+#include "opencv2/opencv.hpp"
+#include "FeatureFile.h"
+
+using namespace std;
+using namespace cv;
+
+#define KD_FOREST_MAGIC						"SIFTKDFO"
+#define KD_FOREST_VERSION					1
+#define SIFT_KD_TREES						4
+#define SIFT_KD_CHECKS						128
+#define SIFT_KD_LEAF_SIZE					8
+#define SIFT_KD_SAMPLES						100
+#define SIFT_KD_TOP_DIMS					5
+#define SIFT_KD_QUERY_BLOCK					64
+
+/**
+ * Header at offset 0 of an index file. Blocks are
+ * stored in native byte order at 64 byte aligned
+ * offsets: float descriptor rows, tree nodes, the
+ * root node of every tree, the point order of
+ * every tree, the first row of every source and
+ * the newline separated source names
+ */
+struct KDForestHeader
+{
+	char magic[8];
+	unsigned int version;
+	unsigned int headerSize;
+	unsigned int count;
+	unsigned int dims;
+	unsigned int trees;
+	unsigned int nodeCount;
+	unsigned int nodeSize;
+	unsigned int sourceCount;
+	uint64 dataOffset;
+	uint64 nodeOffset;
+	uint64 rootOffset;
+	uint64 indexOffset;
+	uint64 sourceOffset;
+	uint64 namesOffset;
+	uint64 namesSize;
+	uint64 fileSize;
+};
+
+/** Node of a tree, a leaf has dim -1 and holds the range [left, right) of the point order **/
+struct KDNode
+{
+	int dim;
+	float split;
+	int left;
+	int right;
+};
+
+/**
+ * Approximate nearest neighbour index of descriptor
+ * rows: randomized KD-trees, each splitting on one
+ * of the highest variance dimensions at random,
+ * searched together best bin first until a fixed
+ * number of descriptors has been checked. Searches
+ * do not modify the forest, so one forest can be
+ * queried from several threads
+ */
+class KDForest
+{
+private:
+	int nTrees;
+	int maxChecks;
+	int nThreads;
+	Mat data;
+	vector<KDNode> nodes;
+	vector<int> roots;
+	vector<int> indices;
+	vector<int> sourceStarts;
+	vector<string> sourceNames;
+	MappedFile file;
+
+	/** Subtree left for later in a best bin first search **/
+	struct Branch
+	{
+		float distance;
+		int node;
+
+		/** Reversed, so that the top of a heap is the nearest branch **/
+		bool operator<(const Branch& other) const
+		{
+			return distance > other.distance;
+		}
+	};
+
+	class BuildInvoker;
+	class SearchInvoker;
+
+	KDForest(const KDForest&);
+	KDForest& operator=(const KDForest&);
+
+	/** Builds the trees over the rows of data **/
+	void buildTrees();
+
+	/** Splits the points [begin, end) of a tree order and appends their subtree **/
+	int divide(vector<KDNode>& tree, int* order, int begin, int end, RNG& rng) const;
+
+	/** The k approximate nearest rows of one query, nearest first **/
+	int search(const float* query, int k, int* best, float* distances, vector<Branch>& heap,
+			vector<int>& visited) const;
+
+public:
+	KDForest(int trees = SIFT_KD_TREES, int checks = SIFT_KD_CHECKS, int threads = 1);
+
+	/** Number of descriptors checked per query, more checks give a higher recall **/
+	void setChecks(int checks);
+
+	/** Most pool threads queries and trees are partitioned over at once **/
+	void setThreadCount(int threads);
+
+	/** Indexes the rows of a descriptor matrix **/
+	void build(const Mat& descriptors);
+
+	/** Indexes the descriptors of a set of feature files **/
+	bool build(const vector<string>& featureFiles);
+
+	/** Writes the index to a file **/
+	bool save(const string& path) const;
+
+	/** Maps an index file, the descriptors are served from the mapping **/
+	bool load(const string& path);
+
+	/** Frees the index **/
+	void release();
+
+	/** Number of indexed descriptors **/
+	int size() const;
+
+	/** Length of the indexed descriptors **/
+	int dims() const;
+
+	/** Number of sources, feature files or matrices, of the index **/
+	int sourceCount() const;
+
+	/** Name of a source, the feature file path **/
+	string sourceName(int source) const;
+
+	/** Source and row within the source of an indexed descriptor **/
+	void locate(int index, int& source, int& row) const;
+
+	/** The k approximate nearest descriptors of every query row **/
+	void knnMatch(const Mat& query, vector<vector<DMatch> >& matches, int k) const;
+
+	/** Approximate nearest descriptor of every query row, filtered by Lowe's ratio **/
+	void match(const Mat& query, vector<DMatch>& matches, float ratio) const;
+};
+
+#endif
@@ -0,0 +1,235 @@
+/*
+ * Matcher.cpp
+ *
+ *  Created on: Oct 15, 2026
+ */
+
+#include <float.h>
+#include "Matcher.h"
+#include "SIFTKernels.h"
+
+/**
+ * Finds the two nearest train rows of a block of
+ * query rows per task
+ */
+class SIFTMatcher::NearestInvoker : public ParallelLoopBody
+{
+public:
+	NearestInvoker(const Mat& _query, const Mat& _train, const vector<float>& _queryNorms,
+			const vector<float>& _trainNorms, vector<int>& _best, vector<float>& _bestDistance,
+			vector<float>& _secondDistance) :
+			query(_query), train(_train), queryNorms(_queryNorms), trainNorms(_trainNorms), best(_best),
+			bestDistance(_bestDistance), secondDistance(_secondDistance)
+	{
+	}
+
+	void operator()(const Range& range) const
+	{
+		KernelPath path = bestKernelPath();
+		float products[4 * SIFT_MATCH_TRAIN_BLOCK];
+
+		for (int block = range.start; block < range.end; block++)
+		{
+			int qStart = block * SIFT_MATCH_QUERY_BLOCK;
+			int qEnd = min(qStart + SIFT_MATCH_QUERY_BLOCK, query.rows);
+
+			for (int q = qStart; q < qEnd; q++)
+			{
+				best[q] = -1;
+				bestDistance[q] = FLT_MAX;
+				secondDistance[q] = FLT_MAX;
+			}
+
+			for (int tStart = 0; tStart < train.rows; tStart += SIFT_MATCH_TRAIN_BLOCK)
+			{
+				int nTrain = min(SIFT_MATCH_TRAIN_BLOCK, train.rows - tStart);
+
+				for (int q = qStart; q < qEnd; q += 4)
+				{
+					int nQueries = min(4, qEnd - q);
+					const float* rows[4];
+					for (int k = 0; k < nQueries; k++)
+						rows[k] = query.ptr<float>(q + k);
+
+					dotProducts(rows, nQueries, train.ptr<float>(tStart), train.step1(), nTrain, train.cols,
+							products, path);
+
+					for (int k = 0; k < nQueries; k++)
+					{
+						const float* dots = products + k * nTrain;
+						int qi = q + k;
+
+						for (int t = 0; t < nTrain; t++)
+						{
+							float distance = queryNorms[qi] + trainNorms[tStart + t] - 2 * dots[t];
+
+							if (distance < bestDistance[qi])
+							{
+								secondDistance[qi] = bestDistance[qi];
+								bestDistance[qi] = distance;
+								best[qi] = tStart + t;
+							}
+							else if (distance < secondDistance[qi])
+							{
+								secondDistance[qi] = distance;
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+
+private:
+	const Mat& query;
+	const Mat& train;
+	const vector<float>& queryNorms;
+	const vector<float>& trainNorms;
+	vector<int>& best;
+	vector<float>& bestDistance;
+	vector<float>& secondDistance;
+};
+
+
+
+SIFTMatcher::SIFTMatcher(float maxRatio, bool enableCrossCheck, int threads)
+{
+	setRatio(maxRatio);
+	setCrossCheck(enableCrossCheck);
+	setThreadCount(threads);
+}
+
+
+
+/**
+ * Sets Lowe's ratio test, a match is kept if its
+ * distance is below ratio times the distance to
+ * the second nearest train descriptor
+ *
+ * @param maxRatio	Ratio in (0, 1], 1 disables the test
+ */
+void SIFTMatcher::setRatio(float maxRatio)
+{
+	ratio = maxRatio;
+}
+
+
+
+/**
+ * Keeps only matches whose train descriptor has
+ * the query descriptor as its own nearest match
+ *
+ * @param enable	Cross check on/off
+ */
+void SIFTMatcher::setCrossCheck(bool enable)
+{
+	crossCheck = enable;
+}
+
+
+
+/**
+ * Sets the largest number of OpenCV pool threads
+ * the query rows are partitioned over at once. The
+ * pool size itself is not changed
+ *
+ * @param threads	Number of threads, 1 for serial
+ */
+void SIFTMatcher::setThreadCount(int threads)
+{
+	nThreads = max(threads, 1);
+}
+
+
+
+/** Squared L2 norm of every row of a float matrix **/
+static void rowNorms(const Mat& rows, vector<float>& norms)
+{
+	norms.resize(rows.rows);
+	for (int i = 0; i < rows.rows; i++)
+	{
+		const float* row = rows.ptr<float>(i);
+		float sum = 0;
+		for (int d = 0; d < rows.cols; d++)
+			sum += row[d] * row[d];
+		norms[i] = sum;
+	}
+}
+
+
+
+/**
+ * Finds the two nearest train rows of every query
+ * row, by squared L2 distance
+ *
+ * @param query				Float query rows
+ * @param train				Float train rows
+ * @param best				Index of the nearest train row
+ * @param bestDistance		Squared distance to the nearest row
+ * @param secondDistance	Squared distance to the second nearest row
+ */
+void SIFTMatcher::nearestTwo(const Mat& query, const Mat& train, vector<int>& best, vector<float>& bestDistance,
+		vector<float>& secondDistance)
+{
+	vector<float> queryNorms, trainNorms;
+	rowNorms(query, queryNorms);
+	rowNorms(train, trainNorms);
+
+	best.resize(query.rows);
+	bestDistance.resize(query.rows);
+	secondDistance.resize(query.rows);
+
+	int nBlocks = (query.rows + SIFT_MATCH_QUERY_BLOCK - 1) / SIFT_MATCH_QUERY_BLOCK;
+	NearestInvoker invoker(query, train, queryNorms, trainNorms, best, bestDistance, secondDistance);
+
+	runParallel(Range(0, nBlocks), invoker, nThreads);
+}
+
+
+
+/**
+ * Matches every query descriptor to its nearest
+ * train descriptor and filters the matches with
+ * the ratio test and the optional cross check
+ *
+ * @param query		Query descriptors, CV_32F or CV_8U rows
+ * @param train		Train descriptors of the same length and type
+ * @param matches	Kept matches in query order, distance is L2
+ *
+ * @return	Replaces matches
+ */
+void SIFTMatcher::match(const Mat& query, const Mat& train, vector<DMatch>& matches)
+{
+	CV_Assert(query.type() == train.type() && (query.type() == CV_32F || query.type() == CV_8U));
+	CV_Assert(query.empty() || train.empty() || query.cols == train.cols);
+
+	matches.clear();
+	if (query.empty() || train.empty())
+		return;
+
+	Mat queryRows = query, trainRows = train;
+	if (query.type() != CV_32F)
+	{
+		query.convertTo(queryRows, CV_32F);
+		train.convertTo(trainRows, CV_32F);
+	}
+
+	vector<int> best, reverseBest;
+	vector<float> bestDistance, secondDistance, reverseDistance, reverseSecond;
+	nearestTwo(queryRows, trainRows, best, bestDistance, secondDistance);
+	if (crossCheck)
+		nearestTwo(trainRows, queryRows, reverseBest, reverseDistance, reverseSecond);
+
+	float ratioSquared = ratio * ratio;
+	for (int q = 0; q < query.rows; q++)
+	{
+		float distance = max(bestDistance[q], 0.f);
+
+		if (ratio < 1 && train.rows > 1 && distance >= ratioSquared * secondDistance[q])
+			continue;
+		if (crossCheck && reverseBest[best[q]] != q)
+			continue;
+
+		matches.push_back(DMatch(q, best[q], sqrt(distance)));
+	}
+}
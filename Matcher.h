@@ -0,0 +1,56 @@
+/*
+ * Matcher.h
+ *
+ *  Created on: Oct 15, 2026
+ */
+
+#ifndef MATCHER_H
+#define MATCHER_H
+
+#include "opencv2/opencv.hpp"
+
+using namespace std;
+using namespace cv;
+
+#define SIFT_MATCH_RATIO					0.8
+#define SIFT_MATCH_QUERY_BLOCK				64
+#define SIFT_MATCH_TRAIN_BLOCK				256
+
+/**
+ * Brute force matcher of two descriptor sets by L2
+ * distance. Distances come from blocked SIMD dot
+ * products, ||q||^2 + ||t||^2 - 2 q.t, with a block
+ * of train rows kept in cache while a block of
+ * queries runs over it. Queries are partitioned
+ * over the threads
+ */
+class SIFTMatcher
+{
+private:
+	float ratio;
+	bool crossCheck;
+	int nThreads;
+
+	class NearestInvoker;
+
+	/** Finds the two nearest train rows of every query row **/
+	void nearestTwo(const Mat& query, const Mat& train, vector<int>& best, vector<float>& bestDistance,
+			vector<float>& secondDistance);
+
+public:
+	SIFTMatcher(float maxRatio = SIFT_MATCH_RATIO, bool enableCrossCheck = false, int threads = 1);
+
+	/** Lowe's ratio between the best and the second best distance, 1 disables it **/
+	void setRatio(float maxRatio);
+
+	/** Keeps only matches that are also the best match from train to query **/
+	void setCrossCheck(bool enable);
+
+	/** Most pool threads the queries are partitioned over at once **/
+	void setThreadCount(int threads);
+
+	/** Matches every query descriptor to its nearest train descriptor **/
+	void match(const Mat& query, const Mat& train, vector<DMatch>& matches);
+};
+
+#endif
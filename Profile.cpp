@@ -0,0 +1,200 @@
+/*
+ * Profile.cpp
+ *
+ *  Created on: Oct 15, 2026
+ */
+
+#include <stdio.h>
+#include "Profile.h"
+
+OctaveCounters::OctaveCounters()
+{
+	tested = 0;
+	lowContrast = 0;
+	edges = 0;
+	unstable = 0;
+	kept = 0;
+	oriented = 0;
+}
+
+
+
+/**
+ * Adds the counts of another octave or tile
+ *
+ * @param other		Counts to add
+ */
+void OctaveCounters::add(const OctaveCounters& other)
+{
+	tested += other.tested;
+	lowContrast += other.lowContrast;
+	edges += other.edges;
+	unstable += other.unstable;
+	kept += other.kept;
+	oriented += other.oriented;
+}
+
+
+
+SIFTProfile::SIFTProfile(bool traceEvents)
+{
+	recordEvents = traceEvents;
+	reset();
+}
+
+
+
+/**
+ * Clears every counter and span, the event times
+ * restart from now
+ */
+void SIFTProfile::reset()
+{
+	frames = 0;
+	for (int s = 0; s < STAGE_COUNT; s++)
+		stageMs[s] = 0;
+	octaves.clear();
+	events.clear();
+	origin = getTickCount();
+}
+
+
+
+/**
+ * Accounts for one run of a stage
+ *
+ * @param stage			Stage index
+ * @param startTicks	Tick count at the start of the run
+ * @param endTicks		Tick count at the end of the run
+ */
+void SIFTProfile::addStage(int stage, int64 startTicks, int64 endTicks)
+{
+	double toUs = 1e6 / getTickFrequency();
+	stageMs[stage] += (endTicks - startTicks) * toUs / 1000;
+
+	if (recordEvents)
+	{
+		ProfileEvent event;
+		event.stage = stage;
+		event.frame = frames;
+		event.start = (startTicks - origin) * toUs;
+		event.duration = (endTicks - startTicks) * toUs;
+		events.push_back(event);
+	}
+}
+
+
+
+/**
+ * Adds time to a stage without recording a span,
+ * for work spread over the threads of a stage
+ *
+ * @param stage		Stage index
+ * @param ticks		Tick counts to add
+ */
+void SIFTProfile::addTicks(int stage, int64 ticks)
+{
+	stageMs[stage] += ticks * 1000.0 / getTickFrequency();
+}
+
+
+
+/**
+ * Adds the counts of an octave
+ *
+ * @param octave	Octave index
+ * @param counters	Counts to add
+ */
+void SIFTProfile::addCounters(int octave, const OctaveCounters& counters)
+{
+	if ((int) octaves.size() <= octave)
+		octaves.resize(octave + 1);
+	octaves[octave].add(counters);
+}
+
+
+
+/**
+ * Name of a stage in reports
+ *
+ * @param stage		Stage index
+ *
+ * @return	Returns the stage name
+ */
+const char* SIFTProfile::stageName(int stage)
+{
+	static const char* names[STAGE_COUNT] = { "pyramid", "dog", "extrema", "clean", "orientation" };
+	return stage >= 0 && stage < STAGE_COUNT ? names[stage] : "unknown";
+}
+
+
+
+/**
+ * Writes the frame count, the total and mean time
+ * of every stage and the counters of every octave
+ * as one JSON object
+ *
+ * @param path		Output file
+ *
+ * @return	false if the file could not be written
+ */
+bool SIFTProfile::writeJson(const string& path) const
+{
+	FILE* f = fopen(path.c_str(), "w");
+	if (!f)
+		return false;
+
+	fprintf(f, "{\n  \"frames\": %d,\n  \"stages\": {\n", frames);
+	for (int s = 0; s < STAGE_COUNT; s++)
+		fprintf(f, "    \"%s\": { \"ms\": %.3f, \"meanMs\": %.3f }%s\n", stageName(s), stageMs[s],
+				frames > 0 ? stageMs[s] / frames : 0.0, s + 1 < STAGE_COUNT ? "," : "");
+
+	fprintf(f, "  },\n  \"octaves\": [\n");
+	for (size_t i = 0; i < octaves.size(); i++)
+	{
+		const OctaveCounters& c = octaves[i];
+		fprintf(f, "    { \"octave\": %d, \"tested\": %lld, \"lowContrast\": %lld, \"edges\": %lld, "
+				"\"unstable\": %lld, \"kept\": %lld, \"oriented\": %lld }%s\n", (int) i, (long long) c.tested,
+				(long long) c.lowContrast, (long long) c.edges, (long long) c.unstable, (long long) c.kept,
+				(long long) c.oriented, i + 1 < octaves.size() ? "," : "");
+	}
+	fprintf(f, "  ]\n}\n");
+
+	bool ok = !ferror(f);
+	ok = fclose(f) == 0 && ok;
+	return ok;
+}
+
+
+
+/**
+ * Writes the stage spans as complete events of the
+ * Chrome trace event format, for chrome://tracing
+ * or Perfetto. Every span carries its frame index.
+ * cleanPoints has no span of its own, it runs on
+ * the workers inside the extrema spans
+ *
+ * @param path		Output file
+ *
+ * @return	false if the file could not be written
+ */
+bool SIFTProfile::writeTrace(const string& path) const
+{
+	FILE* f = fopen(path.c_str(), "w");
+	if (!f)
+		return false;
+
+	fprintf(f, "{\"traceEvents\":[\n");
+	for (size_t e = 0; e < events.size(); e++)
+	{
+		const ProfileEvent& event = events[e];
+		fprintf(f, "{\"name\":\"%s\",\"cat\":\"sift\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":0,\"tid\":0,"
+				"\"args\":{\"frame\":%d}}%s\n", stageName(event.stage), event.start, event.duration, event.frame,
+				e + 1 < events.size() ? "," : "");
+	}
+	fprintf(f, "],\"displayTimeUnit\":\"ms\"}\n");
+
+	bool ok = !ferror(f);
+	ok = fclose(f) == 0 && ok;
+	return ok;
+}
@@ -0,0 +1,104 @@
+/*
+ * Profile.h
+ *
+ *  Created on: Oct 15, 2026
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "opencv2/opencv.hpp"
+
+using namespace std;
+using namespace cv;
+
+/** Timed stages of the detector, cleanPoints runs inside the extrema scan **/
+enum ProfileStage
+{
+	STAGE_PYRAMID = 0,
+	STAGE_DOG = 1,
+	STAGE_EXTREMA = 2,
+	STAGE_CLEAN = 3,
+	STAGE_ORIENTATION = 4,
+	STAGE_COUNT = 5
+};
+
+/** Fate of the extremum candidates of an octave **/
+struct OctaveCounters
+{
+	int64 tested;
+	int64 lowContrast;
+	int64 edges;
+	int64 unstable;
+	int64 kept;
+	int64 oriented;
+
+	OctaveCounters();
+
+	/** Adds the counts of another octave or tile **/
+	void add(const OctaveCounters& other);
+};
+
+/** Wall time span of a stage, in microseconds since the profile was reset **/
+struct ProfileEvent
+{
+	int stage;
+	int frame;
+	double start;
+	double duration;
+};
+
+/**
+ * Time spent in every stage of the detector and
+ * the candidate counts of every octave, summed over
+ * the frames. The cleanPoints time is summed over
+ * the threads scanning for extremas. With events
+ * enabled every stage run is also kept as a span
+ * for a Chrome trace
+ */
+class SIFTProfile
+{
+public:
+	/** Frames and images run through the detector **/
+	int frames;
+
+	/** Milliseconds per stage **/
+	double stageMs[STAGE_COUNT];
+
+	/** Candidate counts per octave **/
+	vector<OctaveCounters> octaves;
+
+	/** Stage spans, only kept with events enabled **/
+	vector<ProfileEvent> events;
+
+	/** Keep a span per stage run **/
+	bool recordEvents;
+
+	/** Tick count the event times are relative to **/
+	int64 origin;
+
+	SIFTProfile(bool traceEvents = false);
+
+	/** Clears every counter and span **/
+	void reset();
+
+	/** Accounts for one run of a stage between two tick counts **/
+	void addStage(int stage, int64 startTicks, int64 endTicks);
+
+	/** Adds time to a stage without a span, for work summed over threads **/
+	void addTicks(int stage, int64 ticks);
+
+	/** Adds the counts of an octave **/
+	void addCounters(int octave, const OctaveCounters& counters);
+
+	/** Name of a stage in reports **/
+	static const char* stageName(int stage);
+
+	/** Writes the stage times and the octave counters as JSON **/
+	bool writeJson(const string& path) const;
+
+	/** Writes the stage spans in the Chrome trace event format **/
+	bool writeTrace(const string& path) const;
+};
+
+#endif
@@ -0,0 +1,219 @@
+/*
+ * Pyramid.cpp
+ *
+ *  Created on: Oct 15, 2026
+ */
+
+#include "Pyramid.h"
+
+/** Levels start on a 64 byte boundary **/
+#define PYRAMID_ALIGN						64
+
+Pyramid::Pyramid()
+{
+	nOctaves = 0;
+	nIntervals = 0;
+	levelType = CV_32F;
+}
+
+
+
+/**
+ * Carves a level of the given size out of the arena
+ * and advances the cursor past it
+ *
+ * @param cursor	Next free byte of the arena
+ * @param size		Size of the level
+ * @param type		Type of the level
+ *
+ * @return	Returns the level header
+ */
+static Mat takeLevel(uchar*& cursor, Size size, int type)
+{
+	Mat level(size, type, cursor);
+	cursor += alignSize(size.area() * CV_ELEM_SIZE(type), PYRAMID_ALIGN);
+	return level;
+}
+
+
+
+/**
+ * Allocates every level of the Guassian and DOG
+ * pyramids, the octave bases and the scratch row
+ * in one arena. Octave sizes follow the halving of
+ * the downsampling, rounding down. 16 bit fixed
+ * point levels take half the memory of float ones
+ *
+ * @param size			Size of the base image
+ * @param octaves		Number of Octaves
+ * @param intervals		Number of Intervals
+ * @param type			CV_32F or CV_16S levels
+ *
+ * @return	false if the geometry did not change and nothing was allocated
+ */
+bool Pyramid::create(Size size, int octaves, int intervals, int type)
+{
+	CV_Assert(type == CV_32F || type == CV_16S);
+
+	if (!arena.empty() && size == baseSize && octaves == nOctaves && intervals == nIntervals
+			&& type == levelType)
+		return false;
+
+	vector<Size> sizes(octaves);
+	size_t total = alignSize(size.width * sizeof(float), PYRAMID_ALIGN);
+
+	for (int i = 0; i < octaves; i++)
+	{
+		sizes[i] = i == 0 ? size : Size(sizes[i - 1].width / 2, sizes[i - 1].height / 2);
+		size_t level = alignSize(sizes[i].area() * CV_ELEM_SIZE(type), PYRAMID_ALIGN);
+		total += level * ((i > 0 ? 1 : 0) + (intervals + 3) + (intervals + 2));
+	}
+
+	arena.create(1, total + PYRAMID_ALIGN, CV_8U);
+	gradientArena.release();
+	magnitude.clear();
+	angle.clear();
+	uchar* cursor = alignPtr(arena.ptr<uchar>(), PYRAMID_ALIGN);
+
+	bases.assign(octaves, Mat());
+	gauss.assign(octaves, vector<Mat>());
+	dog.assign(octaves, vector<Mat>());
+	scratch = takeLevel(cursor, Size(size.width, 1), CV_32F);
+
+	for (int i = 0; i < octaves; i++)
+	{
+		if (i > 0)
+			bases[i] = takeLevel(cursor, sizes[i], type);
+		for (int j = 0; j < intervals + 3; j++)
+			gauss[i].push_back(takeLevel(cursor, sizes[i], type));
+		for (int j = 0; j < intervals + 2; j++)
+			dog[i].push_back(takeLevel(cursor, sizes[i], type));
+	}
+
+	baseSize = size;
+	nOctaves = octaves;
+	nIntervals = intervals;
+	levelType = type;
+	return true;
+}
+
+
+
+/**
+ * Allocates the float gradient magnitude and angle
+ * levels of the DOG intervals, those keypoints are
+ * found on, in a second arena. They take as much
+ * memory as 2 * nIntervals float DOG levels, so
+ * they are only allocated once asked for and kept
+ * until the geometry changes
+ *
+ * @return	false if the levels were already allocated
+ */
+bool Pyramid::createGradients()
+{
+	CV_Assert(!arena.empty());
+
+	if (!gradientArena.empty())
+		return false;
+
+	size_t total = 0;
+	for (int i = 0; i < nOctaves; i++)
+		total += 2 * nIntervals * alignSize(dog[i][0].size().area() * sizeof(float), PYRAMID_ALIGN);
+
+	gradientArena.create(1, total + PYRAMID_ALIGN, CV_8U);
+	uchar* cursor = alignPtr(gradientArena.ptr<uchar>(), PYRAMID_ALIGN);
+
+	magnitude.assign(nOctaves, vector<Mat>());
+	angle.assign(nOctaves, vector<Mat>());
+	for (int i = 0; i < nOctaves; i++)
+	{
+		for (int j = 0; j < nIntervals; j++)
+		{
+			magnitude[i].push_back(takeLevel(cursor, dog[i][0].size(), CV_32F));
+			angle[i].push_back(takeLevel(cursor, dog[i][0].size(), CV_32F));
+		}
+	}
+
+	return true;
+}
+
+
+
+/**
+ * Releases the arenas and every level
+ */
+void Pyramid::release()
+{
+	bases.clear();
+	gauss.clear();
+	dog.clear();
+	magnitude.clear();
+	angle.clear();
+	scratch.release();
+	arena.release();
+	gradientArena.release();
+	baseSize = Size();
+	nOctaves = 0;
+	nIntervals = 0;
+	levelType = CV_32F;
+}
+
+
+
+/**
+ * Size of the base image
+ *
+ * @return	The size the pyramid was created for
+ */
+Size Pyramid::size() const
+{
+	return baseSize;
+}
+
+
+
+/**
+ * Number of octaves
+ *
+ * @return	The octaves the pyramid was created for
+ */
+int Pyramid::octaves() const
+{
+	return nOctaves;
+}
+
+
+
+/**
+ * Number of intervals
+ *
+ * @return	The intervals the pyramid was created for
+ */
+int Pyramid::intervals() const
+{
+	return nIntervals;
+}
+
+
+
+/**
+ * Type of the Guassian and DOG levels
+ *
+ * @return	CV_32F or CV_16S, as the pyramid was created
+ */
+int Pyramid::type() const
+{
+	return levelType;
+}
+
+
+
+/**
+ * Size of the arenas in bytes
+ *
+ * @return	Bytes held by the pyramid and gradient levels
+ */
+size_t Pyramid::bytes() const
+{
+	return arena.total() * arena.elemSize() + gradientArena.total() * gradientArena.elemSize();
+}
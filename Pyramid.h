@@ -0,0 +1,76 @@
+/*
+ * Pyramid.h
+ *
+ *  Created on: Oct 15, 2026
+ */
+
+#ifndef PYRAMID_H
+#define PYRAMID_H
+
+#include "opencv2/opencv.hpp"
+
+using namespace std;
+using namespace cv;
+
+/**
+ * Gaussian and DOG scale space pyramids whose levels
+ * all live in one contiguous arena. The arena is only
+ * reallocated when the geometry changes, so a pyramid
+ * kept across frames of the same size is rebuilt
+ * without any heap allocation
+ */
+class Pyramid
+{
+private:
+	Mat arena;
+	Mat gradientArena;
+	Size baseSize;
+	int nOctaves;
+	int nIntervals;
+	int levelType;
+
+public:
+	/** Octave bases, bases[0] is set to the input image on every build **/
+	vector<Mat> bases;
+
+	/** Guassian pyramid, nIntervals + 3 levels per octave **/
+	vector<vector<Mat> > gauss;
+
+	/** Difference of Guassians pyramid, nIntervals + 2 levels per octave **/
+	vector<vector<Mat> > dog;
+
+	/** Float row buffer of the octave downsampling, as wide as the base image **/
+	Mat scratch;
+
+	/** Float gradient magnitudes and angles of the DOG intervals 1 to nIntervals, empty until createGradients **/
+	vector<vector<Mat> > magnitude;
+	vector<vector<Mat> > angle;
+
+	Pyramid();
+
+	/** Allocates CV_32F or CV_16S levels for the given geometry, returns false if unchanged **/
+	bool create(Size size, int octaves, int intervals, int type = CV_32F);
+
+	/** Allocates the gradient levels in an arena of their own, returns false if already allocated **/
+	bool createGradients();
+
+	/** Releases the arena and every level **/
+	void release();
+
+	/** Size of the base image **/
+	Size size() const;
+
+	/** Number of octaves **/
+	int octaves() const;
+
+	/** Number of intervals **/
+	int intervals() const;
+
+	/** Type of the Guassian and DOG levels **/
+	int type() const;
+
+	/** Size of the arenas in bytes **/
+	size_t bytes() const;
+};
+
+#endif
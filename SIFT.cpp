@@ -1,4 +1,197 @@
+#include <float.h>
+#include <algorithm>
 #include "SIFT.h"
+#include "SIFTKernels.h"
+
+SIFT::SIFT()
+{
+	incrementalBlur = false;
+	fixedPoint = false;
+	fusedDog = false;
+	gradientPyramid = false;
+	fastGradients = false;
+	maxKeypoints = 0;
+	nThreads = 1;
+	profile = NULL;
+}
+
+
+
+/**
+ * Blur every interval of an octave from the previous
+ * interval with only the missing sigma instead of
+ * blurring the octave base with the full sigma
+ *
+ * @param enable	Incremental blur on/off
+ */
+void SIFT::setIncrementalBlur(bool enable)
+{
+	incrementalBlur = enable;
+}
+
+
+
+/**
+ * Runs the Guassian and DOG pyramids, the extrema
+ * scan and the orientation on 16 bit levels holding
+ * the [0, 1] range in SIFT_FIXED_SHIFT fraction bits,
+ * blurred with integer kernels. The levels take half
+ * the memory of float ones. Streams and regions keep
+ * the float pipeline
+ *
+ * @param enable	Fixed point on/off
+ */
+void SIFT::setFixedPoint(bool enable)
+{
+	fixedPoint = enable;
+}
+
+
+
+/**
+ * Builds every DOG interval right after the Guassian
+ * interval it needs, on cache sized tiles, instead
+ * of writing the whole Guassian pyramid before the
+ * DOG pass reads it back. The intervals are always
+ * blurred from the octave base, the incremental blur
+ * setting is ignored. The DOG time is accounted to
+ * the pyramid stage of a profile
+ *
+ * @param enable	Fused DOG on/off
+ */
+void SIFT::setFusedDog(bool enable)
+{
+	fusedDog = enable;
+}
+
+
+
+/**
+ * Computes the gradient magnitude and angle of every
+ * DOG interval once per frame, and cuts the windows
+ * of the orientation and descriptor stages out of
+ * them, instead of recomputing a window around every
+ * keypoint. Pays off when the windows overlap, on
+ * dense keypoints, at the cost of two float levels
+ * per interval. Streams and regions keep computing
+ * the windows per keypoint
+ *
+ * @param enable	Gradient pyramid on/off
+ */
+void SIFT::setGradientPyramid(bool enable)
+{
+	gradientPyramid = enable;
+}
+
+
+
+/**
+ * Computes the gradient angles with a polynomial
+ * arctangent and, on SSE2 and AVX, the magnitudes
+ * with a reciprocal square root estimate, instead
+ * of atan2f and sqrt. Angles are within 0.001
+ * degrees and magnitudes within 2^-21 relatively
+ * of the exact ones, so an angle only changes bin
+ * when it lies that close to a bin edge
+ *
+ * @param enable	Fast gradients on/off
+ */
+void SIFT::setFastGradients(bool enable)
+{
+	fastGradients = enable;
+}
+
+
+
+/**
+ * Limits the keypoints of a detection to those with
+ * the strongest DOG response. With a grid the image
+ * is split in cells and the budget is dealt out one
+ * keypoint per cell at a time, so weak but isolated
+ * keypoints beat the runners-up of crowded cells.
+ * The budget is applied to the extremas, before any
+ * orientation work, except for streams and regions
+ * which select among their oriented keypoints
+ *
+ * @param budget	Maximum number of keypoints, 0 for no limit
+ * @param grid		Cells across and down the image, empty for no grid
+ */
+void SIFT::setKeypointBudget(int budget, Size grid)
+{
+	maxKeypoints = max(budget, 0);
+	budgetGrid = grid;
+}
+
+
+
+/**
+ * Sets the largest number of OpenCV pool threads
+ * every stage of the pipeline runs on at once. It
+ * is a cap on the concurrency of this detector, the
+ * pool size set with setNumThreads is left alone.
+ * The output is the same for any thread count
+ *
+ * @param threads	Number of threads, 1 for serial
+ */
+void SIFT::setThreadCount(int threads)
+{
+	nThreads = max(threads, 1);
+}
+
+
+
+/**
+ * Records the wall time of every stage, the time
+ * spent in cleanPoints and the candidate counts of
+ * every octave into a profile, until set to NULL.
+ * The profile is not owned and must outlive the
+ * detector calls. Without a profile nothing is
+ * measured
+ *
+ * @param target	Profile to accumulate into, or NULL
+ */
+void SIFT::setProfile(SIFTProfile* target)
+{
+	profile = target;
+}
+
+
+
+/**
+ * Runs the given loop body over the range on the
+ * OpenCV thread pool with at most nThreads workers,
+ * or inline on the calling thread when serial
+ *
+ * @param range		Task range
+ * @param body		Loop body processing a sub range
+ */
+void SIFT::runParallel(const Range& range, const ParallelLoopBody& body)
+{
+	::runParallel(range, body, nThreads);
+}
+
+
+
+/** Times a stage into a profile from construction to destruction, if there is one **/
+struct StageTimer
+{
+	SIFTProfile* profile;
+	int stage;
+	int64 start;
+
+	StageTimer(SIFTProfile* _profile, int _stage) :
+			profile(_profile), stage(_stage), start(_profile ? getTickCount() : 0)
+	{
+	}
+
+	~StageTimer()
+	{
+		if (profile)
+			profile->addStage(stage, start, getTickCount());
+	}
+};
+
+
 
 /**
  * Finds the SIFT keypoints in
@@ -10,320 +203,2300 @@
  * @param nIntervals Number of Octaves
  *
  *
- * @return gauss_pyr
+ * @return gauss_pyr
+ */
+void SIFT::findSiftInterestPoint(Mat& image, vector<KeyPoint>& keypoints, int nOctaves, int nIntervals)
+{
+	extractKeypoints(image, keypoints, defaultWorkspace, nOctaves, nIntervals);
+}
+
+
+
+/**
+ * Finds the SIFT keypoints of a video frame. The
+ * workspace buffers are allocated on the first frame
+ * and reused by every following frame of the same
+ * size. Keypoints and gradient windows of the previous
+ * frame are replaced. Keypoints too close to the border
+ * for a gradient window are dropped, so keypoints[i]
+ * matches row i of computeDescriptors
+ *
+ * @param image		The target frame, BGR or grayscale
+ * @param keypoints	Keypoints vector
+ * @param workspace	Buffers reused across frames, updates workspace.stats
+ * @param nOctaves	Number of Octaves
+ * @param nIntervals Number of Intervals
+ *
+ * @return Updates the keypoints with the features of the frame
+ */
+void SIFT::findSiftInterestPoint(Mat& image, vector<KeyPoint>& keypoints, SIFTWorkspace& workspace,
+		int nOctaves, int nIntervals)
+{
+	keypoints.clear();
+	keypointsGradients.clear();
+	keypointsMagnitudes.clear();
+
+	extractKeypoints(image, keypoints, workspace, nOctaves, nIntervals);
+
+	size_t kept = 0;
+	for (size_t z = 0; z < keypoints.size(); z++)
+		if (keypoints[z].angle >= 0)
+			keypoints[kept++] = keypoints[z];
+	keypoints.resize(kept);
+}
+
+
+
+/**
+ * Marks the tiles with a pixel that differs from
+ * the reference by more than threshold
+ *
+ * @param gray			8 bit frame
+ * @param reference		8 bit frame the pyramids were built from
+ * @param difference	Absolute difference, reused across frames
+ * @param tile			Tile size in pixels
+ * @param threshold		Gray level difference marking a tile dirty
+ * @param dirty			Tile mask, set to 1 for the dirty tiles
+ *
+ * @return	Number of dirty tiles
+ */
+static int changedTiles(const Mat& gray, const Mat& reference, Mat& difference, int tile, int threshold, Mat& dirty)
+{
+	absdiff(gray, reference, difference);
+
+	int count = 0;
+	for (int y0 = 0; y0 < gray.rows; y0 += tile)
+	{
+		int y1 = min(y0 + tile, gray.rows);
+		for (int x0 = 0; x0 < gray.cols; x0 += tile)
+		{
+			int x1 = min(x0 + tile, gray.cols);
+			bool changed = false;
+
+			for (int y = y0; y < y1 && !changed; y++)
+			{
+				const uchar* row = difference.ptr<uchar>(y);
+				for (int x = x0; x < x1; x++)
+				{
+					if (row[x] > threshold)
+					{
+						changed = true;
+						break;
+					}
+				}
+			}
+
+			if (changed)
+			{
+				dirty.at<uchar>(y0 / tile, x0 / tile) = 1;
+				count++;
+			}
+		}
+	}
+
+	return count;
+}
+
+
+
+/**
+ * Finds the SIFT keypoints of a frame of a fixed
+ * camera. The frame is compared to the one the
+ * pyramids of the stream were built from in tiles
+ * of SIFT_STREAM_TILE pixels. Only the pyramid
+ * pixels that depend on a dirty tile are rebuilt
+ * and only the DOG around them is searched again,
+ * the keypoints of the other tiles are carried over
+ * with their gradient windows. The first frame, a
+ * new frame size or too many dirty tiles rebuild
+ * the whole pyramids. Keypoints are in the order of
+ * the full detector and keypoints[i] matches row i
+ * of computeDescriptors
+ *
+ * @param image		The target frame, BGR or grayscale
+ * @param keypoints	Keypoints vector
+ * @param stream	State kept across frames, updates stream.stats and stream.workspace.stats
+ * @param nOctaves	Number of Octaves
+ * @param nIntervals Number of Intervals
+ *
+ * @return Updates the keypoints with the features of the frame
+ */
+void SIFT::findSiftInterestPoint(Mat& image, vector<KeyPoint>& keypoints, SIFTStream& stream,
+		int nOctaves, int nIntervals)
+{
+	CV_Assert(nIntervals <= SIFT_INTVLS_MAX);
+
+	int64 start = getTickCount();
+	SIFTWorkspace& workspace = stream.workspace;
+	bool resized = workspace.create(image.size(), nOctaves, nIntervals);
+
+	if (image.channels() == 3)
+		cvtColor(image, workspace.gray, CV_BGR2GRAY);
+	else
+		image.copyTo(workspace.gray);
+
+	/* Tiles cover a whole number of pixels on every octave */
+	int tile = max(SIFT_STREAM_TILE, 1 << (nOctaves - 1));
+	int gridRows = (image.rows + tile - 1) / tile;
+	int gridCols = (image.cols + tile - 1) / tile;
+	int nTiles = gridRows * gridCols, nDirty = nTiles;
+
+	Mat dirty = Mat::zeros(gridRows, gridCols, CV_8U);
+	if (!resized && stream.valid)
+		nDirty = changedTiles(workspace.gray, stream.reference, stream.difference, tile, stream.threshold, dirty);
+
+	double fullPixels = 0;
+	for (int i = 0; i < nOctaves; i++)
+		fullPixels += workspace.pyramid.bases[i].total() * (1 + (nIntervals + 3) + (nIntervals + 2) + nIntervals);
+
+	double pixels = 0;
+	int carried = 0;
+	if (resized || !stream.valid || nDirty > stream.keyframeRatio * nTiles)
+	{
+		streamKeyframe(stream);
+		stream.stats.keyframes++;
+		pixels = fullPixels;
+	}
+	else if (nDirty > 0)
+	{
+		pixels = streamUpdate(stream, dirty, tile, carried);
+	}
+	else
+	{
+		carried = stream.keypoints.size();
+	}
+
+	keypoints = stream.keypoints;
+	keypointsGradients = stream.gradients;
+	keypointsMagnitudes = stream.magnitudes;
+	selectKeypoints(keypoints, 0, image.size(), &keypointsGradients, &keypointsMagnitudes);
+
+	stream.stats.addFrame(nTiles, nDirty, carried, pixels, fullPixels);
+	workspace.stats.addFrame((getTickCount() - start) * 1000.0 / getTickFrequency(), stream.bytes());
+	if (profile)
+		profile->frames++;
+}
+
+
+
+/**
+ * Finds the SIFT keypoints inside rectangles of an
+ * image. Only crops around the rectangles, padded
+ * by padding pixels, are blurred and searched, so
+ * the cost follows the area of the rectangles and
+ * not of the image. Keypoints are in the octave
+ * coordinates of the whole image and in the order
+ * of the full detector. Keypoints too close to a
+ * crop border for a gradient window are dropped,
+ * so keypoints[i] matches row i of computeDescriptors
+ *
+ * @param image		The target image, BGR or grayscale
+ * @param keypoints	Keypoints vector
+ * @param regions	Rectangles to search, in image pixels
+ * @param nOctaves	Number of Octaves
+ * @param nIntervals Number of Intervals
+ * @param padding	Context around a rectangle in pixels, negative for SIFT_IMG_BORDER
+ * 					on the last octave
+ *
+ * @return Updates the keypoints with the features of the regions
+ */
+void SIFT::findSiftInterestPoint(Mat& image, vector<KeyPoint>& keypoints, const vector<Rect>& regions,
+		int nOctaves, int nIntervals, int padding)
+{
+	extractRegions(image, keypoints, regions, NULL, nOctaves, nIntervals, padding);
+}
+
+
+
+/**
+ * Finds the SIFT keypoints on the set pixels of a
+ * mask. The mask is covered by rectangles of
+ * SIFT_STREAM_TILE pixels which are searched like
+ * regions, and a keypoint is kept if the mask is
+ * set under its position on the first octave
+ *
+ * @param image		The target image, BGR or grayscale
+ * @param keypoints	Keypoints vector
+ * @param mask		8 bit mask of the image size
+ * @param nOctaves	Number of Octaves
+ * @param nIntervals Number of Intervals
+ * @param padding	Context around the mask in pixels, negative for SIFT_IMG_BORDER
+ * 					on the last octave
+ *
+ * @return Updates the keypoints with the features under the mask
+ */
+void SIFT::findSiftInterestPoint(Mat& image, vector<KeyPoint>& keypoints, const Mat& mask,
+		int nOctaves, int nIntervals, int padding)
+{
+	CV_Assert(mask.type() == CV_8U && mask.size() == image.size());
+
+	extractRegions(image, keypoints, vector<Rect>(), &mask, nOctaves, nIntervals, padding);
+}
+
+
+
+/**
+ * Runs the detector on a frame using the buffers
+ * of the workspace and records its latency
+ *
+ * @param image		The target frame, BGR or grayscale
+ * @param keypoints	Keypoints vector
+ * @param workspace	Buffers of the frame
+ * @param nOctaves	Number of Octaves
+ * @param nIntervals Number of Intervals
+ *
+ * @return Appends the keypoints of the frame
+ */
+void SIFT::extractKeypoints(Mat& image, vector<KeyPoint>& keypoints, SIFTWorkspace& workspace,
+		int nOctaves, int nIntervals)
+{
+	int64 start = getTickCount();
+	workspace.create(image.size(), nOctaves, nIntervals, fixedPoint ? CV_16S : CV_32F);
+
+	if (image.channels() == 3)
+		cvtColor(image, workspace.gray, CV_BGR2GRAY);
+	else
+		image.copyTo(workspace.gray);
+	normalize(workspace.gray, workspace.image, 0, fixedPoint ? 1 << SIFT_FIXED_SHIFT : 1, NORM_MINMAX,
+			workspace.image.type());
+
+	Pyramid& pyramid = workspace.pyramid;
+	size_t first = keypoints.size();
+	if (fusedDog)
+	{
+		buildFusedPyramid(workspace.image, pyramid);
+	}
+	else
+	{
+		buildGaussianPyramid(workspace.image, pyramid);
+		buildDogPyr(pyramid.gauss, pyramid.dog);
+	}
+	getScaleSpaceExtrema(pyramid.dog, keypoints);
+	selectKeypoints(keypoints, first, pyramid.size());
+	if (gradientPyramid)
+	{
+		pyramid.createGradients();
+		buildGradientPyramid(pyramid.dog, keypoints, pyramid.magnitude, pyramid.angle);
+		orientAll(NULL, &pyramid.magnitude, &pyramid.angle, keypoints, workspace);
+	}
+	else
+	{
+		orientAll(&pyramid.dog, NULL, NULL, keypoints, workspace);
+	}
+
+	workspace.stats.addFrame((getTickCount() - start) * 1000.0 / getTickFrequency(), workspace.bytes());
+	if (profile)
+		profile->frames++;
+}
+
+
+
+/**
+ * Blurs the octave bases into the intervals of the
+ * pyramid. A task is one interval, or one whole
+ * octave when the intervals are blurred incrementally.
+ * With regions only those rectangles of every level
+ * of an octave are blurred, reading the pixels around
+ * them, so they get the values of a full blur
+ */
+class SIFT::PyramidInvoker : public ParallelLoopBody
+{
+public:
+	PyramidInvoker(vector<Mat>& _bases, const double* _sigmas, int _nLevels, vector<vector<Mat> >& _pyr,
+			bool _incremental, const vector<vector<Rect> >* _regions = NULL) :
+			bases(_bases), sigmas(_sigmas), nLevels(_nLevels), pyr(_pyr), incremental(_incremental),
+			regions(_regions)
+	{
+	}
+
+	void operator()(const Range& range) const
+	{
+		for (int t = range.start; t < range.end; t++)
+		{
+			if (incremental)
+			{
+				blur(bases[t], pyr[t][0], sigmas[0], t);
+
+				/* Consecutive blurs add up their variances */
+				for (int j = 1; j < nLevels; j++)
+					blur(pyr[t][j - 1], pyr[t][j], sqrt(sigmas[j] * sigmas[j] - sigmas[j - 1] * sigmas[j - 1]), t);
+			}
+			else
+			{
+				int i = t / nLevels, j = t % nLevels;
+				blur(bases[i], pyr[i][j], sigmas[j], i);
+			}
+		}
+	}
+
+private:
+	vector<Mat>& bases;
+	const double* sigmas;
+	int nLevels;
+	vector<vector<Mat> >& pyr;
+	bool incremental;
+	const vector<vector<Rect> >* regions;
+
+	void blur(const Mat& src, Mat& dst, double sigma, int octave) const
+	{
+		if (src.type() == CV_16S)
+		{
+			CV_Assert(!regions);
+			gaussianBlur16(src, dst, sigma);
+			return;
+		}
+
+		if (!regions)
+		{
+			GaussianBlur(src, dst, Size(0, 0), sigma, 0);
+			return;
+		}
+
+		const vector<Rect>& rects = (*regions)[octave];
+		for (size_t r = 0; r < rects.size(); r++)
+		{
+			Mat out = dst(rects[r]);
+			GaussianBlur(src(rects[r]), out, Size(0, 0), sigma, 0);
+		}
+	}
+};
+
+
+
+/**
+ * Fills the octave bases by downsampling the image
+ * and blurs them into the intervals of the pyramid.
+ * Levels that already have the right size and type
+ * are written in place
+ *
+ * @param image			The base image of the pyramid
+ * @param bases			Octave bases, nOctaves entries
+ * @param scratch		Row buffer of the downsampling
+ * @param gauss_pyr		Guassian pyramid, nOctaves x nIntervals + 3
+ * @param nOctaves		Number of Octaves
+ * @param nIntervals	Number of Intervals
+ */
+void SIFT::buildGaussianLevels(Mat& image, vector<Mat>& bases, Mat& scratch,
+		vector<vector<Mat> >& gauss_pyr, int nOctaves, int nIntervals)
+{
+	StageTimer timer(profile, STAGE_PYRAMID);
+	double sigmas[SIFT_INTVLS_MAX + 3];
+
+	bases[0] = image;
+	for (int i = 1; i < nOctaves; i++)
+		downSample(bases[i - 1], bases[i], scratch);
+
+	sigmas[0] = SIFT_INIT_SIGMA;
+	for (int j = 1; j < nIntervals + 3; j++)
+		sigmas[j] = sigmas[j - 1] * SIFT_STEP_SIGMA;
+
+	int nTasks = incrementalBlur ? nOctaves : nOctaves * (nIntervals + 3);
+	runParallel(Range(0, nTasks), PyramidInvoker(bases, sigmas, nIntervals + 3, gauss_pyr, incrementalBlur));
+}
+
+
+
+/**
+ * Build Scale Space guassian pyramid from an image
+ *
+ * @param image			The base image of the pyramid
+ * @param gauss_pyr		Guassian pyramid, replaced by the new levels
+ * @param nOctaves		Number of Octaves
+ * @param nIntervals	Number of Intervals
+ *
+ * @return Updates the keypoints with SIFT feautres
+ */
+void SIFT::buildGaussianPyramid(Mat& image, vector<vector<Mat> >& gauss_pyr, int nOctaves, int nIntervals)
+{
+	CV_Assert((image.type() == CV_32F || image.type() == CV_16S) && nIntervals <= SIFT_INTVLS_MAX);
+
+	vector<Mat> bases(nOctaves);
+	Mat scratch;
+
+	gauss_pyr.assign(nOctaves, vector<Mat>(nIntervals + 3));
+	buildGaussianLevels(image, bases, scratch, gauss_pyr, nOctaves, nIntervals);
+}
+
+
+
+/**
+ * Build Scale Space guassian pyramid from an image
+ * into the preallocated levels of a pyramid. The
+ * image must have the size the pyramid was created for
+ *
+ * @param image			The base image of the pyramid
+ * @param pyr			Pyramid holding the levels
+ *
+ * @return Updates pyr.bases and pyr.gauss
+ */
+void SIFT::buildGaussianPyramid(Mat& image, Pyramid& pyr)
+{
+	CV_Assert(image.size() == pyr.size() && image.type() == pyr.type());
+	CV_Assert(pyr.intervals() <= SIFT_INTVLS_MAX);
+
+	buildGaussianLevels(image, pyr.bases, pyr.scratch, pyr.gauss, pyr.octaves(), pyr.intervals());
+}
+
+
+
+/**
+ * Subtracts consecutive intervals of the Guassian
+ * pyramid, one DOG interval per task, or only the
+ * given rectangles of every octave
+ */
+class SIFT::DogInvoker : public ParallelLoopBody
+{
+public:
+	DogInvoker(const vector<vector<Mat> >& _gauss_pyr, vector<vector<Mat> >& _dog_pyr,
+			const vector<vector<Rect> >* _regions = NULL) :
+			gauss_pyr(_gauss_pyr), dog_pyr(_dog_pyr), regions(_regions)
+	{
+	}
+
+	void operator()(const Range& range) const
+	{
+		int nLevels = dog_pyr[0].size();
+
+		for (int t = range.start; t < range.end; t++)
+		{
+			int i = t / nLevels, j = t % nLevels;
+			if (!regions)
+			{
+				subtract(gauss_pyr[i][j], gauss_pyr[i][j + 1], dog_pyr[i][j]);
+				continue;
+			}
+
+			const vector<Rect>& rects = (*regions)[i];
+			for (size_t r = 0; r < rects.size(); r++)
+			{
+				Mat out = dog_pyr[i][j](rects[r]);
+				subtract(gauss_pyr[i][j](rects[r]), gauss_pyr[i][j + 1](rects[r]), out);
+			}
+		}
+	}
+
+private:
+	const vector<vector<Mat> >& gauss_pyr;
+	vector<vector<Mat> >& dog_pyr;
+	const vector<vector<Rect> >* regions;
+};
+
+
+
+/**
+ * Build difference of guassians Scale Space guassian
+ * pyramid by subtracting every consecutive intervals.
+ * Levels of dog_pyr that already have the right size
+ * and type are written in place
+ *
+ * @param gauss_pyr		Guassian scale space pyramid
+ * @param dog_pyr		Difference of Guassians pyramid
+ *
+ * @return Updates dog_pyr
+ */
+void SIFT::buildDogPyr(const vector<vector<Mat> >& gauss_pyr, vector<vector<Mat> >& dog_pyr)
+{
+	StageTimer timer(profile, STAGE_DOG);
+	int nOctaves = gauss_pyr.size();
+	int nIntervals = gauss_pyr[0].size();
+
+	dog_pyr.resize(nOctaves);
+	for (int i = 0; i < nOctaves; i++)
+		dog_pyr[i].resize(nIntervals - 1);
+
+	runParallel(Range(0, nOctaves * (nIntervals - 1)), DogInvoker(gauss_pyr, dog_pyr));
+}
+
+
+
+/**
+ * Blurs a tile of an octave base into every interval
+ * and subtracts each interval from the previous one
+ * while both tiles are still in cache, one tile per
+ * task. Float tiles are blurred as regions of the
+ * base, OpenCV reads the pixels around a region
+ * from the parent image, so they get the values of
+ * a full blur
+ */
+class SIFT::FusedInvoker : public ParallelLoopBody
+{
+public:
+	FusedInvoker(vector<Mat>& _bases, const double* _sigmas, vector<vector<Mat> >& _gauss_pyr,
+			vector<vector<Mat> >& _dog_pyr, const vector<pair<int, Rect> >& _tiles) :
+			bases(_bases), sigmas(_sigmas), gauss_pyr(_gauss_pyr), dog_pyr(_dog_pyr), tiles(_tiles)
+	{
+	}
+
+	void operator()(const Range& range) const
+	{
+		for (int t = range.start; t < range.end; t++)
+		{
+			int i = tiles[t].first;
+			const Rect& rect = tiles[t].second;
+
+			for (size_t j = 0; j < gauss_pyr[i].size(); j++)
+			{
+				Mat level = gauss_pyr[i][j];
+				if (level.type() == CV_16S)
+				{
+					gaussianBlur16(bases[i], level, sigmas[j], rect);
+				}
+				else
+				{
+					Mat out = level(rect);
+					GaussianBlur(bases[i](rect), out, Size(0, 0), sigmas[j], 0);
+				}
+
+				if (j > 0)
+				{
+					Mat dog = dog_pyr[i][j - 1](rect);
+					subtract(gauss_pyr[i][j - 1](rect), level(rect), dog);
+				}
+			}
+		}
+	}
+
+private:
+	vector<Mat>& bases;
+	const double* sigmas;
+	vector<vector<Mat> >& gauss_pyr;
+	vector<vector<Mat> >& dog_pyr;
+	const vector<pair<int, Rect> >& tiles;
+};
+
+
+
+/**
+ * Builds the Guassian and DOG pyramids in one pass.
+ * Every octave is cut in tiles of SIFT_FUSED_ROWS x
+ * SIFT_FUSED_COLS pixels, a tile of all the Guassian
+ * and DOG intervals fits in the L2 cache, so each
+ * Guassian tile is subtracted before it is evicted
+ * instead of being read back from memory. The image
+ * must have the size and type the pyramid was
+ * created for
+ *
+ * @param image			The base image of the pyramid
+ * @param pyr			Pyramid holding the levels
+ *
+ * @return Updates pyr.bases, pyr.gauss and pyr.dog
+ */
+void SIFT::buildFusedPyramid(Mat& image, Pyramid& pyr)
+{
+	CV_Assert(image.size() == pyr.size() && image.type() == pyr.type());
+	CV_Assert(pyr.intervals() <= SIFT_INTVLS_MAX);
+
+	StageTimer timer(profile, STAGE_PYRAMID);
+	int nOctaves = pyr.octaves();
+	double sigmas[SIFT_INTVLS_MAX + 3];
+
+	pyr.bases[0] = image;
+	for (int i = 1; i < nOctaves; i++)
+		downSample(pyr.bases[i - 1], pyr.bases[i], pyr.scratch);
+
+	sigmas[0] = SIFT_INIT_SIGMA;
+	for (int j = 1; j < pyr.intervals() + 3; j++)
+		sigmas[j] = sigmas[j - 1] * SIFT_STEP_SIGMA;
+
+	vector<pair<int, Rect> > tiles;
+	for (int i = 0; i < nOctaves; i++)
+	{
+		Size size = pyr.bases[i].size();
+		for (int y = 0; y < size.height; y += SIFT_FUSED_ROWS)
+			for (int x = 0; x < size.width; x += SIFT_FUSED_COLS)
+				tiles.push_back(make_pair(i, Rect(x, y, min(SIFT_FUSED_COLS, size.width - x),
+						min(SIFT_FUSED_ROWS, size.height - y))));
+	}
+
+	runParallel(Range(0, tiles.size()), FusedInvoker(pyr.bases, sigmas, pyr.gauss, pyr.dog, tiles));
+}
+
+
+
+/**
+ * Tests if the given point is an extrema by comparing
+ * it to it's surroundings, bottom and top intervals
+ *
+ * @param dog_pyr		Difference of Guassians pyramid
+ * @param octave		Current Octave
+ * @param interval		Current Interval
+ * @param r				Current row
+ * @param c				Current column
+ *
+ * @return Returns true if extrema else false
+ */
+bool SIFT::isExtrema(vector<vector<Mat> >& dog_pyr, int octave, int interval, int r, int c)
+{
+	float intensity = dog_pyr[octave][interval].at<float>(r, c);
+
+	if (intensity > 0)
+	{
+		for (int i = -1; i <= 1; i++)
+			for (int j = -1; j <= 1; j++)
+				for (int k = -1; k <= 1; k++)
+					if (intensity <= dog_pyr[octave][interval + i].at<float>(r + j, c + k) && (i != 0 || j != 0 || k != 0))
+						return false;
+	}
+	else
+	{
+		for (int i = -1; i <= 1; i++)
+			for (int j = -1; j <= 1; j++)
+				for (int k = -1; k <= 1; k++)
+					if (intensity >= dog_pyr[octave][interval + i].at<float>(r + j, c + k) && (i != 0 || j != 0 || k != 0))
+						return false;
+	}
+
+	return true;
+}
+
+
+
+/**
+ * Reads a DOG pixel in the [0, 1] range of the
+ * float pipeline, from a float or a 16 bit fixed
+ * point interval
+ *
+ * @param image		DOG interval
+ * @param r			Row
+ * @param c			Column
+ *
+ * @return	Returns the pixel value
+ */
+static inline float dogValue(const Mat& image, int r, int c)
+{
+	if (image.type() == CV_16S)
+		return image.at<short>(r, c) * (1.0f / (1 << SIFT_FIXED_SHIFT));
+
+	return image.at<float>(r, c);
+}
+
+
+
+/**
+ * Scans row tiles of the DOG intervals for extremas
+ * into a keypoint list and the candidate counts of
+ * every tile. A task is one worker, which takes
+ * every workers-th tile, so the octaves spread
+ * evenly and each worker has scratch buffers of its
+ * own. The candidates of a tile are classified in
+ * one batch, and the kept ones refined in another.
+ * The classification time of a tile is only
+ * measured when timed
+ */
+class SIFT::ExtremaInvoker : public ParallelLoopBody
+{
+public:
+	ExtremaInvoker(SIFT* _sift, vector<vector<Mat> >& _dog_pyr, vector<ExtremaTile>& _tiles, int _nTiles,
+			int _workers, vector<vector<KeyPoint> >& _results, vector<OctaveCounters>& _counts,
+			vector<int64>& _cleanTicks, vector<ExtremaScratch>& _scratch, int _curv_thr, bool _timed) :
+			sift(_sift), dog_pyr(_dog_pyr), tiles(_tiles), nTiles(_nTiles), workers(_workers), results(_results),
+			counts(_counts), cleanTicks(_cleanTicks), scratch(_scratch), curv_thr(_curv_thr), timed(_timed)
+	{
+	}
+
+	void operator()(const Range& range) const
+	{
+		KernelPath path = bestKernelPath();
+
+		for (int w = range.start; w < range.end; w++)
+		{
+			for (int t = w; t < nTiles; t += workers)
+				scanTile(t, scratch[w], path);
+		}
+	}
+
+private:
+	SIFT* sift;
+	vector<vector<Mat> >& dog_pyr;
+	vector<ExtremaTile>& tiles;
+	int nTiles;
+	int workers;
+	vector<vector<KeyPoint> >& results;
+	vector<OctaveCounters>& counts;
+	vector<int64>& cleanTicks;
+	vector<ExtremaScratch>& scratch;
+	int curv_thr;
+	bool timed;
+
+	/** Scans, classifies and refines tile t with the buffers of the calling worker **/
+	void scanTile(int t, ExtremaScratch& buffers, KernelPath path) const
+	{
+		int i = tiles[t].octave, j = tiles[t].interval;
+		int colStart = tiles[t].colStart, colEnd = tiles[t].colEnd;
+		vector<uchar>& mask = buffers.mask;
+		vector<uchar>& verdicts = buffers.verdicts;
+
+		if ((int) mask.size() < dog_pyr[i][0].cols)
+			mask.resize(dog_pyr[i][0].cols);
+		results[t].clear();
+
+		for (int r = tiles[t].rowStart; r < tiles[t].rowEnd; r++)
+		{
+			if (dog_pyr[i][j].type() == CV_16S)
+			{
+				const short* rows[9];
+				for (int k = 0; k < 9; k++)
+					rows[k] = dog_pyr[i][j - 1 + k / 3].ptr<short>(r - 1 + k % 3);
+				extremaRow16(rows, &mask[0], colStart, colEnd, path);
+			}
+			else
+			{
+				const float* rows[9];
+				for (int k = 0; k < 9; k++)
+					rows[k] = dog_pyr[i][j - 1 + k / 3].ptr<float>(r - 1 + k % 3);
+				extremaRow(rows, &mask[0], colStart, colEnd, path);
+			}
+
+			for (int c = colStart; c < colEnd; c++)
+				if (mask[c])
+					results[t].push_back(KeyPoint(c, r, 0, -1, 0, i, j));
+		}
+
+		int64 start = timed ? getTickCount() : 0;
+		sift->classifyPoints(dog_pyr[i][j], results[t], verdicts, buffers.terms, curv_thr, SIFT_CONTR_THR,
+				SIFT_DETER_THR);
+		if (timed)
+			cleanTicks[t] += getTickCount() - start;
+
+		int kept = 0;
+		for (size_t z = 0; z < verdicts.size(); z++)
+		{
+			if (verdicts[z] == POINT_LOW_CONTRAST)
+				counts[t].lowContrast++;
+			else if (verdicts[z] == POINT_EDGE)
+				counts[t].edges++;
+			else
+				results[t][kept++] = results[t][z];
+		}
+		counts[t].tested += verdicts.size();
+		results[t].resize(kept);
+
+		sift->refineKeypoints(dog_pyr[i], results[t], counts[t], buffers.terms);
+		counts[t].kept += results[t].size();
+	}
+};
+
+
+
+/**
+ * Gets the extremas from the
+ * DOG pyramid. Every interval is split in
+ * tiles of SIFT_TILE_ROWS rows which are
+ * merged back in scan order
+ *
+ * @param dog_pyr		Difference of Guassians pyramid
+ * @param keypoints		Keypoints vector
+ *
+ * @return list of keypoints
+ */
+void SIFT::getScaleSpaceExtrema(vector<vector<Mat> >& dog_pyr, vector<KeyPoint>& keypoints, int curv_thr)
+{
+	int octaves = dog_pyr.size();
+	int intervals = dog_pyr[0].size() - 2;
+	vector<ExtremaTile>& tiles = extremaTiles;
+
+	tiles.clear();
+	for (int i = 0; i < octaves; i++)
+	{
+		for (int j = 1; j <= intervals; j++)
+		{
+			for (int r = SIFT_IMG_BORDER; r < dog_pyr[i][0].rows - SIFT_IMG_BORDER; r += SIFT_TILE_ROWS)
+			{
+				ExtremaTile tile;
+				tile.octave = i;
+				tile.interval = j;
+				tile.rowStart = r;
+				tile.rowEnd = min(r + SIFT_TILE_ROWS, dog_pyr[i][0].rows - SIFT_IMG_BORDER);
+				tile.colStart = SIFT_IMG_BORDER;
+				tile.colEnd = dog_pyr[i][0].cols - SIFT_IMG_BORDER;
+				tiles.push_back(tile);
+			}
+		}
+	}
+
+	scanExtrema(dog_pyr, tiles, keypoints, curv_thr);
+}
+
+
+
+/**
+ * Scans tiles of the DOG intervals for extremas on
+ * the worker threads and appends them in tile order.
+ * The candidate counts and the cleanPoints time go
+ * to the profile. The per tile lists and the per
+ * worker buffers are members that only grow, so a
+ * detector scanning frames of the same size stops
+ * allocating once they reach their largest sizes
+ *
+ * @param dog_pyr		Difference of Guassians pyramid
+ * @param tiles			Row bands of the intervals to scan
+ * @param keypoints		Keypoints vector
+ * @param curv_thr		Curvature threshold
+ *
+ * @return	Appends the extremas to keypoints
+ */
+void SIFT::scanExtrema(vector<vector<Mat> >& dog_pyr, vector<ExtremaTile>& tiles, vector<KeyPoint>& keypoints,
+		int curv_thr)
+{
+	StageTimer timer(profile, STAGE_EXTREMA);
+	int nTiles = tiles.size();
+	int workers = min(nThreads, nTiles);
+	if (nTiles == 0)
+		return;
+
+	if ((int) tileKeypoints.size() < nTiles)
+		tileKeypoints.resize(nTiles);
+	tileCounts.assign(nTiles, OctaveCounters());
+	tileTicks.assign(nTiles, 0);
+	if ((int) scanScratch.size() < workers)
+		scanScratch.resize(workers);
+
+	runParallel(Range(0, workers), ExtremaInvoker(this, dog_pyr, tiles, nTiles, workers, tileKeypoints,
+			tileCounts, tileTicks, scanScratch, curv_thr, profile != NULL));
+
+	for (int t = 0; t < nTiles; t++)
+	{
+		keypoints.insert(keypoints.end(), tileKeypoints[t].begin(), tileKeypoints[t].end());
+		if (profile)
+		{
+			profile->addCounters(tiles[t].octave, tileCounts[t]);
+			profile->addTicks(STAGE_CLEAN, tileTicks[t]);
+		}
+	}
+}
+
+
+
+/**
+ * Fits a 3D quadratic to the DOG around every
+ * candidate of a tile and moves it to the extremum
+ * of the quadratic in x, y and scale. The gradients
+ * and Hessians of the whole batch are gathered one
+ * term per row, so the 3x3 systems are solved with
+ * one SIMD lane per candidate. Candidates whose
+ * extremum is SIFT_INTERP_OFFSET of a sample away
+ * or more, in any dimension, are dropped as unstable
+ * rather than moved to another sample, so a keypoint
+ * stays on the sample it was detected on. Those
+ * whose interpolated contrast is below SIFT_CONTR_THR
+ * are dropped too. The kept ones get their refined
+ * position, their sigma in octave coordinates as
+ * size and their interpolated |DOG| as response
+ *
+ * @param dogs			DOG intervals of the octave
+ * @param candidates	Candidates of one tile, interval in class_id
+ * @param counts		Candidate counts of the tile
+ * @param terms			Scratch buffer of the terms, only grows
+ *
+ * @return	Updates candidates, keeping their order
+ */
+void SIFT::refineKeypoints(vector<Mat>& dogs, vector<KeyPoint>& candidates, OctaveCounters& counts,
+		vector<float>& terms)
+{
+	int n = candidates.size();
+	if (n == 0)
+		return;
+
+	/* Value, 3 gradient, 6 Hessian and 3 offset rows */
+	if (terms.size() < 13 * (size_t) n)
+		terms.resize(13 * n);
+	float* value = &terms[0];
+	float* rows[12];
+	for (int k = 0; k < 12; k++)
+		rows[k] = &terms[(k + 1) * n];
+	float* const* gradient = rows;
+	float* const* hessian = rows + 3;
+	float* const* offset = rows + 9;
+
+	for (int z = 0; z < n; z++)
+	{
+		int j = candidates[z].class_id;
+		int r = candidates[z].pt.y, c = candidates[z].pt.x;
+		const Mat& low = dogs[j - 1];
+		const Mat& mid = dogs[j];
+		const Mat& high = dogs[j + 1];
+		float v = dogValue(mid, r, c);
+
+		value[z] = v;
+		gradient[0][z] = (dogValue(mid, r, c + 1) - dogValue(mid, r, c - 1)) * 0.5f;
+		gradient[1][z] = (dogValue(mid, r + 1, c) - dogValue(mid, r - 1, c)) * 0.5f;
+		gradient[2][z] = (dogValue(high, r, c) - dogValue(low, r, c)) * 0.5f;
+		hessian[0][z] = dogValue(mid, r, c + 1) + dogValue(mid, r, c - 1) - 2 * v;
+		hessian[1][z] = dogValue(mid, r + 1, c) + dogValue(mid, r - 1, c) - 2 * v;
+		hessian[2][z] = dogValue(high, r, c) + dogValue(low, r, c) - 2 * v;
+		hessian[3][z] = (dogValue(mid, r + 1, c + 1) - dogValue(mid, r + 1, c - 1) - dogValue(mid, r - 1, c + 1)
+				+ dogValue(mid, r - 1, c - 1)) * 0.25f;
+		hessian[4][z] = (dogValue(high, r, c + 1) - dogValue(high, r, c - 1) - dogValue(low, r, c + 1)
+				+ dogValue(low, r, c - 1)) * 0.25f;
+		hessian[5][z] = (dogValue(high, r + 1, c) - dogValue(high, r - 1, c) - dogValue(low, r + 1, c)
+				+ dogValue(low, r - 1, c)) * 0.25f;
+	}
+
+	solveHessians(hessian, gradient, offset, n);
+
+	int kept = 0;
+	for (int z = 0; z < n; z++)
+	{
+		float ox = offset[0][z], oy = offset[1][z], os = offset[2][z];
+
+		/* Also rejects the non finite offsets of a singular Hessian */
+		if (!(fabs(ox) < SIFT_INTERP_OFFSET && fabs(oy) < SIFT_INTERP_OFFSET && fabs(os) < SIFT_INTERP_OFFSET))
+		{
+			counts.unstable++;
+			continue;
+		}
+
+		float contrast = value[z] + 0.5f * (gradient[0][z] * ox + gradient[1][z] * oy + gradient[2][z] * os);
+		if (fabs(contrast) < SIFT_CONTR_THR)
+		{
+			counts.lowContrast++;
+			continue;
+		}
+
+		KeyPoint keypoint = candidates[z];
+		keypoint.pt.x += ox;
+		keypoint.pt.y += oy;
+		keypoint.size = SIFT_INIT_SIGMA * pow(SIFT_STEP_SIGMA, keypoint.class_id + os);
+		keypoint.response = fabs(contrast);
+		candidates[kept++] = keypoint;
+	}
+
+	candidates.resize(kept);
+}
+
+
+
+/**
+ * Gathers the DOG value and the 2x2 Hessian of a
+ * candidate into column z of the edge test terms.
+ * Samples are scaled to the [0, 1] range one by one
+ * like dogValue
+ *
+ * @param image		Float or 16 bit DOG interval of the candidate
+ * @param r			Row
+ * @param c			Column
+ * @param scale		Scale of a sample, 1 for a float interval
+ * @param terms		4 rows: value, xx, yy, xy
+ * @param z			Column of the candidate
+ *
+ * @return	Updates terms[0 - 3][z]
+ */
+template<typename T>
+static inline void gatherEdgeTerms(const Mat& image, int r, int c, float scale, float* const* terms, int z)
+{
+	const T* above = image.ptr<T>(r - 1) + c;
+	const T* row = image.ptr<T>(r) + c;
+	const T* below = image.ptr<T>(r + 1) + c;
+	float v = row[0] * scale;
+
+	terms[0][z] = v;
+	terms[1][z] = row[1] * scale + row[-1] * scale - 2 * v;
+	terms[2][z] = below[0] * scale + above[0] * scale - 2 * v;
+	terms[3][z] = (below[1] * scale - below[-1] * scale - above[1] * scale + above[-1] * scale) * 0.25f;
+}
+
+
+
+/**
+ * Gathers the edge test terms of a batch of
+ * candidates, see gatherEdgeTerms
+ *
+ * @param image			Float or 16 bit DOG interval of the candidates
+ * @param candidates	Candidates, at their sample in pt
+ * @param begin			First candidate
+ * @param end			Candidate past the last one
+ * @param terms			4 rows: value, xx, yy, xy
+ *
+ * @return	Updates terms[0 - 3][begin, end)
+ */
+static void gatherEdgeTerms(const Mat& image, const vector<KeyPoint>& candidates, int begin, int end,
+		float* const* terms)
+{
+	if (image.type() == CV_16S)
+	{
+		for (int z = begin; z < end; z++)
+			gatherEdgeTerms<short>(image, cvRound(candidates[z].pt.y), cvRound(candidates[z].pt.x),
+					1.0f / (1 << SIFT_FIXED_SHIFT), terms, z);
+	}
+	else
+	{
+		for (int z = begin; z < end; z++)
+			gatherEdgeTerms<float>(image, cvRound(candidates[z].pt.y), cvRound(candidates[z].pt.x), 1.0f, terms, z);
+	}
+}
+
+
+
+/**
+ * Tests if the given point is a good feature or
+ * not by discarding low contrast points and edges
+ *
+ * @param image			Current DOG scale space image
+ * @param curv_thr		Curvature threshold
+ *
+ * @return true if good feature else false
+ */
+bool SIFT::cleanPoints(Point position, Mat& image, int curv_thr, float cont_thr, float dtr_thr)
+{
+	return classifyPoint(position, image, curv_thr, cont_thr, dtr_thr) == POINT_KEPT;
+}
+
+
+
+/**
+ * Tells if the given point is a good feature, or
+ * whether it is discarded for its low contrast or
+ * as an edge by the curvature test. This is the
+ * scalar test of a single point, classifyPoints
+ * gives the same verdicts for a whole batch
+ *
+ * @param image			Current DOG scale space image
+ * @param curv_thr		Curvature threshold
+ *
+ * @return POINT_KEPT, POINT_LOW_CONTRAST or POINT_EDGE
+ */
+int SIFT::classifyPoint(Point position, Mat& image, int curv_thr, float cont_thr, float dtr_thr)
+{
+	vector<KeyPoint> candidate(1, KeyPoint(position.x, position.y, 0));
+	float values[4];
+	float* terms[4] = { values, values + 1, values + 2, values + 3 };
+	uchar verdict;
+
+	gatherEdgeTerms(image, candidate, 0, 1, terms);
+	edgeTests(terms, &verdict, 1, cont_thr, curv_thr, dtr_thr, KERNEL_SCALAR);
+
+	return verdict;
+}
+
+
+
+/**
+ * Classifies every candidate of one DOG interval
+ * like classifyPoint. The values and Hessians of
+ * the batch are gathered one term per row first,
+ * then the contrast and curvature tests run with
+ * one SIMD lane per candidate
+ *
+ * @param image			DOG interval of the candidates
+ * @param candidates	Candidates, at their sample in pt
+ * @param verdicts		Output PointClass of every candidate
+ * @param curv_thr		Curvature threshold
+ * @param cont_thr		Contrast threshold
+ * @param dtr_thr		Determinant threshold
+ *
+ * @return	Resizes and fills verdicts
+ */
+void SIFT::classifyPoints(Mat& image, const vector<KeyPoint>& candidates, vector<uchar>& verdicts, int curv_thr,
+		float cont_thr, float dtr_thr)
+{
+	vector<float> values;
+	classifyPoints(image, candidates, verdicts, values, curv_thr, cont_thr, dtr_thr);
+}
+
+
+
+/**
+ * Classifies every candidate of one DOG interval,
+ * see classifyPoints, gathering the terms into a
+ * buffer that only grows, so a scan worker reusing
+ * it does not allocate once it is large enough
+ *
+ * @param image			DOG interval of the candidates
+ * @param candidates	Candidates, at their sample in pt
+ * @param verdicts		Output PointClass of every candidate
+ * @param values		Scratch buffer of the terms
+ * @param curv_thr		Curvature threshold
+ * @param cont_thr		Contrast threshold
+ * @param dtr_thr		Determinant threshold
+ *
+ * @return	Resizes and fills verdicts
+ */
+void SIFT::classifyPoints(Mat& image, const vector<KeyPoint>& candidates, vector<uchar>& verdicts,
+		vector<float>& values, int curv_thr, float cont_thr, float dtr_thr)
+{
+	int n = candidates.size();
+	verdicts.resize(n);
+	if (n == 0)
+		return;
+
+	if (values.size() < 4 * (size_t) n)
+		values.resize(4 * n);
+	float* terms[4];
+	for (int k = 0; k < 4; k++)
+		terms[k] = &values[k * n];
+
+	gatherEdgeTerms(image, candidates, 0, n, terms);
+	edgeTests(terms, &verdicts[0], n, cont_thr, curv_thr, dtr_thr);
+}
+
+
+
+/**
+ * Gets the first and its index
+ * in a given histogram
+ *
+ * @param histogram		The given histogram
+ * @param size			Number of bins
+ * @param maximum		The first maximum value
+ * @param indexMax		The index of first maximum
+ *
+ * @return	maximum, indexMax
+ */
+void SIFT::histogramMax(const double* histogram, int size, int &maximum, int &indexMax)
+{
+	maximum = histogram[0];
+	indexMax = 0;
+
+	for (int i = 0; i < size; i++)
+	{
+		if (maximum < histogram[i])
+		{
+			maximum = histogram[i];
+			indexMax = i;
+		}
+	}
+}
+
+
+
+/**
+ * Build a gradient histogram from
+ * the given window and range
+ *
+ * @param matrix		Matrix Window
+ * @param range			The histogram span
+ * @param maximum		Maximum value in the histogram
+ * @param histo			Output histogram of maximum / range bins
+ *
+ * @return	Fills the histogram
+ */
+void SIFT::buildHistogram(const Mat& matrix, int range, int maximum, double* histo)
+{
+	int size = maximum / range;
+
+	for (int i = 0; i < size; i++)
+	{
+		histo[i] = 0;
+	}
+
+	for (int i = 0; i < matrix.rows; i++)
+	{
+		for (int j = 0; j < matrix.cols; j++)
+		{
+			int index = matrix.at<float>(i, j) / range;
+			histo[index]++;
+		}
+	}
+}
+
+
+
+/**
+ * Computes the gradient magnitudes and angles of
+ * the marked cells of the DOG intervals, one row of
+ * cells per task, run by run. 16 bit intervals are
+ * converted to float run by run, scaled to [0, 1]
+ */
+class SIFT::GradientInvoker : public ParallelLoopBody
+{
+public:
+	GradientInvoker(const vector<vector<Mat> >& _dog_pyr, const vector<vector<Mat> >& _cells,
+			vector<vector<Mat> >& _magnitudes, vector<vector<Mat> >& _angles, const vector<ExtremaTile>& _tiles,
+			bool _fast) :
+			dog_pyr(_dog_pyr), cells(_cells), magnitudes(_magnitudes), angles(_angles), tiles(_tiles), fast(_fast)
+	{
+	}
+
+	void operator()(const Range& range) const
+	{
+		KernelPath path = bestKernelPath();
+
+		for (int t = range.start; t < range.end; t++)
+		{
+			const ExtremaTile& tile = tiles[t];
+			const Mat& dog = dog_pyr[tile.octave][tile.interval];
+			Mat& magnitude = magnitudes[tile.octave][tile.interval - 1];
+			Mat& angle = angles[tile.octave][tile.interval - 1];
+			const uchar* marks = cells[tile.octave][tile.interval - 1].ptr<uchar>(tile.rowStart / SIFT_GRADIENT_CELL);
+			int nCells = cells[tile.octave][tile.interval - 1].cols;
+
+			for (int x = 0; x < nCells; x++)
+			{
+				if (!marks[x])
+					continue;
+
+				int end = x;
+				while (end < nCells && marks[end])
+					end++;
+
+				/* The run kept one pixel off the border, and the ring its differences read */
+				int colStart = max(x * SIFT_GRADIENT_CELL, 1);
+				int colEnd = min(end * SIFT_GRADIENT_CELL, dog.cols - 1);
+				int rowStart = max(tile.rowStart, 1);
+				int rowEnd = min(tile.rowEnd, dog.rows - 1);
+				Rect around(colStart - 1, rowStart - 1, colEnd - colStart + 2, rowEnd - rowStart + 2);
+				Mat patch;
+				if (dog.type() == CV_16S)
+					dog(around).convertTo(patch, CV_32F, 1.0 / (1 << SIFT_FIXED_SHIFT));
+				else
+					patch = dog(around);
+
+				for (int r = rowStart; r < rowEnd; r++)
+				{
+					int k = r - around.y;
+					const float* above = patch.ptr<float>(k - 1) + 1;
+					const float* row = patch.ptr<float>(k) + 1;
+					const float* below = patch.ptr<float>(k + 1) + 1;
+					float* magnitudeRow = magnitude.ptr<float>(r) + colStart;
+					float* angleRow = angle.ptr<float>(r) + colStart;
+
+					if (fast)
+						fastGradientRow(above, row, below, magnitudeRow, angleRow, 0, colEnd - colStart, path);
+					else
+						gradientRow(above, row, below, magnitudeRow, angleRow, 0, colEnd - colStart, path);
+				}
+				x = end;
+			}
+		}
+	}
+
+private:
+	const vector<vector<Mat> >& dog_pyr;
+	const vector<vector<Mat> >& cells;
+	vector<vector<Mat> >& magnitudes;
+	vector<vector<Mat> >& angles;
+	const vector<ExtremaTile>& tiles;
+	bool fast;
+};
+
+
+
+/**
+ * Computes the gradient magnitude and angle, in
+ * degrees, of the DOG intervals 1 to nIntervals,
+ * those keypoints are found on, by central
+ * differences. Interval j of an octave goes to
+ * level j - 1. Only the SIFT_GRADIENT_CELL square
+ * cells under the gradient window of a keypoint are
+ * computed, once however many windows overlap them,
+ * the other pixels are left as they were. The
+ * levels are reused when they have the right size.
+ * The time goes to the orientation stage
+ *
+ * @param dog_pyr		Difference of Guassians pyramid
+ * @param keypoints		Keypoints whose windows are needed
+ * @param magnitudes	Output gradient magnitude levels
+ * @param angles		Output gradient angle levels
+ */
+void SIFT::buildGradientPyramid(const vector<vector<Mat> >& dog_pyr, const vector<KeyPoint>& keypoints,
+		vector<vector<Mat> >& magnitudes, vector<vector<Mat> >& angles)
+{
+	StageTimer timer(profile, STAGE_ORIENTATION);
+	int octaves = dog_pyr.size();
+	int intervals = dog_pyr[0].size() - 2;
+	vector<vector<Mat> > cells(octaves);
+
+	magnitudes.resize(octaves);
+	angles.resize(octaves);
+	for (int i = 0; i < octaves; i++)
+	{
+		Size size = dog_pyr[i][0].size();
+		magnitudes[i].resize(intervals);
+		angles[i].resize(intervals);
+
+		for (int j = 0; j < intervals; j++)
+		{
+			magnitudes[i][j].create(size, CV_32F);
+			angles[i][j].create(size, CV_32F);
+			cells[i].push_back(Mat::zeros((size.height + SIFT_GRADIENT_CELL - 1) / SIFT_GRADIENT_CELL,
+					(size.width + SIFT_GRADIENT_CELL - 1) / SIFT_GRADIENT_CELL, CV_8U));
+		}
+	}
+
+	/* Cells under the windows computeKeypointOrientation cuts out */
+	for (size_t z = 0; z < keypoints.size(); z++)
+	{
+		const Mat& dog = dog_pyr[keypoints[z].octave][0];
+		int keyx = cvRound(keypoints[z].pt.x);
+		int keyy = cvRound(keypoints[z].pt.y);
+
+		if (keyx - SIFT_HIST_BOREDER - 1 < 0 || keyx + SIFT_HIST_BOREDER + 1 > dog.cols
+				|| keyy - SIFT_HIST_BOREDER - 1 < 0 || keyy + SIFT_HIST_BOREDER + 1 > dog.rows)
+			continue;
+
+		Mat& marks = cells[keypoints[z].octave][keypoints[z].class_id - 1];
+		for (int y = (keyy - SIFT_HIST_BOREDER) / SIFT_GRADIENT_CELL;
+				y <= (keyy + SIFT_HIST_BOREDER - 1) / SIFT_GRADIENT_CELL; y++)
+			for (int x = (keyx - SIFT_HIST_BOREDER) / SIFT_GRADIENT_CELL;
+					x <= (keyx + SIFT_HIST_BOREDER - 1) / SIFT_GRADIENT_CELL; x++)
+				marks.at<uchar>(y, x) = 1;
+	}
+
+	/* One task per row of cells with a marked cell */
+	vector<ExtremaTile> tiles;
+	for (int i = 0; i < octaves; i++)
+	{
+		for (int j = 0; j < intervals; j++)
+		{
+			const Mat& marks = cells[i][j];
+			for (int y = 0; y < marks.rows; y++)
+			{
+				if (countNonZero(marks.row(y)) == 0)
+					continue;
+
+				ExtremaTile tile;
+				tile.octave = i;
+				tile.interval = j + 1;
+				tile.rowStart = y * SIFT_GRADIENT_CELL;
+				tile.rowEnd = (y + 1) * SIFT_GRADIENT_CELL;
+				tile.colStart = 0;
+				tile.colEnd = dog_pyr[i][0].cols;
+				tiles.push_back(tile);
+			}
+		}
+	}
+
+	runParallel(Range(0, tiles.size()), GradientInvoker(dog_pyr, cells, magnitudes, angles, tiles, fastGradients));
+}
+
+
+
+/**
+ * Sets the orientation of a keypoint to the center
+ * of the fullest 10 degree bin of the angles of its
+ * gradient window
+ *
+ * @param gradientWindow	Gradient angles around the keypoint
+ * @param keypoint			The keypoint to orient
+ */
+void SIFT::orientKeypoint(Mat& gradientWindow, KeyPoint& keypoint)
+{
+	const int range = 10;
+	const int maximum = 360;
+	int maxima, indexMax;
+
+	double histo[maximum / range];
+	buildHistogram(gradientWindow, range, maximum, histo);
+	histogramMax(histo, maximum / range, maxima, indexMax);
+
+	int angleOrientation = indexMax * range;
+	angleOrientation = angleOrientation + (range / 2);
+	keypoint.angle = angleOrientation;
+}
+
+
+
+/**
+ * Computes the gradient window and the orientation
+ * of a single keypoint from its DOG interval. The
+ * window holds the gradients of the rows and
+ * columns within SIFT_HIST_BOREDER of the keypoint
+ * sample, by central differences. Windows that
+ * already have the right size are written in place,
+ * so headers into an arena are filled without any
+ * allocation, and 16 bit samples are converted on
+ * the stack
+ *
+ * @param image			DOG interval of the keypoint
+ * @param keypoint		The keypoint to orient
+ * @param gradientWindow	Gradient window of the keypoint
+ * @param magnitudeWindow	Magnitude window of the keypoint
+ *
+ * @return	false if the window crosses the image border
+ */
+bool SIFT::computeKeypointOrientation(Mat& image, KeyPoint& keypoint, Mat& gradientWindow, Mat& magnitudeWindow)
+{
+	int keyx = cvRound(keypoint.pt.x);
+	int keyy = cvRound(keypoint.pt.y);
+
+	if (keyx - SIFT_HIST_BOREDER - 1 < 0 || keyx + SIFT_HIST_BOREDER + 1 > image.cols
+			|| keyy - SIFT_HIST_BOREDER - 1 < 0 || keyy + SIFT_HIST_BOREDER + 1 > image.rows)
+		return false;
+
+	/* The window and the one pixel ring its differences read */
+	Rect around(keyx - SIFT_HIST_BOREDER - 1, keyy - SIFT_HIST_BOREDER - 1, SIFT_HIST_BOREDER * 2 + 2,
+			SIFT_HIST_BOREDER * 2 + 2);
+	float converted[(SIFT_HIST_BOREDER * 2 + 2) * (SIFT_HIST_BOREDER * 2 + 2)];
+	Mat patch;
+	if (image.type() == CV_16S)
+	{
+		patch = Mat(around.size(), CV_32F, converted);
+		image(around).convertTo(patch, CV_32F, 1.0 / (1 << SIFT_FIXED_SHIFT));
+	}
+	else
+	{
+		patch = image(around);
+	}
+
+	gradientWindow.create(SIFT_HIST_BOREDER * 2, SIFT_HIST_BOREDER * 2, CV_32F);
+	magnitudeWindow.create(SIFT_HIST_BOREDER * 2, SIFT_HIST_BOREDER * 2, CV_32F);
+	for (int i = 0; i < SIFT_HIST_BOREDER * 2; i++)
+	{
+		const float* above = patch.ptr<float>(i) + 1;
+		const float* row = patch.ptr<float>(i + 1) + 1;
+		const float* below = patch.ptr<float>(i + 2) + 1;
+
+		if (fastGradients)
+			fastGradientRow(above, row, below, magnitudeWindow.ptr<float>(i), gradientWindow.ptr<float>(i), 0,
+					SIFT_HIST_BOREDER * 2);
+		else
+			gradientRow(above, row, below, magnitudeWindow.ptr<float>(i), gradientWindow.ptr<float>(i), 0,
+					SIFT_HIST_BOREDER * 2);
+	}
+
+	orientKeypoint(gradientWindow, keypoint);
+
+	return true;
+}
+
+
+
+/**
+ * Cuts the gradient window of a single keypoint out
+ * of the gradient levels of its interval and orients
+ * it. Gives the same windows and orientation as the
+ * per keypoint computation. Windows of the right
+ * size are written in place
+ *
+ * @param magnitude		Gradient magnitude level of the keypoint
+ * @param angle			Gradient angle level of the keypoint
+ * @param keypoint		The keypoint to orient
+ * @param gradientWindow	Gradient window of the keypoint
+ * @param magnitudeWindow	Magnitude window of the keypoint
+ *
+ * @return	false if the window crosses the image border
+ */
+bool SIFT::computeKeypointOrientation(const Mat& magnitude, const Mat& angle, KeyPoint& keypoint,
+		Mat& gradientWindow, Mat& magnitudeWindow)
+{
+	int keyx = cvRound(keypoint.pt.x);
+	int keyy = cvRound(keypoint.pt.y);
+
+	if (keyx - SIFT_HIST_BOREDER - 1 < 0 || keyx + SIFT_HIST_BOREDER + 1 > angle.cols
+			|| keyy - SIFT_HIST_BOREDER - 1 < 0 || keyy + SIFT_HIST_BOREDER + 1 > angle.rows)
+		return false;
+
+	Rect window(keyx - SIFT_HIST_BOREDER, keyy - SIFT_HIST_BOREDER, SIFT_HIST_BOREDER * 2, SIFT_HIST_BOREDER * 2);
+	angle(window).copyTo(gradientWindow);
+	magnitude(window).copyTo(magnitudeWindow);
+	orientKeypoint(gradientWindow, keypoint);
+
+	return true;
+}
+
+
+
+/** Counts an oriented keypoint of an octave into a profile, if there is one **/
+static void countOriented(SIFTProfile* profile, int octave)
+{
+	if (!profile)
+		return;
+
+	OctaveCounters counters;
+	counters.oriented = 1;
+	profile->addCounters(octave, counters);
+}
+
+
+
+/**
+ * Orients the keypoints, one keypoint per task,
+ * from their DOG interval or from the gradient
+ * levels when given. The windows are written into
+ * the given headers, or allocated for empty ones.
+ * Keypoints on the border are flagged not oriented
+ */
+class SIFT::OrientationInvoker : public ParallelLoopBody
+{
+public:
+	OrientationInvoker(SIFT* _sift, vector<vector<Mat> >* _dog_pyr, const vector<vector<Mat> >* _magnitudes,
+			const vector<vector<Mat> >* _angles, vector<KeyPoint>& _keypoints, vector<Mat>& _gradients,
+			vector<Mat>& _windowMagnitudes, vector<uchar>& _oriented) :
+			sift(_sift), dog_pyr(_dog_pyr), magnitudes(_magnitudes), angles(_angles), keypoints(_keypoints),
+			gradients(_gradients), windowMagnitudes(_windowMagnitudes), oriented(_oriented)
+	{
+	}
+
+	void operator()(const Range& range) const
+	{
+		for (int z = range.start; z < range.end; z++)
+		{
+			int i = keypoints[z].octave, j = keypoints[z].class_id;
+			if (magnitudes)
+				oriented[z] = sift->computeKeypointOrientation((*magnitudes)[i][j - 1], (*angles)[i][j - 1],
+						keypoints[z], gradients[z], windowMagnitudes[z]);
+			else
+				oriented[z] = sift->computeKeypointOrientation((*dog_pyr)[i][j], keypoints[z], gradients[z],
+						windowMagnitudes[z]);
+		}
+	}
+
+private:
+	SIFT* sift;
+	vector<vector<Mat> >* dog_pyr;
+	const vector<vector<Mat> >* magnitudes;
+	const vector<vector<Mat> >* angles;
+	vector<KeyPoint>& keypoints;
+	vector<Mat>& gradients;
+	vector<Mat>& windowMagnitudes;
+	vector<uchar>& oriented;
+};
+
+
+
+/**
+ * Compute the Orientation histogram
+ * for the DOG pyramid and updates
+ * the orientation of each keypoint
+ *
+ * @param dog_pyr		Difference of Guassians pyramid
+ * @param keypoints		Keypoints vector
+ *
+ * @return	Returns keypointsGradients
+ */
+void SIFT::computeOrientationHist(vector<vector<Mat> >& dog_pyr, vector<KeyPoint>& keypoints)
+{
+	SIFTWorkspace windows;
+	orientAll(&dog_pyr, NULL, NULL, keypoints, windows);
+}
+
+
+
+/**
+ * Compute the Orientation histogram from
+ * the gradient levels of buildGradientPyramid
+ * and updates the orientation of each keypoint
+ *
+ * @param magnitudes	Gradient magnitude levels
+ * @param angles		Gradient angle levels
+ * @param keypoints		Keypoints vector
+ *
+ * @return	Returns keypointsGradients
+ */
+void SIFT::computeOrientationHist(const vector<vector<Mat> >& magnitudes, const vector<vector<Mat> >& angles,
+		vector<KeyPoint>& keypoints)
+{
+	SIFTWorkspace windows;
+	orientAll(NULL, &magnitudes, &angles, keypoints, windows);
+}
+
+
+
+/**
+ * Orients every keypoint from the DOG pyramid or
+ * from gradient levels and keeps the windows of
+ * those off the border for the descriptors. The
+ * windows go to the slots of the window arena of
+ * the workspace, which only grows, so frames with
+ * no more keypoints than an earlier one do not
+ * allocate. They stay valid until the next frame
+ * of the workspace. The default workspace keeps
+ * the windows of every image the detector saw, so
+ * its windows are copied out of the arena instead
+ *
+ * @param dog_pyr		Difference of Guassians pyramid or NULL
+ * @param magnitudes	Gradient magnitude levels or NULL
+ * @param angles		Gradient angle levels or NULL
+ * @param keypoints		Keypoints vector
+ * @param workspace		Workspace holding the window arena
+ */
+void SIFT::orientAll(vector<vector<Mat> >* dog_pyr, const vector<vector<Mat> >* magnitudes,
+		const vector<vector<Mat> >* angles, vector<KeyPoint>& keypoints, SIFTWorkspace& workspace)
+{
+	StageTimer timer(profile, STAGE_ORIENTATION);
+	workspace.createWindows(keypoints.size(), SIFT_HIST_BOREDER * 2);
+
+	runParallel(Range(0, keypoints.size()), OrientationInvoker(this, dog_pyr, magnitudes, angles, keypoints,
+			workspace.gradientWindows, workspace.magnitudeWindows, workspace.oriented));
+
+	bool accumulated = &workspace == &defaultWorkspace;
+	for (size_t z = 0; z < keypoints.size(); z++)
+	{
+		if (workspace.oriented[z])
+		{
+			if (accumulated)
+			{
+				keypointsGradients.push_back(workspace.gradientWindows[z].clone());
+				keypointsMagnitudes.push_back(workspace.magnitudeWindows[z].clone());
+			}
+			else
+			{
+				keypointsGradients.push_back(workspace.gradientWindows[z]);
+				keypointsMagnitudes.push_back(workspace.magnitudeWindows[z]);
+			}
+			countOriented(profile, keypoints[z].octave);
+		}
+	}
+}
+
+
+
+/**
+ * Orients the candidate keypoints and appends those
+ * that have a gradient window, with their windows
+ *
+ * @param dog_pyr		Difference of Guassians pyramid
+ * @param candidates	Keypoints to orient
+ * @param keypoints		Oriented keypoints
+ * @param gradients		Gradient windows of the oriented keypoints
+ * @param magnitudes	Magnitude windows of the oriented keypoints
  */
-void SIFT::findSiftInterestPoint(Mat& image, vector<KeyPoint>& keypoints, int nOctaves, int nIntervals)
+void SIFT::orientKeypoints(vector<vector<Mat> >& dog_pyr, vector<KeyPoint>& candidates, vector<KeyPoint>& keypoints,
+		vector<Mat>& gradients, vector<Mat>& magnitudes)
 {
-	Mat _image;
-	cvtColor(image, _image, CV_BGR2GRAY);
-	normalize(_image, _image, 0, 1, NORM_MINMAX, CV_32F);
+	StageTimer timer(profile, STAGE_ORIENTATION);
+	vector<Mat> windows(candidates.size()), windowMagnitudes(candidates.size());
+	vector<uchar> oriented(candidates.size());
 
-	vector<vector<Mat> > pyr, dog_pyr;
-	buildGaussianPyramid(_image, pyr, nOctaves, nIntervals);
-	dog_pyr = buildDogPyr(pyr);
-	getScaleSpaceExtrema(dog_pyr, keypoints);
-	computeOrientationHist(dog_pyr, keypoints);
+	runParallel(Range(0, candidates.size()),
+			OrientationInvoker(this, &dog_pyr, NULL, NULL, candidates, windows, windowMagnitudes, oriented));
+
+	for (size_t z = 0; z < candidates.size(); z++)
+	{
+		if (oriented[z])
+		{
+			keypoints.push_back(candidates[z]);
+			gradients.push_back(windows[z]);
+			magnitudes.push_back(windowMagnitudes[z]);
+			countOriented(profile, candidates[z].octave);
+		}
+	}
 }
 
 
 
+/** Orders keypoints like the full detector: octave, interval, row and column of their sample **/
+struct KeypointOrder
+{
+	const vector<KeyPoint>& keypoints;
+
+	KeypointOrder(const vector<KeyPoint>& _keypoints) :
+			keypoints(_keypoints)
+	{
+	}
+
+	bool operator()(int a, int b) const
+	{
+		const KeyPoint& p = keypoints[a];
+		const KeyPoint& q = keypoints[b];
+
+		if (p.octave != q.octave)
+			return p.octave < q.octave;
+		if (p.class_id != q.class_id)
+			return p.class_id < q.class_id;
+		if (cvRound(p.pt.y) != cvRound(q.pt.y))
+			return cvRound(p.pt.y) < cvRound(q.pt.y);
+		return cvRound(p.pt.x) < cvRound(q.pt.x);
+	}
+};
+
+
+
 /**
- * Build Scale Space guassian pyramid from an image
- *
- * @param image			The base image of the pyramid
- * @param nOctaves		Number of Octaves
- * @param nIntervals	Number of Intervals
- *
- * @return Updates the keypoints with SIFT feautres
+ * Orders keypoints by their rank in their grid cell,
+ * then by decreasing response, then by index so the
+ * selection does not depend on the sort
  */
-void SIFT::buildGaussianPyramid(Mat& image, vector<vector<Mat> >& gauss_pyr, int nOctaves, int nIntervals)
+struct BudgetOrder
 {
-	double sigma;
-	Mat tempImage;
-	image.copyTo(tempImage);
+	const vector<KeyPoint>& keypoints;
+	const vector<int>& ranks;
 
-	for (int i = 0; i < nOctaves; i++)
+	BudgetOrder(const vector<KeyPoint>& _keypoints, const vector<int>& _ranks) :
+			keypoints(_keypoints), ranks(_ranks)
 	{
-		sigma = SIFT_INIT_SIGMA;
-		vector<Mat> pyr_intervals;
+	}
 
-		for (int j = 0; j < nIntervals + 3; j++)
-		{
-			Mat blurredImage;
-			GaussianBlur(tempImage, blurredImage, Size(0, 0), sigma, 0);
-			pyr_intervals.push_back(blurredImage);
-			sigma *= SIFT_STEP_SIGMA;
-		}
+	bool operator()(int a, int b) const
+	{
+		if (ranks[a] != ranks[b])
+			return ranks[a] < ranks[b];
+		if (keypoints[a].response != keypoints[b].response)
+			return keypoints[a].response > keypoints[b].response;
+		return a < b;
+	}
+};
+
+
+
+/** Orders keypoints by grid cell, then by decreasing response, then by index **/
+struct CellOrder
+{
+	const vector<KeyPoint>& keypoints;
+	const vector<int>& cells;
 
-		gauss_pyr.push_back(pyr_intervals);
-		tempImage = downSample(tempImage);
+	CellOrder(const vector<KeyPoint>& _keypoints, const vector<int>& _cells) :
+			keypoints(_keypoints), cells(_cells)
+	{
 	}
-}
+
+	bool operator()(int a, int b) const
+	{
+		if (cells[a] != cells[b])
+			return cells[a] < cells[b];
+		if (keypoints[a].response != keypoints[b].response)
+			return keypoints[a].response > keypoints[b].response;
+		return a < b;
+	}
+};
 
 
 
 /**
- * Build difference of guassians Scale Space guassian
- * pyramid by subtracting every consecutive intervals
- *
- * @param gauss_pyr		Guassian scale space pyramid
+ * Keeps the maxKeypoints keypoints from first on with
+ * the strongest response, in their original order.
+ * With a budget grid a keypoint is ranked by the
+ * number of stronger keypoints in its cell, and the
+ * budget goes to rank 0 of every cell first. Windows,
+ * when given, match the keypoints one to one and are
+ * filtered along
  *
- * @return Returns the Difference of Guassians pyramid
+ * @param keypoints		Keypoints, those before first are kept
+ * @param first			First keypoint of the detection
+ * @param size			Size of the image, octave 0
+ * @param gradients		Gradient windows of the keypoints or NULL
+ * @param magnitudes	Magnitude windows of the keypoints or NULL
  */
-vector<vector<Mat> > SIFT::buildDogPyr(vector<vector<Mat> > gauss_pyr)
+void SIFT::selectKeypoints(vector<KeyPoint>& keypoints, size_t first, Size size, vector<Mat>* gradients,
+		vector<Mat>* magnitudes)
 {
-	int nOctaves = gauss_pyr.size();
-	int nIntervals = gauss_pyr[0].size();
-	vector<vector<Mat> > dog_pyr;
+	int count = keypoints.size() - first;
+	if (maxKeypoints <= 0 || count <= maxKeypoints)
+		return;
 
-	for (int i = 0; i < nOctaves; i++)
-	{
-		vector<Mat> dog_intervals;
+	vector<KeyPoint> found(keypoints.begin() + first, keypoints.end());
+	vector<int> order(count), ranks(count, 0);
+	for (int z = 0; z < count; z++)
+		order[z] = z;
 
-		for (int j = 0; j < nIntervals - 1; j++)
+	if (budgetGrid.area() > 0)
+	{
+		vector<int> cells(count);
+		for (int z = 0; z < count; z++)
 		{
-			dog_intervals.push_back(gauss_pyr[i][j] - gauss_pyr[i][j + 1]);
+			int x = cvRound(found[z].pt.x) << found[z].octave;
+			int y = cvRound(found[z].pt.y) << found[z].octave;
+			int gx = min(x * budgetGrid.width / max(size.width, 1), budgetGrid.width - 1);
+			int gy = min(y * budgetGrid.height / max(size.height, 1), budgetGrid.height - 1);
+			cells[z] = gy * budgetGrid.width + gx;
 		}
 
-		dog_pyr.push_back(dog_intervals);
+		sort(order.begin(), order.end(), CellOrder(found, cells));
+		for (int z = 1; z < count; z++)
+			if (cells[order[z]] == cells[order[z - 1]])
+				ranks[order[z]] = ranks[order[z - 1]] + 1;
+	}
+
+	sort(order.begin(), order.end(), BudgetOrder(found, ranks));
+	vector<uchar> keep(count, 0);
+	for (int z = 0; z < maxKeypoints; z++)
+		keep[order[z]] = 1;
+
+	size_t kept = first;
+	for (int z = 0; z < count; z++)
+	{
+		if (!keep[z])
+			continue;
+
+		keypoints[kept] = found[z];
+		if (gradients)
+		{
+			(*gradients)[kept] = (*gradients)[first + z];
+			(*magnitudes)[kept] = (*magnitudes)[first + z];
+		}
+		kept++;
 	}
 
-	return dog_pyr;
+	keypoints.resize(kept);
+	if (gradients)
+	{
+		gradients->resize(kept);
+		magnitudes->resize(kept);
+	}
 }
 
 
 
 /**
- * Tests if the given point is an extrema by comparing
- * it to it's surroundings, bottom and top intervals
- *
- * @param dog_pyr		Difference of Guassians pyramid
- * @param octave		Current Octave
- * @param interval		Current Interval
- * @param r				Current row
- * @param c				Current column
+ * Sorts keypoints into the order of the full detector,
+ * their gradient and magnitude windows move with them
  *
- * @return Returns true if extrema else false
+ * @param keypoints		Keypoints to sort
+ * @param gradients		Gradient windows of the keypoints
+ * @param magnitudes	Magnitude windows of the keypoints
  */
-bool SIFT::isExtrema(vector<vector<Mat> >& dog_pyr, int octave, int interval, int r, int c)
+static void sortKeypoints(vector<KeyPoint>& keypoints, vector<Mat>& gradients, vector<Mat>& magnitudes)
 {
-	float intensity = dog_pyr[octave][interval].at<float>(r, c);
-
-	if (intensity > 0)
+	vector<int> order(keypoints.size());
+	for (size_t z = 0; z < order.size(); z++)
+		order[z] = z;
+	sort(order.begin(), order.end(), KeypointOrder(keypoints));
+
+	vector<KeyPoint> sortedKeypoints(order.size());
+	vector<Mat> sortedGradients(order.size()), sortedMagnitudes(order.size());
+	for (size_t z = 0; z < order.size(); z++)
 	{
-		for (int i = -1; i <= 1; i++)
-			for (int j = -1; j <= 1; j++)
-				for (int k = -1; k <= 1; k++)
-					if (intensity <= dog_pyr[octave][interval + i].at<float>(r + j, c + k) && (j != 0 || k != 0))
-						return false;
+		sortedKeypoints[z] = keypoints[order[z]];
+		sortedGradients[z] = gradients[order[z]];
+		sortedMagnitudes[z] = magnitudes[order[z]];
 	}
+
+	keypoints.swap(sortedKeypoints);
+	gradients.swap(sortedGradients);
+	magnitudes.swap(sortedMagnitudes);
+}
+
+
+
+/** Radius of the kernel GaussianBlur and blurDecimate pick for a float image **/
+static int blurRadius(double sigma)
+{
+	return (cvRound(sigma * 4 * 2 + 1) | 1) / 2;
+}
+
+
+
+/** Grows the set cells of a tile mask by radius cells in every direction **/
+static Mat growCells(const Mat& cells, int radius)
+{
+	Mat grown;
+	if (radius > 0)
+		dilate(cells, grown, Mat::ones(radius * 2 + 1, radius * 2 + 1, CV_8U));
 	else
-	{
-		for (int i = -1; i <= 1; i++)
-			for (int j = -1; j <= 1; j++)
-				for (int k = -1; k <= 1; k++)
-					if (intensity >= dog_pyr[octave][interval + i].at<float>(r + j, c + k) && (j != 0 || k != 0))
-						return false;
-	}
+		grown = cells.clone();
 
-	return true;
+	return grown;
 }
 
 
 
 /**
- * Gets the extremas from the
- * DOG pyramid
+ * Converts a tile mask to rectangles of an octave,
+ * runs of set cells of a row are merged with the
+ * run of the same columns on the row above
  *
- * @param dog_pyr		Difference of Guassians pyramid
- * @param keypoints		Keypoints vector
+ * @param cells		Tile mask
+ * @param cell		Size of a tile on the octave in pixels
+ * @param size		Size of the octave, rectangles are clipped to it
+ * @param rects		Rectangles covering the set cells
  *
- * @return list of keypoints
+ * @return	Pixels covered by the rectangles
  */
-void SIFT::getScaleSpaceExtrema(vector<vector<Mat> >& dog_pyr, vector<KeyPoint>& keypoints, int curv_thr)
+static double cellRects(const Mat& cells, int cell, Size size, vector<Rect>& rects)
 {
-	int octaves = dog_pyr.size();
-	int intervals = dog_pyr[0].size() - 2;
+	Rect bounds(0, 0, size.width, size.height);
+	vector<int> open, next;
+	double pixels = 0;
 
-	for (int i = 0; i < octaves; i++)
+	rects.clear();
+	for (int gy = 0; gy < cells.rows && gy * cell < size.height; gy++)
 	{
-		for (int j = 1; j <= intervals; j++)
+		const uchar* row = cells.ptr<uchar>(gy);
+		next.clear();
+
+		for (int gx = 0; gx < cells.cols && gx * cell < size.width; gx++)
 		{
-			for (int r = SIFT_IMG_BORDER; r < dog_pyr[i][0].rows - SIFT_IMG_BORDER; r++)
+			if (!row[gx])
+				continue;
+
+			int end = gx;
+			while (end < cells.cols && end * cell < size.width && row[end])
+				end++;
+
+			Rect run = Rect(gx * cell, gy * cell, (end - gx) * cell, cell) & bounds;
+			pixels += run.area();
+
+			size_t k = 0;
+			while (k < open.size() && (rects[open[k]].x != run.x || rects[open[k]].width != run.width))
+				k++;
+
+			if (k < open.size())
 			{
-				for (int c = SIFT_IMG_BORDER; c < dog_pyr[i][0].cols - SIFT_IMG_BORDER; c++)
-				{
-					if (isExtrema(dog_pyr, i, j, r, c))
-						if (cleanPoints(Point(c, r), dog_pyr[i][j], curv_thr))
-							keypoints.push_back(KeyPoint(c, r, j, -1, 0, i));
-				}
+				rects[open[k]].height += run.height;
+				next.push_back(open[k]);
+			}
+			else
+			{
+				next.push_back(rects.size());
+				rects.push_back(run);
 			}
+			gx = end;
 		}
+		open.swap(next);
 	}
+
+	return pixels;
 }
 
 
 
 /**
- * Tests if the given point is a good feature or
- * not by discarding low contrast points and edges
- *
- * @param image			Current DOG scale space image
- * @param curv_thr		Curvature threshold
+ * Finds the tiles of an octave that depend on its
+ * changed DOG pixels. Extremas are searched again
+ * in the tiles next to a change, keypoints in the
+ * tiles within a gradient window of a change keep
+ * their position but are oriented again
  *
- * @return true if good feature else false
+ * @param changed	Tiles with changed DOG pixels
+ * @param cell		Size of a tile on the octave in pixels
+ * @param search	Tiles to search again
+ * @param orient	Tiles whose keypoints are oriented again
  */
-bool SIFT::cleanPoints(Point position, Mat& image, int curv_thr, float cont_thr, float dtr_thr)
+static void staleCells(const Mat& changed, int cell, Mat& search, Mat& orient)
 {
-	float rx, ry, fxx, fxy, fyy, deter;
-	float trace, curvature;
-
-	if (abs(image.at<float>(position)) < cont_thr)
-	{
-		return false;
-	}
-	else
-	{
-		rx = position.x;
-		ry = position.y;
-		fxx = image.at<float>(rx - 1, ry) + image.at<float>(rx + 1, ry) - 2 * image.at<float>(rx, ry);
-		fyy = image.at<float>(rx, ry - 1) + image.at<float>(rx, ry + 1) - 2 * image.at<float>(rx, ry);
-		fxy = image.at<float>(rx - 1, ry - 1) + image.at<float>(rx + 1, ry + 1) - image.at<float>(rx - 1, ry + 1)
-				- image.at<float>(rx + 1, ry - 1);
+	search = growCells(changed, 1);
+	orient = growCells(changed, (SIFT_HIST_BOREDER + 1 + cell - 1) / cell);
+}
 
-		trace = fxx + fyy;
-		deter = (fxx * fyy) - (fxy * fxy);
-		curvature = trace * trace / deter;
 
-		if (deter < dtr_thr || curvature > curv_thr)
-		{
-			return false;
-		}
-	}
 
-	return true;
+/**
+ * Normalizes the whole frame with its range, builds
+ * both pyramids and orients every keypoint. The frame
+ * becomes the reference of the following frames
+ *
+ * @param stream	Stream holding the grayscale frame in its workspace
+ */
+void SIFT::streamKeyframe(SIFTStream& stream)
+{
+	SIFTWorkspace& workspace = stream.workspace;
+	Pyramid& pyramid = workspace.pyramid;
+
+	/* Same scale and shift as normalize with NORM_MINMAX */
+	double minVal, maxVal;
+	minMaxLoc(workspace.gray, &minVal, &maxVal);
+	stream.scale = maxVal - minVal > DBL_EPSILON ? 1.0 / (maxVal - minVal) : 0;
+	stream.shift = -minVal * stream.scale;
+	workspace.gray.convertTo(workspace.image, CV_32F, stream.scale, stream.shift);
+	workspace.gray.copyTo(stream.reference);
+
+	buildGaussianPyramid(workspace.image, pyramid);
+	buildDogPyr(pyramid.gauss, pyramid.dog);
+
+	vector<KeyPoint> candidates;
+	getScaleSpaceExtrema(pyramid.dog, candidates);
+
+	stream.keypoints.clear();
+	stream.gradients.clear();
+	stream.magnitudes.clear();
+	orientKeypoints(pyramid.dog, candidates, stream.keypoints, stream.gradients, stream.magnitudes);
+	stream.valid = true;
 }
 
 
 
 /**
- * Gets the first and its index
- * in a given histogram
+ * Rebuilds the pyramids of a stream around the dirty
+ * tiles. A change spreads on every octave by the
+ * radius of the decimation to the next octave base
+ * and by the radius of the Guassian levels to the
+ * levels and the DOG. Those tiles are blurred and
+ * subtracted again in place, the DOG around them is
+ * searched again and the keypoints of the other tiles
+ * are carried over
  *
- * @param histogram		The given histogram
- * @param maximum		The first maximum value
- * @param indexMax		The index of first maximum
- * @param secondmax		The Second maximum value
- * @param indexSecond	The index of second maximum
+ * @param stream	Stream holding the grayscale frame in its workspace
+ * @param dirty		Tile mask of the frame
+ * @param tile		Tile size on the first octave in pixels
+ * @param carried	Keypoints carried over with their windows
  *
- * @return	maximum, indexMax
+ * @return	Pyramid pixels written plus DOG pixels searched
  */
-void SIFT::histogramMax(vector<double> histogram, int &maximum, int &indexMax)
+double SIFT::streamUpdate(SIFTStream& stream, const Mat& dirty, int tile, int& carried)
 {
-	maximum = histogram[0];
-	indexMax = 0;
+	SIFTWorkspace& workspace = stream.workspace;
+	Pyramid& pyramid = workspace.pyramid;
+	int nOctaves = pyramid.octaves(), nIntervals = pyramid.intervals(), nLevels = nIntervals + 3;
+
+	double sigmas[SIFT_INTVLS_MAX + 3];
+	sigmas[0] = SIFT_INIT_SIGMA;
+	for (int j = 1; j < nLevels; j++)
+		sigmas[j] = sigmas[j - 1] * SIFT_STEP_SIGMA;
+
+	/* Distance a changed base pixel reaches on the levels */
+	int reach = blurRadius(sigmas[nLevels - 1]);
+	if (incrementalBlur)
+	{
+		reach = blurRadius(sigmas[0]);
+		for (int j = 1; j < nLevels; j++)
+			reach += blurRadius(sqrt(sigmas[j] * sigmas[j] - sigmas[j - 1] * sigmas[j - 1]));
+	}
+
+	vector<vector<Rect> > baseRects(nOctaves), levelRects(nOctaves), searchRects(nOctaves);
+	vector<Mat> search(nOctaves), orient(nOctaves);
+	Mat changed = dirty;
+	double pixels = 0;
 
-	for (size_t i = 0; i < histogram.size(); i++)
+	for (int i = 0; i < nOctaves; i++)
 	{
-		if (maximum < histogram[i])
+		int cell = tile >> i;
+		Size size = pyramid.bases[i].size();
+
+		if (i > 0)
+			changed = growCells(changed, (blurRadius(INTERPOLATION_SIGMA) + cell * 2 - 1) / (cell * 2));
+
+		Mat levels = growCells(changed, (reach + cell - 1) / cell);
+		staleCells(levels, cell, search[i], orient[i]);
+
+		pixels += cellRects(changed, cell, size, baseRects[i]);
+		pixels += cellRects(levels, cell, size, levelRects[i]) * (nLevels + nLevels - 1);
+		pixels += cellRects(search[i], cell, size, searchRects[i]) * nIntervals;
+	}
+
+	/* Octave bases, the first one is the normalized frame */
+	int64 stageStart = getTickCount();
+	for (size_t r = 0; r < baseRects[0].size(); r++)
+	{
+		Rect rect = baseRects[0][r];
+		Mat image = workspace.image(rect), reference = stream.reference(rect);
+		workspace.gray(rect).convertTo(image, CV_32F, stream.scale, stream.shift);
+		workspace.gray(rect).copyTo(reference);
+	}
+	for (int i = 1; i < nOctaves; i++)
+		for (size_t r = 0; r < baseRects[i].size(); r++)
+			blurDecimate(pyramid.bases[i - 1], pyramid.bases[i], INTERPOLATION_SIGMA, pyramid.scratch.ptr<float>(),
+					baseRects[i][r]);
+
+	int nTasks = incrementalBlur ? nOctaves : nOctaves * nLevels;
+	runParallel(Range(0, nTasks),
+			PyramidInvoker(pyramid.bases, sigmas, nLevels, pyramid.gauss, incrementalBlur, &levelRects));
+	if (profile)
+		profile->addStage(STAGE_PYRAMID, stageStart, getTickCount());
+
+	stageStart = getTickCount();
+	runParallel(Range(0, nOctaves * (nLevels - 1)), DogInvoker(pyramid.gauss, pyramid.dog, &levelRects));
+	if (profile)
+		profile->addStage(STAGE_DOG, stageStart, getTickCount());
+
+	vector<ExtremaTile> tiles;
+	for (int i = 0; i < nOctaves; i++)
+	{
+		int rows = pyramid.dog[i][0].rows, cols = pyramid.dog[i][0].cols;
+
+		for (int j = 1; j <= nIntervals; j++)
 		{
-			maximum = histogram[i];
-			indexMax = i;
+			for (size_t k = 0; k < searchRects[i].size(); k++)
+			{
+				Rect rect = searchRects[i][k];
+				int rowEnd = min(rect.y + rect.height, rows - SIFT_IMG_BORDER);
+
+				ExtremaTile band;
+				band.octave = i;
+				band.interval = j;
+				band.colStart = max(rect.x, SIFT_IMG_BORDER);
+				band.colEnd = min(rect.x + rect.width, cols - SIFT_IMG_BORDER);
+				if (band.colStart >= band.colEnd)
+					continue;
+
+				for (int r = max(rect.y, SIFT_IMG_BORDER); r < rowEnd; r += SIFT_TILE_ROWS)
+				{
+					band.rowStart = r;
+					band.rowEnd = min(r + SIFT_TILE_ROWS, rowEnd);
+					tiles.push_back(band);
+				}
+			}
+		}
+	}
+
+	vector<KeyPoint> extremas;
+	scanExtrema(pyramid.dog, tiles, extremas, SIFT_CURV_THR);
+
+	/* Keypoints of the clean tiles keep their windows or only get a new orientation */
+	vector<KeyPoint> keypoints, candidates;
+	vector<Mat> gradients, magnitudes;
+	for (size_t z = 0; z < stream.keypoints.size(); z++)
+	{
+		const KeyPoint& keypoint = stream.keypoints[z];
+		int cell = tile >> keypoint.octave;
+		int gx = cvRound(keypoint.pt.x) / cell, gy = cvRound(keypoint.pt.y) / cell;
+
+		if (search[keypoint.octave].at<uchar>(gy, gx))
+			continue;
+
+		if (orient[keypoint.octave].at<uchar>(gy, gx))
+		{
+			candidates.push_back(keypoint);
+		}
+		else
+		{
+			keypoints.push_back(keypoint);
+			gradients.push_back(stream.gradients[z]);
+			magnitudes.push_back(stream.magnitudes[z]);
 		}
 	}
+	carried = keypoints.size();
+
+	candidates.insert(candidates.end(), extremas.begin(), extremas.end());
+	orientKeypoints(pyramid.dog, candidates, keypoints, gradients, magnitudes);
+
+	sortKeypoints(keypoints, gradients, magnitudes);
+	stream.keypoints.swap(keypoints);
+	stream.gradients.swap(gradients);
+	stream.magnitudes.swap(magnitudes);
+
+	return pixels;
 }
 
 
 
 /**
- * Build a gradient histogram from
- * the given window and range
- *
- * @param matrix		Matrix Window
- * @param range			The histogram span
- * @param maximum		Maximum value in the histogram
+ * Covers the regions with padded crops whose origins
+ * are multiples of the last octave scale, so every
+ * octave of a crop samples the same pixels as the
+ * octave of the whole image. Overlapping crops are
+ * merged into their bounding box until none overlap
  *
- * @return	Returns the calcuated histogram
+ * @param regions		Rectangles to search
+ * @param size			Image size
+ * @param padding		Context around a rectangle in pixels
+ * @param align			Scale of the last octave
+ * @param crops			Disjoint crops covering the padded regions
  */
-vector<double> SIFT::buildHistogram(Mat matrix, int range, int maximum)
+static void regionCrops(const vector<Rect>& regions, Size size, int padding, int align, vector<Rect>& crops)
 {
-	int size = maximum / range;
-	vector<double> histo(size);
+	Rect bounds(0, 0, size.width, size.height);
 
-	for (size_t i = 0; i < histo.size(); i++)
+	crops.clear();
+	for (size_t r = 0; r < regions.size(); r++)
 	{
-		histo[i] = 0;
+		Rect region = regions[r] & bounds;
+		if (region.area() == 0)
+			continue;
+
+		int x0 = max(region.x - padding, 0) / align * align;
+		int y0 = max(region.y - padding, 0) / align * align;
+		int x1 = min(region.x + region.width + padding, size.width);
+		int y1 = min(region.y + region.height + padding, size.height);
+		crops.push_back(Rect(x0, y0, x1 - x0, y1 - y0));
 	}
 
-	for (int i = 0; i < matrix.rows; i++)
+	for (bool merged = true; merged;)
 	{
-		for (int j = 0; j < matrix.cols; j++)
+		merged = false;
+		for (size_t a = 0; a < crops.size() && !merged; a++)
 		{
-			int index = matrix.at<float>(i, j) / range;
-			histo[index]++;
+			for (size_t b = a + 1; b < crops.size() && !merged; b++)
+			{
+				if ((crops[a] & crops[b]).area() > 0)
+				{
+					crops[a] = crops[a] | crops[b];
+					crops.erase(crops.begin() + b);
+					merged = true;
+				}
+			}
 		}
 	}
-
-	return histo;
 }
 
 
 
 /**
- * Compute the Orientation histogram
- * for the DOG pyramid and updates
- * the orientation of each keypoint
+ * Runs the detector on crops around the regions or
+ * the set pixels of a mask. The crops are normalized
+ * with their common range and run through the full
+ * pipeline one after the other. Extremas outside the
+ * regions or the mask are dropped before they are
+ * oriented, the kept ones are moved to the octave
+ * coordinates of the image
  *
- * @param dog_pyr		Difference of Guassians pyramid
+ * @param image			The target image, BGR or grayscale
  * @param keypoints		Keypoints vector
+ * @param regions		Rectangles to search, ignored with a mask
+ * @param mask			8 bit mask of the image size or NULL
+ * @param nOctaves		Number of Octaves
+ * @param nIntervals	Number of Intervals
+ * @param padding		Context around a rectangle, negative for the default
  *
- * @return	Returns keypointsGradients
+ * @return Updates the keypoints and their gradient windows
  */
-void SIFT::computeOrientationHist(vector<vector<Mat> >& dog_pyr, vector<KeyPoint>& keypoints)
+void SIFT::extractRegions(Mat& image, vector<KeyPoint>& keypoints, const vector<Rect>& regions, const Mat* mask,
+		int nOctaves, int nIntervals, int padding)
 {
-	int range = 10;
-	int maximum = 360;
+	CV_Assert(nIntervals <= SIFT_INTVLS_MAX);
 
-	for (size_t z = 0; z < keypoints.size(); z++)
+	int align = 1 << (nOctaves - 1);
+	if (padding < 0)
+		padding = SIFT_IMG_BORDER * align;
+
+	vector<Rect> areas = regions;
+	if (mask)
 	{
-		Mat image = dog_pyr[keypoints[z].octave][keypoints[z].size];
-		int keyx = keypoints[z].pt.x;
-		int keyy = keypoints[z].pt.y;
+		int tile = max(SIFT_STREAM_TILE, align);
+		Mat cells = Mat::zeros((image.rows + tile - 1) / tile, (image.cols + tile - 1) / tile, CV_8U);
+		for (int gy = 0; gy < cells.rows; gy++)
+			for (int gx = 0; gx < cells.cols; gx++)
+				if (countNonZero((*mask)(Rect(gx * tile, gy * tile, tile, tile) & Rect(0, 0, image.cols, image.rows))))
+					cells.at<uchar>(gy, gx) = 1;
+		cellRects(cells, tile, image.size(), areas);
+	}
+
+	vector<Rect> crops;
+	regionCrops(areas, image.size(), padding, align, crops);
+
+	keypoints.clear();
+	keypointsGradients.clear();
+	keypointsMagnitudes.clear();
+
+	/* One range for every crop, like the normalization of the whole image */
+	vector<Mat> grays(crops.size());
+	double minVal = DBL_MAX, maxVal = -DBL_MAX;
+	for (size_t c = 0; c < crops.size(); c++)
+	{
+		if (image.channels() == 3)
+			cvtColor(image(crops[c]), grays[c], CV_BGR2GRAY);
+		else
+			image(crops[c]).copyTo(grays[c]);
+
+		double cropMin, cropMax;
+		minMaxLoc(grays[c], &cropMin, &cropMax);
+		minVal = min(minVal, cropMin);
+		maxVal = max(maxVal, cropMax);
+	}
+	double scale = maxVal - minVal > DBL_EPSILON ? 1.0 / (maxVal - minVal) : 0;
+
+	for (size_t c = 0; c < crops.size(); c++)
+	{
+		Rect crop = crops[c];
+		Mat normalized;
+		grays[c].convertTo(normalized, CV_32F, scale, -minVal * scale);
 
-		if (!(keyx - SIFT_HIST_BOREDER - 1 < 0 || keyx + SIFT_HIST_BOREDER + 1 > image.cols
-				|| keyy - SIFT_HIST_BOREDER - 1 < 0 || keyy + SIFT_HIST_BOREDER + 1 > image.rows))
+		Pyramid pyramid;
+		pyramid.create(crop.size(), nOctaves, nIntervals);
+		buildGaussianPyramid(normalized, pyramid);
+		buildDogPyr(pyramid.gauss, pyramid.dog);
+
+		vector<KeyPoint> extremas, candidates;
+		getScaleSpaceExtrema(pyramid.dog, extremas);
+
+		for (size_t z = 0; z < extremas.size(); z++)
 		{
-			Mat tempMagnitude = (Mat_<float>(SIFT_HIST_BOREDER * 2, SIFT_HIST_BOREDER * 2));
-			Mat tempGradient = (Mat_<float>(SIFT_HIST_BOREDER * 2, SIFT_HIST_BOREDER * 2));
-			for (int i = 0; i < SIFT_HIST_BOREDER * 2; i++)
-			{
-				for (int j = 0; j < SIFT_HIST_BOREDER * 2; j++)
-				{
-					float diffx, diffy, magnitude, gradient;
-
-					diffx = image.at<float>(keyx + i + 1 - SIFT_HIST_BOREDER, keyy - SIFT_HIST_BOREDER + j)
-							- image.at<float>(keyx + i - 1 - SIFT_HIST_BOREDER, keyy - SIFT_HIST_BOREDER + j);
-					diffy = image.at<float>(keyx - SIFT_HIST_BOREDER + i, keyy + j + 1 - SIFT_HIST_BOREDER)
-							- image.at<float>(keyx - SIFT_HIST_BOREDER + i, keyy + j - 1 - SIFT_HIST_BOREDER);
-					magnitude = sqrt(pow(diffx, 2) + pow(diffy, 2));
-					gradient = rad2deg(atan2f(diffy, diffx));
-					tempMagnitude.at<float>(i, j) = magnitude;
-					tempGradient.at<float>(i, j) = gradient;
-				}
-			}
+			int octave = extremas[z].octave;
+			Point position((cvRound(extremas[z].pt.x) << octave) + crop.x, (cvRound(extremas[z].pt.y) << octave) + crop.y);
 
-			keypointsGradients.push_back(tempGradient);
-			keypointsMagnitudes.push_back(tempMagnitude);
-			int maxima, indexMax;
+			bool inside = false;
+			if (mask)
+				inside = mask->at<uchar>(position.y, position.x) != 0;
+			for (size_t r = 0; !mask && r < regions.size() && !inside; r++)
+				inside = regions[r].contains(position);
+
+			if (inside)
+				candidates.push_back(extremas[z]);
+		}
 
-			vector<double> histo = buildHistogram(tempGradient, range, maximum);
-			histogramMax(histo, maxima, indexMax);
+		size_t first = keypoints.size();
+		orientKeypoints(pyramid.dog, candidates, keypoints, keypointsGradients, keypointsMagnitudes);
 
-			int angleOrientation = indexMax * range;
-			angleOrientation = angleOrientation + (range / 2);
-			keypoints[z].angle = angleOrientation;
+		for (size_t z = first; z < keypoints.size(); z++)
+		{
+			keypoints[z].pt.x += crop.x >> keypoints[z].octave;
+			keypoints[z].pt.y += crop.y >> keypoints[z].octave;
 		}
 	}
+
+	sortKeypoints(keypoints, keypointsGradients, keypointsMagnitudes);
+	selectKeypoints(keypoints, 0, image.size(), &keypointsGradients, &keypointsMagnitudes);
+	if (profile)
+		profile->frames++;
 }
 
 
@@ -338,35 +2511,80 @@ void SIFT::computeOrientationHist(vector<vector<Mat> >& dog_pyr, vector<KeyPoint
  */
 vector<vector<double> > SIFT::computeDescriptors()
 {
-	vector<vector<double> > descriptors;
+	Mat compact;
+	computeDescriptors(compact, CV_32F);
+
+	vector<vector<double> > descriptors(compact.rows);
+	for (int points = 0; points < compact.rows; points++)
+	{
+		const float* row = compact.ptr<float>(points);
+		descriptors[points].assign(row, row + compact.cols);
+	}
+
+	return descriptors;
+}
+
+
+
+/**
+ * Compute the SIFT descriptor of each keypoints
+ * into one contiguous row major matrix, a row of
+ * SIFT_DESCR_LENGTH bins per gradient window. The
+ * float32 rows hold the raw orientation counts of
+ * every 4x4 block. The uint8 rows are normalized
+ * to unit length, scaled by SIFT_DESCR_SCALE and
+ * clamped to 255, 128 bytes per descriptor
+ *
+ * @param descriptors	Output matrix, reused if already allocated
+ * @param type			CV_32F or CV_8U
+ *
+ * @return	Updates descriptors
+ */
+void SIFT::computeDescriptors(Mat& descriptors, int type)
+{
+	CV_Assert(type == CV_32F || type == CV_8U);
 
-	for (size_t points = 0; points < keypointsGradients.size(); points++)
+	int nPoints = keypointsGradients.size();
+	float bins[SIFT_DESCR_LENGTH];
+	descriptors.create(nPoints, SIFT_DESCR_LENGTH, type);
+
+	for (int points = 0; points < nPoints; points++)
 	{
-		vector<double> singleDescriptor;
-		Mat temp = keypointsGradients[points];
-		singleDescriptor.reserve(128);
+		const Mat& temp = keypointsGradients[points];
+		int bin = 0;
+
 		for (int xBlock = 0; xBlock < temp.cols; xBlock += 4)
 		{
-			for (int yBlock = 0; yBlock < temp.rows; yBlock += 4)
+			for (int yBlock = 0; yBlock < temp.rows; yBlock += 4, bin += SIFT_DESCR_BINS)
 			{
-				Mat blockMatrix = Mat::zeros(4, 4, CV_32F);
-				for (int i = 0; i < blockMatrix.cols; i++)
+				for (int k = 0; k < SIFT_DESCR_BINS; k++)
+					bins[bin + k] = 0;
+
+				for (int i = 0; i < 4; i++)
 				{
-					for (int j = 0; j < blockMatrix.rows; j++)
-					{
-						blockMatrix.at<float>(i, j) = temp.at<float>(xBlock + i, yBlock + j);
-					}
+					const float* row = temp.ptr<float>(xBlock + i) + yBlock;
+					for (int j = 0; j < 4; j++)
+						bins[bin + min((int) (row[j] / (360 / SIFT_DESCR_BINS)), SIFT_DESCR_BINS - 1)]++;
 				}
-
-				vector<double> singleHistogram = buildHistogram(blockMatrix, 45, 360);
-				singleDescriptor.insert(singleDescriptor.end(), singleHistogram.begin(), singleHistogram.end());
 			}
 		}
 
-		descriptors.push_back(singleDescriptor);
+		if (type == CV_32F)
+		{
+			memcpy(descriptors.ptr<float>(points), bins, sizeof(bins));
+		}
+		else
+		{
+			double length = 0;
+			for (int k = 0; k < SIFT_DESCR_LENGTH; k++)
+				length += bins[k] * bins[k];
+
+			double scale = length > 0 ? SIFT_DESCR_SCALE / sqrt(length) : 0;
+			uchar* row = descriptors.ptr<uchar>(points);
+			for (int k = 0; k < SIFT_DESCR_LENGTH; k++)
+				row[k] = saturate_cast<uchar>(bins[k] * scale);
+		}
 	}
-
-	return descriptors;
 }
 
 
@@ -434,28 +2652,26 @@ double SIFT::deg2rad(float deg)
 
 /**
  * Downsamples an image to quarter its size
- * half in each dimension
+ * half in each dimension. The blur and the
+ * decimation are fused in a single pass.
+ * 16 bit images use the integer kernel
  *
- * @param image		The input image to downsample
- * @return Returns the resized image
+ * @param image			The input image to downsample, float or 16 bit
+ * @param resizedImage	The resized image, written in place if allocated
+ * @param scratch		Row buffer, reused if it holds image.cols floats
+ *
+ * @return Updates resizedImage
  */
-Mat SIFT::downSample(Mat& image)
+void SIFT::downSample(Mat& image, Mat& resizedImage, Mat& scratch)
 {
-	Mat blurredImage;
-	image.copyTo(blurredImage);
-	GaussianBlur(image, blurredImage, Size(0, 0), INTERPOLATION_SIGMA, 0);
-
-	Mat temp = Mat(Size(blurredImage.cols / 2, blurredImage.rows), image.type());
-	for (int i = 0; i < temp.cols; i++)
+	if (image.type() == CV_16S)
 	{
-		blurredImage.col(i * 2).copyTo(temp.col(i));
+		blurDecimate16(image, resizedImage, INTERPOLATION_SIGMA);
+		return;
 	}
 
-	Mat resizedImage = Mat(Size(temp.cols, temp.rows / 2), image.type());
-	for (int i = 0; i < resizedImage.rows; i++)
-	{
-		temp.row(i * 2).copyTo(resizedImage.row(i));
-	}
+	if (scratch.total() < (size_t) image.cols || scratch.type() != CV_32F)
+		scratch.create(1, image.cols, CV_32F);
 
-	return resizedImage;
+	blurDecimate(image, resizedImage, INTERPOLATION_SIGMA, scratch.ptr<float>());
 }
@@ -12,27 +12,143 @@
 #include <stdio.h>
 #include "opencv2/opencv.hpp"
 #include "opencv2/highgui/highgui.hpp"
+#include "Workspace.h"
+#include "Profile.h"
 
 #define SIFT_INTVLS							5
+#define SIFT_INTVLS_MAX						32
 #define SIFT_OCTVES							4
 #define SIFT_IMG_BORDER						10
 #define SIFT_HIST_BOREDER					8
+#define SIFT_GRADIENT_CELL					4
+#define SIFT_TILE_ROWS						32
+#define SIFT_FUSED_ROWS						64
+#define SIFT_FUSED_COLS						512
+#define SIFT_ROI_PADDING					-1
 #define SIFT_CURV_THR						10
 #define SIFT_CONTR_THR						0.03
+#define SIFT_INTERP_OFFSET					0.499
 #define SIFT_DETER_THR						0
+#define SIFT_DESCR_BINS						8
+#define SIFT_DESCR_LENGTH					((SIFT_HIST_BOREDER / 2) * (SIFT_HIST_BOREDER / 2) * SIFT_DESCR_BINS)
+#define SIFT_DESCR_SCALE					512
 #define INTERPOLATION_SIGMA					0.707106781
 #define SIFT_INIT_SIGMA						0.707106781
 #define SIFT_STEP_SIGMA						1.414213562
+#define SIFT_FIXED_SHIFT					14
 #define PI									3.141592653
 
 using namespace std;
 using namespace cv;
 
+/** Verdict of cleanPoints on an extremum candidate **/
+enum PointClass
+{
+	POINT_KEPT = 0,
+	POINT_LOW_CONTRAST = 1,
+	POINT_EDGE = 2
+};
+
+/** A band of rows of one DOG interval scanned by a single task **/
+struct ExtremaTile
+{
+	int octave, interval;
+	int rowStart, rowEnd;
+	int colStart, colEnd;
+};
+
+/** Buffers of one extrema scan worker, reused by its tiles and by every frame **/
+struct ExtremaScratch
+{
+	vector<uchar> mask;
+	vector<uchar> verdicts;
+	vector<float> terms;
+};
+
 class SIFT
 {
 private:
 	vector<Mat> keypointsGradients;
 	vector<Mat> keypointsMagnitudes;
+	bool incrementalBlur;
+	bool fixedPoint;
+	bool fusedDog;
+	bool gradientPyramid;
+	bool fastGradients;
+	int maxKeypoints;
+	Size budgetGrid;
+	int nThreads;
+	SIFTWorkspace defaultWorkspace;
+	SIFTProfile* profile;
+
+	/** Tiles, per tile results and per worker buffers of the extrema scan, kept across frames **/
+	vector<ExtremaTile> extremaTiles;
+	vector<vector<KeyPoint> > tileKeypoints;
+	vector<OctaveCounters> tileCounts;
+	vector<int64> tileTicks;
+	vector<ExtremaScratch> scanScratch;
+
+	class PyramidInvoker;
+	class DogInvoker;
+	class FusedInvoker;
+	class ExtremaInvoker;
+	class OrientationInvoker;
+	class GradientInvoker;
+
+	/** Scans tiles of the DOG intervals for extremas and appends them in tile order **/
+	void scanExtrema(vector<vector<Mat> >& dog_pyr, vector<ExtremaTile>& tiles, vector<KeyPoint>& keypoints,
+			int curv_thr);
+
+	/** Runs the given loop body on the thread pool or inline when serial **/
+	void runParallel(const Range& range, const ParallelLoopBody& body);
+
+	/** Rebuilds the pyramids of a stream from the whole frame **/
+	void streamKeyframe(SIFTStream& stream);
+
+	/** Rebuilds the pyramids of a stream around the dirty tiles, returns the pixels processed **/
+	double streamUpdate(SIFTStream& stream, const Mat& dirty, int tile, int& carried);
+
+	/** Runs the detector on padded crops around rectangles or the set pixels of a mask **/
+	void extractRegions(Mat& image, vector<KeyPoint>& keypoints, const vector<Rect>& regions, const Mat* mask,
+			int nOctaves, int nIntervals, int padding);
+
+	/** Moves candidates to the extremum of a quadratic fit in x, y and scale, drops the unstable ones **/
+	void refineKeypoints(vector<Mat>& dogs, vector<KeyPoint>& candidates, OctaveCounters& counts,
+			vector<float>& terms);
+
+	/** classifyPoints gathering the terms into a scratch buffer that is reused across calls **/
+	void classifyPoints(Mat& image, const vector<KeyPoint>& candidates, vector<uchar>& verdicts,
+			vector<float>& terms, int curv_thr, float cont_thr, float dtr_thr);
+
+	/** Keeps the strongest keypoints of a detection within the budget, with their windows if given **/
+	void selectKeypoints(vector<KeyPoint>& keypoints, size_t first, Size size, vector<Mat>* gradients = NULL,
+			vector<Mat>* magnitudes = NULL);
+
+	/** Orients candidate keypoints and appends those with a gradient window **/
+	void orientKeypoints(vector<vector<Mat> >& dog_pyr, vector<KeyPoint>& candidates, vector<KeyPoint>& keypoints,
+			vector<Mat>& gradients, vector<Mat>& magnitudes);
+
+	/** Runs the detector on a frame using the buffers of the workspace **/
+	void extractKeypoints(Mat& image, vector<KeyPoint>& keypoints, SIFTWorkspace& workspace,
+			int nOctaves, int nIntervals);
+
+	/** Fills the octave bases and the Guassian levels of a pyramid **/
+	void buildGaussianLevels(Mat& image, vector<Mat>& bases, Mat& scratch,
+			vector<vector<Mat> >& gauss_pyr, int nOctaves, int nIntervals);
+
+	/** Computes the gradient window and orientation of a single keypoint **/
+	bool computeKeypointOrientation(Mat& image, KeyPoint& keypoint, Mat& gradientWindow, Mat& magnitudeWindow);
+
+	/** Cuts the gradient window of a single keypoint out of the gradient levels and orients it **/
+	bool computeKeypointOrientation(const Mat& magnitude, const Mat& angle, KeyPoint& keypoint,
+			Mat& gradientWindow, Mat& magnitudeWindow);
+
+	/** Orients a keypoint to the fullest bin of the angles of its gradient window **/
+	void orientKeypoint(Mat& gradientWindow, KeyPoint& keypoint);
+
+	/** Orients the keypoints from the DOG pyramid or the gradient levels into the window arena of a workspace **/
+	void orientAll(vector<vector<Mat> >* dog_pyr, const vector<vector<Mat> >* magnitudes,
+			const vector<vector<Mat> >* angles, vector<KeyPoint>& keypoints, SIFTWorkspace& workspace);
 
 	/** Convert a given angle from radians to degrees **/
 	double deg2rad(float deg);
@@ -40,46 +156,113 @@ private:
 	/** Convert a given angle from degrees to radians **/
 	double rad2deg(float rad);
 
-	/** Downsamples an image to quarter its size **/
-	Mat downSample(Mat& image);
+	/** Downsamples an image to quarter its size with a fused blur **/
+	void downSample(Mat& image, Mat& resizedImage, Mat& scratch);
 
 	/** Gets the first and its index in a given histogram **/ 
-	void histogramMax(vector<double> histogram, int &maximum, int &indexMax);
+	void histogramMax(const double* histogram, int size, int &maximum, int &indexMax);
 
 	/** Tests if the given point is an extrema by comparing it to it's surroundings **/ 	
 	bool isExtrema(vector<vector<Mat> >& dog_pyr, int octave, int interval, int r, int c);
 
 	/** Build a gradient histogram from the given window and range **/
-	vector<double> buildHistogram(Mat matrix, int range, int maximum);
+	void buildHistogram(const Mat& matrix, int range, int maximum, double* histogram);
 
 public:
+	SIFT();
+
+	/** Blur every interval from the previous one instead of the octave base **/
+	void setIncrementalBlur(bool enable);
+
+	/** Run the pyramids, extrema and orientation on 16 bit fixed point levels **/
+	void setFixedPoint(bool enable);
+
+	/** Build the Guassian and DOG levels together tile by tile instead of level by level **/
+	void setFusedDog(bool enable);
+
+	/** Orient and describe from gradient levels computed once per frame instead of per keypoint **/
+	void setGradientPyramid(bool enable);
+
+	/** Compute the gradient angles and magnitudes with SIMD approximations instead of atan2f and sqrt **/
+	void setFastGradients(bool enable);
+
+	/** Keeps at most budget keypoints by DOG response, spread over a grid of cells if not empty **/
+	void setKeypointBudget(int budget, Size grid = Size());
+
+	/** Most OpenCV pool threads a stage runs on at once, 1 runs every stage serially **/
+	void setThreadCount(int threads);
+
+	/** Records stage times and candidate counts into a profile, NULL to stop **/
+	void setProfile(SIFTProfile* target);
+
 	/** Finds the SIFT keypoints in a given image **/
 	void findSiftInterestPoint(Mat& image, vector<KeyPoint>& keypoints,
 			int nOctaves = SIFT_OCTVES, int nIntervals = SIFT_INTVLS);
 
+	/** Finds the SIFT keypoints of a video frame reusing the buffers of a workspace **/
+	void findSiftInterestPoint(Mat& image, vector<KeyPoint>& keypoints, SIFTWorkspace& workspace,
+			int nOctaves = SIFT_OCTVES, int nIntervals = SIFT_INTVLS);
+
+	/** Finds the SIFT keypoints of a fixed camera frame recomputing only the changed tiles **/
+	void findSiftInterestPoint(Mat& image, vector<KeyPoint>& keypoints, SIFTStream& stream,
+			int nOctaves = SIFT_OCTVES, int nIntervals = SIFT_INTVLS);
+
+	/** Finds the SIFT keypoints inside rectangles of an image, in image coordinates **/
+	void findSiftInterestPoint(Mat& image, vector<KeyPoint>& keypoints, const vector<Rect>& regions,
+			int nOctaves = SIFT_OCTVES, int nIntervals = SIFT_INTVLS, int padding = SIFT_ROI_PADDING);
+
+	/** Finds the SIFT keypoints on the set pixels of an 8 bit mask, in image coordinates **/
+	void findSiftInterestPoint(Mat& image, vector<KeyPoint>& keypoints, const Mat& mask,
+			int nOctaves = SIFT_OCTVES, int nIntervals = SIFT_INTVLS, int padding = SIFT_ROI_PADDING);
+
 	/** Build Scale Space guassian pyramid from an image **/
 	void buildGaussianPyramid(Mat& image, vector<vector<Mat> >& pyr, 
 		int nOctaves = SIFT_OCTVES, int nIntervals = SIFT_INTVLS);
 
+	/** Build Scale Space guassian pyramid into the levels of an allocated pyramid **/
+	void buildGaussianPyramid(Mat& image, Pyramid& pyr);
+
+	/** Build the guassian and DOG pyramids together, tile by tile, into an allocated pyramid **/
+	void buildFusedPyramid(Mat& image, Pyramid& pyr);
+
 	/** Tests if the given point is a good feature **/
 	bool cleanPoints(Point position, Mat& image, int curv_thr = SIFT_CURV_THR,
 			float cont_thr = SIFT_CONTR_THR, float dtr_thr = SIFT_DETER_THR);
 
+	/** Tells why the given point is a good feature or not, a PointClass **/
+	int classifyPoint(Point position, Mat& image, int curv_thr = SIFT_CURV_THR,
+			float cont_thr = SIFT_CONTR_THR, float dtr_thr = SIFT_DETER_THR);
+
+	/** The PointClass of every candidate of a DOG interval, tested in SIMD batches **/
+	void classifyPoints(Mat& image, const vector<KeyPoint>& candidates, vector<uchar>& verdicts,
+			int curv_thr = SIFT_CURV_THR, float cont_thr = SIFT_CONTR_THR, float dtr_thr = SIFT_DETER_THR);
+
 	/** Gets the extremas from the DOG pyramid **/
 	void getScaleSpaceExtrema(vector<vector<Mat> >& dog_pyr, vector<KeyPoint>& keypoints,
 		int curv_thr = SIFT_CURV_THR);
 	
 	/** Compute the Orientation histogram for the DOG pyramid **/
 	void computeOrientationHist(vector<vector<Mat> >& dog_pyr, vector<KeyPoint>& keypoints);
+
+	/** Compute the Orientation histogram from the gradient levels of buildGradientPyramid **/
+	void computeOrientationHist(const vector<vector<Mat> >& magnitudes, const vector<vector<Mat> >& angles,
+			vector<KeyPoint>& keypoints);
 	
 	/** Draws the given keypoints on the given image **/
 	void drawKeyPoints(Mat& image, vector<KeyPoint>& keypoints);
 
-	/** Finds the SIFT keypoints in a given image **/
-	vector<vector<Mat> > buildDogPyr(vector<vector<Mat> > gauss_pyr);
+	/** Build the difference of guassians pyramid, reusing the levels of dog_pyr **/
+	void buildDogPyr(const vector<vector<Mat> >& gauss_pyr, vector<vector<Mat> >& dog_pyr);
+
+	/** Build the gradient magnitude and angle levels of the DOG intervals under the keypoint windows **/
+	void buildGradientPyramid(const vector<vector<Mat> >& dog_pyr, const vector<KeyPoint>& keypoints,
+			vector<vector<Mat> >& magnitudes, vector<vector<Mat> >& angles);
 	
 	/** Compute the SIFT descriptor of each keypoints **/
 	vector<vector<double> > computeDescriptors();
+
+	/** Compute the SIFT descriptors as rows of a float32 or quantized uint8 matrix **/
+	void computeDescriptors(Mat& descriptors, int type = CV_32F);
 };
 
 #endif
@@ -0,0 +1,1917 @@
+/*
+ * SIFTKernels.cpp
+ *
+ *  Created on: Oct 15, 2026
+ */
+
+#include <float.h>
+#include <limits.h>
+#include <algorithm>
+#include "SIFTKernels.h"
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define SIFT_HAVE_X86						1
+#define SIFT_TARGET_SSE2					__attribute__((target("sse2")))
+#define SIFT_TARGET_AVX						__attribute__((target("avx")))
+#define SIFT_TARGET_AVX2					__attribute__((target("avx2")))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <immintrin.h>
+#define SIFT_HAVE_X86						1
+#define SIFT_TARGET_SSE2
+#define SIFT_TARGET_AVX
+#define SIFT_TARGET_AVX2
+#endif
+
+/** Odd coefficients of the arctangent polynomial on [0, 1], Abramowitz and Stegun 4.4.49 **/
+#define SIFT_ATAN_C1						0.9998660f
+#define SIFT_ATAN_C3						-0.3302995f
+#define SIFT_ATAN_C5						0.1801410f
+#define SIFT_ATAN_C7						-0.0851330f
+#define SIFT_ATAN_C9						0.0208351f
+
+/**
+ * Returns the widest kernel path supported by
+ * the compiler and the running CPU
+ *
+ * @return	KERNEL_AVX2, KERNEL_AVX, KERNEL_SSE2 or KERNEL_SCALAR
+ */
+KernelPath bestKernelPath()
+{
+	if (kernelPathSupported(KERNEL_AVX2))
+		return KERNEL_AVX2;
+	if (kernelPathSupported(KERNEL_AVX))
+		return KERNEL_AVX;
+	if (kernelPathSupported(KERNEL_SSE2))
+		return KERNEL_SSE2;
+
+	return KERNEL_SCALAR;
+}
+
+
+
+/**
+ * Tests if the given kernel path was compiled in
+ * and can run on this CPU
+ *
+ * @param path		Kernel path
+ *
+ * @return	true if supported else false
+ */
+bool kernelPathSupported(KernelPath path)
+{
+#ifdef SIFT_HAVE_X86
+#ifdef CV_CPU_AVX2
+	if (path == KERNEL_AVX2)
+		return checkHardwareSupport(CV_CPU_AVX2);
+#endif
+	if (path == KERNEL_AVX)
+		return checkHardwareSupport(CV_CPU_AVX);
+	if (path == KERNEL_SSE2)
+		return checkHardwareSupport(CV_CPU_SSE2);
+#endif
+
+	return path == KERNEL_SCALAR;
+}
+
+
+
+/**
+ * Stripe of runParallel: pulls chunks of tasks
+ * from a counter shared by all stripes until the
+ * range is exhausted, so a stripe that drew cheap
+ * tasks takes over the rest of the range
+ */
+class ChunkInvoker : public ParallelLoopBody
+{
+public:
+	ChunkInvoker(const ParallelLoopBody& _body, const Range& _range, int _chunk, int* _next) :
+			body(_body), range(_range), chunk(_chunk), next(_next)
+	{
+	}
+
+	void operator()(const Range&) const
+	{
+		for (;;)
+		{
+			int start = CV_XADD(next, chunk);
+			if (start >= range.end)
+				break;
+
+			body(Range(start, std::min(start + chunk, range.end)));
+		}
+	}
+
+private:
+	const ParallelLoopBody& body;
+	Range range;
+	int chunk;
+	int* next;
+};
+
+
+
+/**
+ * Runs a loop body over a range on the OpenCV
+ * thread pool, or inline on the calling thread for
+ * 1 thread or a single task. At most threads
+ * stripes are started, so threads caps how many
+ * pool workers run the body at once, and the
+ * stripes pull small chunks of the range as they
+ * go, so uneven tasks such as the octave major
+ * pyramid levels still spread over every stripe.
+ * A chunk is about an eighth of a stripe's share,
+ * one task for short ranges. The pool size chosen
+ * with setNumThreads is never changed, so callers
+ * on different threads do not race on it, and a
+ * cap above the pool size gains nothing
+ *
+ * @param range		Task range
+ * @param body		Loop body processing a sub range
+ * @param threads	Largest number of concurrent workers
+ */
+void runParallel(const Range& range, const ParallelLoopBody& body, int threads)
+{
+	int tasks = range.end - range.start;
+
+	if (threads > 1 && tasks > 1)
+	{
+		int stripes = std::min(threads, tasks);
+		int chunk = std::max(tasks / (stripes * 8), 1);
+		int next = range.start;
+
+		parallel_for_(Range(0, stripes), ChunkInvoker(body, range, chunk, &next), stripes);
+	}
+	else
+	{
+		body(range);
+	}
+}
+
+
+
+/**
+ * Marks the 3x3x3 extremas of a DOG row. A pixel
+ * is a maximum if it is positive and greater than
+ * all 26 neighbours, a minimum if it is not positive
+ * and smaller than all 26 neighbours
+ *
+ * @param rows		Rows r - 1, r, r + 1 of the lower, current
+ *					and upper intervals, 9 pointers
+ * @param mask		Output mask, 1 for extremas else 0
+ * @param begin		First column
+ * @param end		Column past the last one
+ *
+ * @return	Updates mask[begin, end)
+ */
+static void extremaRowScalar(const float* const* rows, uchar* mask, int begin, int end)
+{
+	for (int c = begin; c < end; c++)
+	{
+		float value = rows[4][c];
+		float maxNeighbour = -FLT_MAX, minNeighbour = FLT_MAX;
+
+		for (int k = 0; k < 9; k++)
+		{
+			for (int dc = -1; dc <= 1; dc++)
+			{
+				if (k == 4 && dc == 0)
+					continue;
+
+				float neighbour = rows[k][c + dc];
+				maxNeighbour = std::max(maxNeighbour, neighbour);
+				minNeighbour = std::min(minNeighbour, neighbour);
+			}
+		}
+
+		mask[c] = (value > 0 && value > maxNeighbour) || (value <= 0 && value < minNeighbour);
+	}
+}
+
+
+
+#ifdef SIFT_HAVE_X86
+/** SSE2 version of extremaRowScalar, 8 pixels per iteration **/
+SIFT_TARGET_SSE2
+static void extremaRowSSE2(const float* const* rows, uchar* mask, int begin, int end)
+{
+	const __m128 zero = _mm_setzero_ps();
+	int c = begin;
+
+	for (; c + 8 <= end; c += 8)
+	{
+		for (int half = 0; half < 8; half += 4)
+		{
+			__m128 value = _mm_loadu_ps(rows[4] + c + half);
+			__m128 maxNeighbour = _mm_loadu_ps(rows[4] + c + half - 1);
+			__m128 minNeighbour = maxNeighbour;
+			__m128 right = _mm_loadu_ps(rows[4] + c + half + 1);
+			maxNeighbour = _mm_max_ps(maxNeighbour, right);
+			minNeighbour = _mm_min_ps(minNeighbour, right);
+
+			for (int k = 0; k < 9; k++)
+			{
+				if (k == 4)
+					continue;
+
+				for (int dc = -1; dc <= 1; dc++)
+				{
+					__m128 neighbour = _mm_loadu_ps(rows[k] + c + half + dc);
+					maxNeighbour = _mm_max_ps(maxNeighbour, neighbour);
+					minNeighbour = _mm_min_ps(minNeighbour, neighbour);
+				}
+			}
+
+			__m128 isMax = _mm_and_ps(_mm_cmpgt_ps(value, zero), _mm_cmpgt_ps(value, maxNeighbour));
+			__m128 isMin = _mm_and_ps(_mm_cmple_ps(value, zero), _mm_cmplt_ps(value, minNeighbour));
+			int bits = _mm_movemask_ps(_mm_or_ps(isMax, isMin));
+
+			for (int b = 0; b < 4; b++)
+				mask[c + half + b] = (bits >> b) & 1;
+		}
+	}
+
+	extremaRowScalar(rows, mask, c, end);
+}
+
+
+
+/** AVX version of extremaRowScalar, 8 pixels per iteration **/
+SIFT_TARGET_AVX
+static void extremaRowAVX(const float* const* rows, uchar* mask, int begin, int end)
+{
+	const __m256 zero = _mm256_setzero_ps();
+	int c = begin;
+
+	for (; c + 8 <= end; c += 8)
+	{
+		__m256 value = _mm256_loadu_ps(rows[4] + c);
+		__m256 maxNeighbour = _mm256_loadu_ps(rows[4] + c - 1);
+		__m256 minNeighbour = maxNeighbour;
+		__m256 right = _mm256_loadu_ps(rows[4] + c + 1);
+		maxNeighbour = _mm256_max_ps(maxNeighbour, right);
+		minNeighbour = _mm256_min_ps(minNeighbour, right);
+
+		for (int k = 0; k < 9; k++)
+		{
+			if (k == 4)
+				continue;
+
+			for (int dc = -1; dc <= 1; dc++)
+			{
+				__m256 neighbour = _mm256_loadu_ps(rows[k] + c + dc);
+				maxNeighbour = _mm256_max_ps(maxNeighbour, neighbour);
+				minNeighbour = _mm256_min_ps(minNeighbour, neighbour);
+			}
+		}
+
+		__m256 isMax = _mm256_and_ps(_mm256_cmp_ps(value, zero, _CMP_GT_OQ),
+				_mm256_cmp_ps(value, maxNeighbour, _CMP_GT_OQ));
+		__m256 isMin = _mm256_and_ps(_mm256_cmp_ps(value, zero, _CMP_LE_OQ),
+				_mm256_cmp_ps(value, minNeighbour, _CMP_LT_OQ));
+		int bits = _mm256_movemask_ps(_mm256_or_ps(isMax, isMin));
+
+		for (int b = 0; b < 8; b++)
+			mask[c + b] = (bits >> b) & 1;
+	}
+
+	extremaRowScalar(rows, mask, c, end);
+}
+#endif
+
+
+
+/**
+ * Marks the 3x3x3 extremas of a DOG row on the
+ * given kernel path, see extremaRowScalar. Columns
+ * begin - 1 and end must be readable
+ *
+ * @param rows		Rows r - 1, r, r + 1 of the lower, current
+ *					and upper intervals, 9 pointers
+ * @param mask		Output mask, 1 for extremas else 0
+ * @param begin		First column
+ * @param end		Column past the last one
+ * @param path		Kernel path, must be supported
+ *
+ * @return	Updates mask[begin, end)
+ */
+void extremaRow(const float* const* rows, uchar* mask, int begin, int end, KernelPath path)
+{
+#ifdef SIFT_HAVE_X86
+	if (path >= KERNEL_AVX)
+		return extremaRowAVX(rows, mask, begin, end);
+	if (path == KERNEL_SSE2)
+		return extremaRowSSE2(rows, mask, begin, end);
+#endif
+
+	extremaRowScalar(rows, mask, begin, end);
+}
+
+
+
+/**
+ * Mirrors an out of range index back into [0, len)
+ * the way BORDER_REFLECT_101 does
+ *
+ * @param p			Index
+ * @param len		Length of the axis
+ *
+ * @return	Returns the reflected index
+ */
+static inline int reflect101(int p, int len)
+{
+	if (len == 1)
+		return 0;
+
+	while (p < 0 || p >= len)
+	{
+		if (p < 0)
+			p = -p;
+		if (p >= len)
+			p = 2 * len - 2 - p;
+	}
+
+	return p;
+}
+
+
+
+/**
+ * Blurs a float image with a Guassian and keeps every
+ * other row and column, in one pass. The vertical
+ * blur is only evaluated on the even source rows and
+ * the horizontal blur only on the even columns, so
+ * no full size blurred image is ever written. Kernel
+ * size and border handling match GaussianBlur with
+ * Size(0, 0) and BORDER_REFLECT_101. A region only
+ * rewrites those output pixels, with the same values
+ * as a full pass
+ *
+ * @param src			Float image
+ * @param dst			Output of src.rows / 2 x src.cols / 2, written in place if allocated
+ * @param sigma			Standard deviation of the Guassian
+ * @param rowBuffer		Scratch of at least src.cols floats
+ * @param region		Output pixels to compute, empty for the whole image
+ *
+ * @return	Updates dst
+ */
+void blurDecimate(const Mat& src, Mat& dst, double sigma, float* rowBuffer, Rect region)
+{
+	CV_Assert(src.type() == CV_32F);
+
+	int ksize = cvRound(sigma * 4 * 2 + 1) | 1;
+	int radius = ksize / 2;
+	CV_Assert(ksize <= SIFT_MAX_KSIZE);
+
+	float kernel[SIFT_MAX_KSIZE];
+	double weights[SIFT_MAX_KSIZE], sum = 0;
+	for (int k = 0; k < ksize; k++)
+	{
+		weights[k] = exp(-(k - radius) * (k - radius) / (2 * sigma * sigma));
+		sum += weights[k];
+	}
+	for (int k = 0; k < ksize; k++)
+		kernel[k] = (float) (weights[k] / sum);
+
+	dst.create(src.rows / 2, src.cols / 2, CV_32F);
+	if (region.area() == 0)
+		region = Rect(0, 0, dst.cols, dst.rows);
+	region &= Rect(0, 0, dst.cols, dst.rows);
+
+	int cols = src.cols;
+	int first = (radius + 1) / 2;
+	int last = (cols - 1 - radius) / 2;
+
+	/* Source columns read by the region, reflected taps included */
+	int begin = std::max(region.x * 2 - radius, 0);
+	int end = std::min((region.x + region.width - 1) * 2 + radius + 1, cols);
+
+	for (int y = region.y; y < region.y + region.height; y++)
+	{
+		const float* rows[SIFT_MAX_KSIZE];
+		for (int k = 0; k < ksize; k++)
+			rows[k] = src.ptr<float>(reflect101(y * 2 + k - radius, src.rows));
+
+		for (int x = begin; x < end; x++)
+			rowBuffer[x] = kernel[0] * rows[0][x];
+		for (int k = 1; k < ksize; k++)
+		{
+			const float* row = rows[k];
+			float weight = kernel[k];
+			for (int x = begin; x < end; x++)
+				rowBuffer[x] += weight * row[x];
+		}
+
+		float* out = dst.ptr<float>(y);
+		for (int x = region.x; x < region.x + region.width; x++)
+		{
+			float value = 0;
+			if (x >= first && x <= last)
+			{
+				const float* taps = rowBuffer + x * 2 - radius;
+				for (int k = 0; k < ksize; k++)
+					value += kernel[k] * taps[k];
+			}
+			else
+			{
+				for (int k = 0; k < ksize; k++)
+					value += kernel[k] * rowBuffer[reflect101(x * 2 + k - radius, cols)];
+			}
+			out[x] = value;
+		}
+	}
+}
+
+
+
+/**
+ * Quantizes the taps of a Guassian to Q15 integers.
+ * The rounding error is moved to the center tap so
+ * the weights sum to exactly 1 << SIFT_WEIGHT_SHIFT
+ * and a flat image stays flat
+ *
+ * @param sigma		Standard deviation of the Guassian
+ * @param kernel	Output of ksize weights
+ *
+ * @return	Returns ksize, the same as GaussianBlur picks for a float image
+ */
+static int fixedKernel(double sigma, short* kernel)
+{
+	int ksize = cvRound(sigma * 4 * 2 + 1) | 1;
+	int radius = ksize / 2;
+	CV_Assert(ksize <= SIFT_MAX_KSIZE);
+
+	double weights[SIFT_MAX_KSIZE], sum = 0;
+	for (int k = 0; k < ksize; k++)
+	{
+		weights[k] = exp(-(k - radius) * (k - radius) / (2 * sigma * sigma));
+		sum += weights[k];
+	}
+
+	int total = 0;
+	for (int k = 0; k < ksize; k++)
+	{
+		kernel[k] = (short) cvRound(weights[k] / sum * (1 << SIFT_WEIGHT_SHIFT));
+		total += kernel[k];
+	}
+
+	int center = kernel[radius] + (1 << SIFT_WEIGHT_SHIFT) - total;
+	CV_Assert(center < SHRT_MAX);
+	kernel[radius] = (short) center;
+
+	return ksize;
+}
+
+
+
+/**
+ * Weighted sum of ksize 16 bit rows with Q15 weights,
+ * rounded back to 16 bits. The vertical blur passes
+ * the neighbouring image rows, the horizontal blur
+ * the same padded row shifted by one pixel per tap.
+ * Inputs of at most 1 << 15 can not overflow the
+ * 32 bit sums
+ *
+ * @param taps			ksize rows
+ * @param kernel		Q15 weights
+ * @param ksize			Number of taps
+ * @param out			Output row
+ * @param begin			First column
+ * @param end			Column past the last one
+ *
+ * @return	Updates out[begin, end)
+ */
+static void weightedSum16Scalar(const short* const* taps, const short* kernel, int ksize, short* out,
+		int begin, int end)
+{
+	for (int x = begin; x < end; x++)
+	{
+		int sum = 1 << (SIFT_WEIGHT_SHIFT - 1);
+		for (int k = 0; k < ksize; k++)
+			sum += kernel[k] * taps[k][x];
+		out[x] = saturate_cast<short>(sum >> SIFT_WEIGHT_SHIFT);
+	}
+}
+
+
+
+#ifdef SIFT_HAVE_X86
+/**
+ * SSE2 version of weightedSum16Scalar, 8 pixels per
+ * iteration. Taps are taken in pairs, interleaving
+ * two rows lets a single multiply-add apply both
+ * weights
+ */
+SIFT_TARGET_SSE2
+static void weightedSum16SSE2(const short* const* taps, const short* kernel, int ksize, short* out,
+		int begin, int end)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i round = _mm_set1_epi32(1 << (SIFT_WEIGHT_SHIFT - 1));
+	int x = begin;
+
+	for (; x + 8 <= end; x += 8)
+	{
+		__m128i low = round, high = round;
+		int k = 0;
+
+		for (; k + 1 < ksize; k += 2)
+		{
+			__m128i weights = _mm_set1_epi32((kernel[k + 1] << 16) | (unsigned short) kernel[k]);
+			__m128i a = _mm_loadu_si128((const __m128i*) (taps[k] + x));
+			__m128i b = _mm_loadu_si128((const __m128i*) (taps[k + 1] + x));
+			low = _mm_add_epi32(low, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), weights));
+			high = _mm_add_epi32(high, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), weights));
+		}
+		if (k < ksize)
+		{
+			__m128i weights = _mm_set1_epi32((unsigned short) kernel[k]);
+			__m128i a = _mm_loadu_si128((const __m128i*) (taps[k] + x));
+			low = _mm_add_epi32(low, _mm_madd_epi16(_mm_unpacklo_epi16(a, zero), weights));
+			high = _mm_add_epi32(high, _mm_madd_epi16(_mm_unpackhi_epi16(a, zero), weights));
+		}
+
+		low = _mm_srai_epi32(low, SIFT_WEIGHT_SHIFT);
+		high = _mm_srai_epi32(high, SIFT_WEIGHT_SHIFT);
+		_mm_storeu_si128((__m128i*) (out + x), _mm_packs_epi32(low, high));
+	}
+
+	weightedSum16Scalar(taps, kernel, ksize, out, x, end);
+}
+
+
+
+/**
+ * AVX2 version of weightedSum16Scalar, 16 pixels per
+ * iteration. Unpacking and packing both work within
+ * 128 bit lanes, so the pixels come back in order
+ */
+SIFT_TARGET_AVX2
+static void weightedSum16AVX2(const short* const* taps, const short* kernel, int ksize, short* out,
+		int begin, int end)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i round = _mm256_set1_epi32(1 << (SIFT_WEIGHT_SHIFT - 1));
+	int x = begin;
+
+	for (; x + 16 <= end; x += 16)
+	{
+		__m256i low = round, high = round;
+		int k = 0;
+
+		for (; k + 1 < ksize; k += 2)
+		{
+			__m256i weights = _mm256_set1_epi32((kernel[k + 1] << 16) | (unsigned short) kernel[k]);
+			__m256i a = _mm256_loadu_si256((const __m256i*) (taps[k] + x));
+			__m256i b = _mm256_loadu_si256((const __m256i*) (taps[k + 1] + x));
+			low = _mm256_add_epi32(low, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), weights));
+			high = _mm256_add_epi32(high, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), weights));
+		}
+		if (k < ksize)
+		{
+			__m256i weights = _mm256_set1_epi32((unsigned short) kernel[k]);
+			__m256i a = _mm256_loadu_si256((const __m256i*) (taps[k] + x));
+			low = _mm256_add_epi32(low, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, zero), weights));
+			high = _mm256_add_epi32(high, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, zero), weights));
+		}
+
+		low = _mm256_srai_epi32(low, SIFT_WEIGHT_SHIFT);
+		high = _mm256_srai_epi32(high, SIFT_WEIGHT_SHIFT);
+		_mm256_storeu_si256((__m256i*) (out + x), _mm256_packs_epi32(low, high));
+	}
+
+	weightedSum16SSE2(taps, kernel, ksize, out, x, end);
+}
+#endif
+
+
+
+/**
+ * Weighted sum of 16 bit rows on the given kernel
+ * path, see weightedSum16Scalar. Integer sums make
+ * every path return the same values
+ *
+ * @param taps			ksize rows
+ * @param kernel		Q15 weights
+ * @param ksize			Number of taps
+ * @param out			Output row
+ * @param begin			First column
+ * @param end			Column past the last one
+ * @param path			Kernel path, must be supported
+ *
+ * @return	Updates out[begin, end)
+ */
+static void weightedSum16(const short* const* taps, const short* kernel, int ksize, short* out, int begin,
+		int end, KernelPath path)
+{
+#ifdef SIFT_HAVE_X86
+	if (path == KERNEL_AVX2)
+		return weightedSum16AVX2(taps, kernel, ksize, out, begin, end);
+	if (path >= KERNEL_SSE2)
+		return weightedSum16SSE2(taps, kernel, ksize, out, begin, end);
+#endif
+
+	weightedSum16Scalar(taps, kernel, ksize, out, begin, end);
+}
+
+
+
+/**
+ * Blurs the source rows around row y vertically into
+ * the middle of a padded row and mirrors the padding
+ * the way BORDER_REFLECT_101 does, if the columns
+ * reach the image border
+ *
+ * @param src		16 bit image
+ * @param y			Source row
+ * @param kernel	Q15 weights
+ * @param ksize		Number of taps
+ * @param padded	Output of src.cols + ksize - 1 pixels
+ * @param begin		First column
+ * @param end		Column past the last one
+ * @param path		Kernel path
+ *
+ * @return	Updates padded
+ */
+static void blurColumns16(const Mat& src, int y, const short* kernel, int ksize, short* padded, int begin,
+		int end, KernelPath path)
+{
+	int radius = ksize / 2;
+	const short* rows[SIFT_MAX_KSIZE];
+	for (int k = 0; k < ksize; k++)
+		rows[k] = src.ptr<short>(reflect101(y + k - radius, src.rows));
+
+	short* row = padded + radius;
+	weightedSum16(rows, kernel, ksize, row, begin, end, path);
+
+	for (int k = 1; k <= radius; k++)
+	{
+		if (begin == 0)
+			row[-k] = row[reflect101(-k, src.cols)];
+		if (end == src.cols)
+			row[src.cols - 1 + k] = row[reflect101(src.cols - 1 + k, src.cols)];
+	}
+}
+
+
+
+/**
+ * Blurs a 16 bit fixed point image with a Guassian
+ * whose taps are Q15 integers, a vertical then a
+ * horizontal pass per row. Kernel size and border
+ * handling match GaussianBlur with Size(0, 0) and
+ * BORDER_REFLECT_101, values differ from a float
+ * blur by the rounding of the taps and of the two
+ * passes. A region only rewrites those output
+ * pixels, with the same values as a full pass
+ *
+ * @param src			16 bit image of values in [-1 << 15, 1 << 15)
+ * @param dst			Output of the size of src, written in place if allocated
+ * @param sigma			Standard deviation of the Guassian
+ * @param region		Output pixels to compute, empty for the whole image
+ * @param path			Kernel path, must be supported
+ *
+ * @return	Updates dst
+ */
+void gaussianBlur16(const Mat& src, Mat& dst, double sigma, Rect region, KernelPath path)
+{
+	CV_Assert(src.type() == CV_16S);
+
+	short kernel[SIFT_MAX_KSIZE];
+	int ksize = fixedKernel(sigma, kernel);
+	int radius = ksize / 2;
+
+	dst.create(src.size(), CV_16S);
+	CV_Assert(dst.data != src.data);
+	if (region.area() == 0)
+		region = Rect(0, 0, src.cols, src.rows);
+	region &= Rect(0, 0, src.cols, src.rows);
+
+	/* Source columns read by the region, reflected taps included */
+	int begin = std::max(region.x - radius, 0);
+	int end = std::min(region.x + region.width + radius, src.cols);
+
+	std::vector<short> padded(src.cols + ksize - 1);
+	const short* taps[SIFT_MAX_KSIZE];
+	for (int k = 0; k < ksize; k++)
+		taps[k] = &padded[k];
+
+	for (int y = region.y; y < region.y + region.height; y++)
+	{
+		blurColumns16(src, y, kernel, ksize, &padded[0], begin, end, path);
+		weightedSum16(taps, kernel, ksize, dst.ptr<short>(y), region.x, region.x + region.width, path);
+	}
+}
+
+
+
+/**
+ * Blurs a 16 bit fixed point image with a Guassian
+ * and keeps every other row and column, in one pass.
+ * The vertical blur is only evaluated on the even
+ * rows. The blurred row is split in its even and odd
+ * pixels, so the horizontal blur of the even columns
+ * is again a plain weighted sum of shifted rows
+ *
+ * @param src			16 bit image of values in [-1 << 15, 1 << 15)
+ * @param dst			Output of src.rows / 2 x src.cols / 2, written in place if allocated
+ * @param sigma			Standard deviation of the Guassian
+ * @param path			Kernel path, must be supported
+ *
+ * @return	Updates dst
+ */
+void blurDecimate16(const Mat& src, Mat& dst, double sigma, KernelPath path)
+{
+	CV_Assert(src.type() == CV_16S);
+
+	short kernel[SIFT_MAX_KSIZE];
+	int ksize = fixedKernel(sigma, kernel);
+
+	dst.create(src.rows / 2, src.cols / 2, CV_16S);
+
+	int width = src.cols + ksize - 1;
+	std::vector<short> padded(width), even((width + 1) / 2), odd(width / 2 + 1);
+	const short* taps[SIFT_MAX_KSIZE];
+	for (int k = 0; k < ksize; k++)
+		taps[k] = (k % 2 == 0 ? &even[0] : &odd[0]) + k / 2;
+
+	for (int y = 0; y < dst.rows; y++)
+	{
+		blurColumns16(src, y * 2, kernel, ksize, &padded[0], 0, src.cols, path);
+		for (int x = 0; x < width; x++)
+			(x % 2 == 0 ? even : odd)[x / 2] = padded[x];
+
+		weightedSum16(taps, kernel, ksize, dst.ptr<short>(y), 0, dst.cols, path);
+	}
+}
+
+
+
+/**
+ * Marks the 3x3x3 extremas of a 16 bit DOG row, see
+ * extremaRowScalar
+ *
+ * @param rows		Rows r - 1, r, r + 1 of the lower, current
+ *					and upper intervals, 9 pointers
+ * @param mask		Output mask, 1 for extremas else 0
+ * @param begin		First column
+ * @param end		Column past the last one
+ *
+ * @return	Updates mask[begin, end)
+ */
+static void extremaRow16Scalar(const short* const* rows, uchar* mask, int begin, int end)
+{
+	for (int c = begin; c < end; c++)
+	{
+		short value = rows[4][c];
+		short maxNeighbour = SHRT_MIN, minNeighbour = SHRT_MAX;
+
+		for (int k = 0; k < 9; k++)
+		{
+			for (int dc = -1; dc <= 1; dc++)
+			{
+				if (k == 4 && dc == 0)
+					continue;
+
+				short neighbour = rows[k][c + dc];
+				maxNeighbour = std::max(maxNeighbour, neighbour);
+				minNeighbour = std::min(minNeighbour, neighbour);
+			}
+		}
+
+		mask[c] = (value > 0 && value > maxNeighbour) || (value <= 0 && value < minNeighbour);
+	}
+}
+
+
+
+#ifdef SIFT_HAVE_X86
+/** SSE2 version of extremaRow16Scalar, 8 pixels per iteration **/
+SIFT_TARGET_SSE2
+static void extremaRow16SSE2(const short* const* rows, uchar* mask, int begin, int end)
+{
+	const __m128i zero = _mm_setzero_si128();
+	int c = begin;
+
+	for (; c + 8 <= end; c += 8)
+	{
+		__m128i value = _mm_loadu_si128((const __m128i*) (rows[4] + c));
+		__m128i maxNeighbour = _mm_loadu_si128((const __m128i*) (rows[4] + c - 1));
+		__m128i minNeighbour = maxNeighbour;
+		__m128i right = _mm_loadu_si128((const __m128i*) (rows[4] + c + 1));
+		maxNeighbour = _mm_max_epi16(maxNeighbour, right);
+		minNeighbour = _mm_min_epi16(minNeighbour, right);
+
+		for (int k = 0; k < 9; k++)
+		{
+			if (k == 4)
+				continue;
+
+			for (int dc = -1; dc <= 1; dc++)
+			{
+				__m128i neighbour = _mm_loadu_si128((const __m128i*) (rows[k] + c + dc));
+				maxNeighbour = _mm_max_epi16(maxNeighbour, neighbour);
+				minNeighbour = _mm_min_epi16(minNeighbour, neighbour);
+			}
+		}
+
+		__m128i positive = _mm_cmpgt_epi16(value, zero);
+		__m128i isMax = _mm_and_si128(positive, _mm_cmpgt_epi16(value, maxNeighbour));
+		__m128i isMin = _mm_andnot_si128(positive, _mm_cmplt_epi16(value, minNeighbour));
+		int bits = _mm_movemask_epi8(_mm_or_si128(isMax, isMin));
+
+		for (int b = 0; b < 8; b++)
+			mask[c + b] = (bits >> (b * 2)) & 1;
+	}
+
+	extremaRow16Scalar(rows, mask, c, end);
+}
+
+
+
+/** AVX2 version of extremaRow16Scalar, 16 pixels per iteration **/
+SIFT_TARGET_AVX2
+static void extremaRow16AVX2(const short* const* rows, uchar* mask, int begin, int end)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	int c = begin;
+
+	for (; c + 16 <= end; c += 16)
+	{
+		__m256i value = _mm256_loadu_si256((const __m256i*) (rows[4] + c));
+		__m256i maxNeighbour = _mm256_loadu_si256((const __m256i*) (rows[4] + c - 1));
+		__m256i minNeighbour = maxNeighbour;
+		__m256i right = _mm256_loadu_si256((const __m256i*) (rows[4] + c + 1));
+		maxNeighbour = _mm256_max_epi16(maxNeighbour, right);
+		minNeighbour = _mm256_min_epi16(minNeighbour, right);
+
+		for (int k = 0; k < 9; k++)
+		{
+			if (k == 4)
+				continue;
+
+			for (int dc = -1; dc <= 1; dc++)
+			{
+				__m256i neighbour = _mm256_loadu_si256((const __m256i*) (rows[k] + c + dc));
+				maxNeighbour = _mm256_max_epi16(maxNeighbour, neighbour);
+				minNeighbour = _mm256_min_epi16(minNeighbour, neighbour);
+			}
+		}
+
+		__m256i positive = _mm256_cmpgt_epi16(value, zero);
+		__m256i isMax = _mm256_and_si256(positive, _mm256_cmpgt_epi16(value, maxNeighbour));
+		__m256i isMin = _mm256_andnot_si256(positive, _mm256_cmpgt_epi16(minNeighbour, value));
+		unsigned int bits = _mm256_movemask_epi8(_mm256_or_si256(isMax, isMin));
+
+		for (int b = 0; b < 16; b++)
+			mask[c + b] = (bits >> (b * 2)) & 1;
+	}
+
+	extremaRow16SSE2(rows, mask, c, end);
+}
+#endif
+
+
+
+/**
+ * Marks the 3x3x3 extremas of a 16 bit DOG row on
+ * the given kernel path, see extremaRowScalar.
+ * Columns begin - 1 and end must be readable
+ *
+ * @param rows		Rows r - 1, r, r + 1 of the lower, current
+ *					and upper intervals, 9 pointers
+ * @param mask		Output mask, 1 for extremas else 0
+ * @param begin		First column
+ * @param end		Column past the last one
+ * @param path		Kernel path, must be supported
+ *
+ * @return	Updates mask[begin, end)
+ */
+void extremaRow16(const short* const* rows, uchar* mask, int begin, int end, KernelPath path)
+{
+#ifdef SIFT_HAVE_X86
+	if (path == KERNEL_AVX2)
+		return extremaRow16AVX2(rows, mask, begin, end);
+	if (path >= KERNEL_SSE2)
+		return extremaRow16SSE2(rows, mask, begin, end);
+#endif
+
+	extremaRow16Scalar(rows, mask, begin, end);
+}
+
+
+
+/**
+ * Solves H offset = -g for n symmetric 3x3 systems,
+ * by the adjugate of H. The terms are stored one row
+ * per term, so a SIMD lane holds one system. A
+ * singular H gives non finite offsets
+ *
+ * @param hessian	6 rows: xx, yy, ss, xy, xs, ys
+ * @param gradient	3 rows: x, y, s
+ * @param offset	Output of 3 rows: x, y, s
+ * @param begin		First system
+ * @param end		System past the last one
+ *
+ * @return	Updates offset[0 - 2][begin, end)
+ */
+static void solveHessiansScalar(const float* const* hessian, const float* const* gradient, float* const* offset,
+		int begin, int end)
+{
+	for (int z = begin; z < end; z++)
+	{
+		float a = hessian[0][z], b = hessian[1][z], c = hessian[2][z];
+		float d = hessian[3][z], e = hessian[4][z], f = hessian[5][z];
+		float gx = gradient[0][z], gy = gradient[1][z], gs = gradient[2][z];
+
+		float a00 = b * c - f * f, a01 = e * f - d * c, a02 = d * f - b * e;
+		float a11 = a * c - e * e, a12 = d * e - a * f, a22 = a * b - d * d;
+		float det = a * a00 + d * a01 + e * a02;
+
+		offset[0][z] = -(a00 * gx + a01 * gy + a02 * gs) / det;
+		offset[1][z] = -(a01 * gx + a11 * gy + a12 * gs) / det;
+		offset[2][z] = -(a02 * gx + a12 * gy + a22 * gs) / det;
+	}
+}
+
+
+
+#ifdef SIFT_HAVE_X86
+/** SSE2 version of solveHessiansScalar, 4 systems per iteration **/
+SIFT_TARGET_SSE2
+static void solveHessiansSSE2(const float* const* hessian, const float* const* gradient, float* const* offset,
+		int begin, int end)
+{
+	const __m128 sign = _mm_set1_ps(-0.0f);
+	int z = begin;
+
+	for (; z + 4 <= end; z += 4)
+	{
+		__m128 a = _mm_loadu_ps(hessian[0] + z), b = _mm_loadu_ps(hessian[1] + z), c = _mm_loadu_ps(hessian[2] + z);
+		__m128 d = _mm_loadu_ps(hessian[3] + z), e = _mm_loadu_ps(hessian[4] + z), f = _mm_loadu_ps(hessian[5] + z);
+		__m128 gx = _mm_loadu_ps(gradient[0] + z), gy = _mm_loadu_ps(gradient[1] + z);
+		__m128 gs = _mm_loadu_ps(gradient[2] + z);
+
+		__m128 a00 = _mm_sub_ps(_mm_mul_ps(b, c), _mm_mul_ps(f, f));
+		__m128 a01 = _mm_sub_ps(_mm_mul_ps(e, f), _mm_mul_ps(d, c));
+		__m128 a02 = _mm_sub_ps(_mm_mul_ps(d, f), _mm_mul_ps(b, e));
+		__m128 a11 = _mm_sub_ps(_mm_mul_ps(a, c), _mm_mul_ps(e, e));
+		__m128 a12 = _mm_sub_ps(_mm_mul_ps(d, e), _mm_mul_ps(a, f));
+		__m128 a22 = _mm_sub_ps(_mm_mul_ps(a, b), _mm_mul_ps(d, d));
+		__m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a, a00), _mm_mul_ps(d, a01)), _mm_mul_ps(e, a02));
+
+		__m128 ox = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a00, gx), _mm_mul_ps(a01, gy)), _mm_mul_ps(a02, gs));
+		__m128 oy = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a01, gx), _mm_mul_ps(a11, gy)), _mm_mul_ps(a12, gs));
+		__m128 os = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a02, gx), _mm_mul_ps(a12, gy)), _mm_mul_ps(a22, gs));
+
+		_mm_storeu_ps(offset[0] + z, _mm_div_ps(_mm_xor_ps(ox, sign), det));
+		_mm_storeu_ps(offset[1] + z, _mm_div_ps(_mm_xor_ps(oy, sign), det));
+		_mm_storeu_ps(offset[2] + z, _mm_div_ps(_mm_xor_ps(os, sign), det));
+	}
+
+	solveHessiansScalar(hessian, gradient, offset, z, end);
+}
+
+
+
+/** AVX version of solveHessiansScalar, 8 systems per iteration **/
+SIFT_TARGET_AVX
+static void solveHessiansAVX(const float* const* hessian, const float* const* gradient, float* const* offset,
+		int begin, int end)
+{
+	const __m256 sign = _mm256_set1_ps(-0.0f);
+	int z = begin;
+
+	for (; z + 8 <= end; z += 8)
+	{
+		__m256 a = _mm256_loadu_ps(hessian[0] + z), b = _mm256_loadu_ps(hessian[1] + z);
+		__m256 c = _mm256_loadu_ps(hessian[2] + z), d = _mm256_loadu_ps(hessian[3] + z);
+		__m256 e = _mm256_loadu_ps(hessian[4] + z), f = _mm256_loadu_ps(hessian[5] + z);
+		__m256 gx = _mm256_loadu_ps(gradient[0] + z), gy = _mm256_loadu_ps(gradient[1] + z);
+		__m256 gs = _mm256_loadu_ps(gradient[2] + z);
+
+		__m256 a00 = _mm256_sub_ps(_mm256_mul_ps(b, c), _mm256_mul_ps(f, f));
+		__m256 a01 = _mm256_sub_ps(_mm256_mul_ps(e, f), _mm256_mul_ps(d, c));
+		__m256 a02 = _mm256_sub_ps(_mm256_mul_ps(d, f), _mm256_mul_ps(b, e));
+		__m256 a11 = _mm256_sub_ps(_mm256_mul_ps(a, c), _mm256_mul_ps(e, e));
+		__m256 a12 = _mm256_sub_ps(_mm256_mul_ps(d, e), _mm256_mul_ps(a, f));
+		__m256 a22 = _mm256_sub_ps(_mm256_mul_ps(a, b), _mm256_mul_ps(d, d));
+		__m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(a, a00), _mm256_mul_ps(d, a01)),
+				_mm256_mul_ps(e, a02));
+
+		__m256 ox = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(a00, gx), _mm256_mul_ps(a01, gy)),
+				_mm256_mul_ps(a02, gs));
+		__m256 oy = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(a01, gx), _mm256_mul_ps(a11, gy)),
+				_mm256_mul_ps(a12, gs));
+		__m256 os = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(a02, gx), _mm256_mul_ps(a12, gy)),
+				_mm256_mul_ps(a22, gs));
+
+		_mm256_storeu_ps(offset[0] + z, _mm256_div_ps(_mm256_xor_ps(ox, sign), det));
+		_mm256_storeu_ps(offset[1] + z, _mm256_div_ps(_mm256_xor_ps(oy, sign), det));
+		_mm256_storeu_ps(offset[2] + z, _mm256_div_ps(_mm256_xor_ps(os, sign), det));
+	}
+
+	solveHessiansScalar(hessian, gradient, offset, z, end);
+}
+#endif
+
+
+
+/**
+ * Solves H offset = -g for n symmetric 3x3 systems
+ * on the given kernel path, see solveHessiansScalar.
+ * Every path rounds the same way and returns the
+ * same offsets
+ *
+ * @param hessian	6 rows: xx, yy, ss, xy, xs, ys
+ * @param gradient	3 rows: x, y, s
+ * @param offset	Output of 3 rows: x, y, s
+ * @param n			Number of systems
+ * @param path		Kernel path, must be supported
+ *
+ * @return	Updates offset[0 - 2][0, n)
+ */
+void solveHessians(const float* const* hessian, const float* const* gradient, float* const* offset, int n,
+		KernelPath path)
+{
+#ifdef SIFT_HAVE_X86
+	if (path >= KERNEL_AVX)
+		return solveHessiansAVX(hessian, gradient, offset, 0, n);
+	if (path == KERNEL_SSE2)
+		return solveHessiansSSE2(hessian, gradient, offset, 0, n);
+#endif
+
+	solveHessiansScalar(hessian, gradient, offset, 0, n);
+}
+
+
+
+/**
+ * Classifies n extremum candidates by their DOG
+ * value and the 2x2 Hessian of their interval. The
+ * terms are stored one row per term, so a SIMD lane
+ * holds one candidate. A candidate is rejected for
+ * low contrast if |value| < contrast, else as an
+ * edge if the determinant is below determinant or
+ * the trace^2 / determinant ratio is above curvature
+ *
+ * @param terms			4 rows: value, xx, yy, xy
+ * @param verdicts		Output verdicts: 0 kept, 1 low contrast, 2 edge
+ * @param begin			First candidate
+ * @param end			Candidate past the last one
+ * @param contrast		Contrast threshold
+ * @param curvature		Curvature ratio threshold
+ * @param determinant	Determinant threshold
+ *
+ * @return	Updates verdicts[begin, end)
+ */
+static void edgeTestsScalar(const float* const* terms, uchar* verdicts, int begin, int end, float contrast,
+		float curvature, float determinant)
+{
+	for (int z = begin; z < end; z++)
+	{
+		float value = terms[0][z], xx = terms[1][z], yy = terms[2][z], xy = terms[3][z];
+		float trace = xx + yy;
+		float det = xx * yy - xy * xy;
+
+		if (fabs(value) < contrast)
+			verdicts[z] = 1;
+		else if (det < determinant || trace * trace / det > curvature)
+			verdicts[z] = 2;
+		else
+			verdicts[z] = 0;
+	}
+}
+
+
+
+#ifdef SIFT_HAVE_X86
+/** SSE2 version of edgeTestsScalar, 4 candidates per iteration **/
+SIFT_TARGET_SSE2
+static void edgeTestsSSE2(const float* const* terms, uchar* verdicts, int begin, int end, float contrast,
+		float curvature, float determinant)
+{
+	const __m128 magnitude = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	const __m128 contr = _mm_set1_ps(contrast), curv = _mm_set1_ps(curvature);
+	const __m128 deter = _mm_set1_ps(determinant);
+	int z = begin;
+
+	for (; z + 4 <= end; z += 4)
+	{
+		__m128 value = _mm_loadu_ps(terms[0] + z), xx = _mm_loadu_ps(terms[1] + z);
+		__m128 yy = _mm_loadu_ps(terms[2] + z), xy = _mm_loadu_ps(terms[3] + z);
+		__m128 trace = _mm_add_ps(xx, yy);
+		__m128 det = _mm_sub_ps(_mm_mul_ps(xx, yy), _mm_mul_ps(xy, xy));
+
+		int low = _mm_movemask_ps(_mm_cmplt_ps(_mm_and_ps(value, magnitude), contr));
+		int edge = _mm_movemask_ps(_mm_or_ps(_mm_cmplt_ps(det, deter),
+				_mm_cmpgt_ps(_mm_div_ps(_mm_mul_ps(trace, trace), det), curv))) & ~low;
+
+		for (int k = 0; k < 4; k++)
+			verdicts[z + k] = ((low >> k) & 1) | (((edge >> k) & 1) << 1);
+	}
+
+	edgeTestsScalar(terms, verdicts, z, end, contrast, curvature, determinant);
+}
+
+
+
+/** AVX version of edgeTestsScalar, 8 candidates per iteration **/
+SIFT_TARGET_AVX
+static void edgeTestsAVX(const float* const* terms, uchar* verdicts, int begin, int end, float contrast,
+		float curvature, float determinant)
+{
+	const __m256 magnitude = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+	const __m256 contr = _mm256_set1_ps(contrast), curv = _mm256_set1_ps(curvature);
+	const __m256 deter = _mm256_set1_ps(determinant);
+	int z = begin;
+
+	for (; z + 8 <= end; z += 8)
+	{
+		__m256 value = _mm256_loadu_ps(terms[0] + z), xx = _mm256_loadu_ps(terms[1] + z);
+		__m256 yy = _mm256_loadu_ps(terms[2] + z), xy = _mm256_loadu_ps(terms[3] + z);
+		__m256 trace = _mm256_add_ps(xx, yy);
+		__m256 det = _mm256_sub_ps(_mm256_mul_ps(xx, yy), _mm256_mul_ps(xy, xy));
+
+		int low = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_and_ps(value, magnitude), contr, _CMP_LT_OQ));
+		int edge = _mm256_movemask_ps(_mm256_or_ps(_mm256_cmp_ps(det, deter, _CMP_LT_OQ),
+				_mm256_cmp_ps(_mm256_div_ps(_mm256_mul_ps(trace, trace), det), curv, _CMP_GT_OQ))) & ~low;
+
+		for (int k = 0; k < 8; k++)
+			verdicts[z + k] = ((low >> k) & 1) | (((edge >> k) & 1) << 1);
+	}
+
+	edgeTestsScalar(terms, verdicts, z, end, contrast, curvature, determinant);
+}
+#endif
+
+
+
+/**
+ * Classifies n extremum candidates on the given
+ * kernel path, see edgeTestsScalar. Every path
+ * gives the same verdicts
+ *
+ * @param terms			4 rows: value, xx, yy, xy
+ * @param verdicts		Output verdicts: 0 kept, 1 low contrast, 2 edge
+ * @param n				Number of candidates
+ * @param contrast		Contrast threshold
+ * @param curvature		Curvature ratio threshold
+ * @param determinant	Determinant threshold
+ * @param path			Kernel path, must be supported
+ *
+ * @return	Updates verdicts[0, n)
+ */
+void edgeTests(const float* const* terms, uchar* verdicts, int n, float contrast, float curvature,
+		float determinant, KernelPath path)
+{
+#ifdef SIFT_HAVE_X86
+	if (path >= KERNEL_AVX)
+		return edgeTestsAVX(terms, verdicts, 0, n, contrast, curvature, determinant);
+	if (path == KERNEL_SSE2)
+		return edgeTestsSSE2(terms, verdicts, 0, n, contrast, curvature, determinant);
+#endif
+
+	edgeTestsScalar(terms, verdicts, 0, n, contrast, curvature, determinant);
+}
+
+
+
+/**
+ * Angle of a gradient in degrees, in [0, 360)
+ *
+ * @param dy	Vertical difference
+ * @param dx	Horizontal difference
+ *
+ * @return	Returns the angle
+ */
+static inline float gradientAngle(float dy, float dx)
+{
+	float angle = atan2f(dy, dx) * (float) (180 / CV_PI);
+	if (angle < 0)
+		angle += 360;
+
+	/* A tiny negative angle rounds up to 360 */
+	return angle < 360 ? angle : 0;
+}
+
+
+
+/**
+ * Computes the gradient magnitude and angle of a
+ * row from central differences. The row pointers
+ * are read one pixel before begin and one past end
+ *
+ * @param above		Row above
+ * @param row		Row of the gradients
+ * @param below		Row below
+ * @param magnitude	Output magnitudes
+ * @param angle		Output angles in degrees, in [0, 360)
+ * @param begin		First pixel
+ * @param end		Pixel past the last one
+ *
+ * @return	Updates magnitude and angle in [begin, end)
+ */
+static void gradientRowScalar(const float* above, const float* row, const float* below, float* magnitude,
+		float* angle, int begin, int end)
+{
+	for (int z = begin; z < end; z++)
+	{
+		float dx = row[z + 1] - row[z - 1];
+		float dy = below[z] - above[z];
+
+		magnitude[z] = sqrt(dx * dx + dy * dy);
+		angle[z] = gradientAngle(dy, dx);
+	}
+}
+
+
+
+#ifdef SIFT_HAVE_X86
+/** SSE2 version of gradientRowScalar, 4 pixels per iteration **/
+SIFT_TARGET_SSE2
+static void gradientRowSSE2(const float* above, const float* row, const float* below, float* magnitude,
+		float* angle, int begin, int end)
+{
+	float dxs[4], dys[4];
+	int z = begin;
+
+	for (; z + 4 <= end; z += 4)
+	{
+		__m128 dx = _mm_sub_ps(_mm_loadu_ps(row + z + 1), _mm_loadu_ps(row + z - 1));
+		__m128 dy = _mm_sub_ps(_mm_loadu_ps(below + z), _mm_loadu_ps(above + z));
+
+		_mm_storeu_ps(magnitude + z, _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy))));
+		_mm_storeu_ps(dxs, dx);
+		_mm_storeu_ps(dys, dy);
+		for (int k = 0; k < 4; k++)
+			angle[z + k] = gradientAngle(dys[k], dxs[k]);
+	}
+
+	gradientRowScalar(above, row, below, magnitude, angle, z, end);
+}
+
+
+
+/** AVX version of gradientRowScalar, 8 pixels per iteration **/
+SIFT_TARGET_AVX
+static void gradientRowAVX(const float* above, const float* row, const float* below, float* magnitude,
+		float* angle, int begin, int end)
+{
+	float dxs[8], dys[8];
+	int z = begin;
+
+	for (; z + 8 <= end; z += 8)
+	{
+		__m256 dx = _mm256_sub_ps(_mm256_loadu_ps(row + z + 1), _mm256_loadu_ps(row + z - 1));
+		__m256 dy = _mm256_sub_ps(_mm256_loadu_ps(below + z), _mm256_loadu_ps(above + z));
+
+		_mm256_storeu_ps(magnitude + z,
+				_mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy))));
+		_mm256_storeu_ps(dxs, dx);
+		_mm256_storeu_ps(dys, dy);
+		for (int k = 0; k < 8; k++)
+			angle[z + k] = gradientAngle(dys[k], dxs[k]);
+	}
+
+	gradientRowScalar(above, row, below, magnitude, angle, z, end);
+}
+#endif
+
+
+
+/**
+ * Computes the gradient magnitude and angle of a
+ * row on the given kernel path, see
+ * gradientRowScalar. The square roots are correctly
+ * rounded on every path, so every path gives the
+ * same gradients
+ *
+ * @param above		Row above
+ * @param row		Row of the gradients
+ * @param below		Row below
+ * @param magnitude	Output magnitudes
+ * @param angle		Output angles in degrees, in [0, 360)
+ * @param begin		First pixel
+ * @param end		Pixel past the last one
+ * @param path		Kernel path, must be supported
+ *
+ * @return	Updates magnitude and angle in [begin, end)
+ */
+void gradientRow(const float* above, const float* row, const float* below, float* magnitude, float* angle,
+		int begin, int end, KernelPath path)
+{
+#ifdef SIFT_HAVE_X86
+	if (path >= KERNEL_AVX)
+		return gradientRowAVX(above, row, below, magnitude, angle, begin, end);
+	if (path == KERNEL_SSE2)
+		return gradientRowSSE2(above, row, below, magnitude, angle, begin, end);
+#endif
+
+	gradientRowScalar(above, row, below, magnitude, angle, begin, end);
+}
+
+
+
+/**
+ * Approximates the angle of a gradient in degrees,
+ * in [0, 360). The arctangent of the smaller over
+ * the larger component, in [0, 1], is the minimax
+ * polynomial of Abramowitz and Stegun 4.4.49, and
+ * the octant is restored by reflections. The
+ * polynomial is within 1e-5 radians of the exact
+ * value in exact arithmetic; with float rounding
+ * the angle is within about 1.2e-5 radians
+ * (0.00067 degrees)
+ *
+ * @param dy	Vertical difference
+ * @param dx	Horizontal difference
+ *
+ * @return	Returns the angle
+ */
+static inline float fastGradientAngle(float dy, float dx)
+{
+	float ax = fabs(dx), ay = fabs(dy);
+	float a = std::min(ax, ay) / std::max(std::max(ax, ay), FLT_MIN);
+	float s = a * a;
+	float p = SIFT_ATAN_C1 + s * (SIFT_ATAN_C3 + s * (SIFT_ATAN_C5 + s * (SIFT_ATAN_C7 + s * SIFT_ATAN_C9)));
+	float angle = a * p * (float) (180 / CV_PI);
+
+	if (ay > ax)
+		angle = 90 - angle;
+	if (dx < 0)
+		angle = 180 - angle;
+	if (dy < 0)
+		angle = 360 - angle;
+
+	return angle < 360 ? angle : 0;
+}
+
+
+
+/**
+ * Scalar version of fastGradientRow: the polynomial
+ * angle of fastGradientAngle and exact magnitudes
+ *
+ * @param above		Row above
+ * @param row		Row of the gradients
+ * @param below		Row below
+ * @param magnitude	Output magnitudes
+ * @param angle		Output angles in degrees, in [0, 360)
+ * @param begin		First pixel
+ * @param end		Pixel past the last one
+ *
+ * @return	Updates magnitude and angle in [begin, end)
+ */
+static void fastGradientRowScalar(const float* above, const float* row, const float* below, float* magnitude,
+		float* angle, int begin, int end)
+{
+	for (int z = begin; z < end; z++)
+	{
+		float dx = row[z + 1] - row[z - 1];
+		float dy = below[z] - above[z];
+
+		magnitude[z] = sqrt(dx * dx + dy * dy);
+		angle[z] = fastGradientAngle(dy, dx);
+	}
+}
+
+
+
+#ifdef SIFT_HAVE_X86
+/**
+ * Approximate magnitudes and angles of 4 gradients.
+ * The angle is fastGradientAngle lane by lane, the
+ * magnitude is the squared norm times its reciprocal
+ * square root estimate refined by one Newton step,
+ * within 2^-21 of the exact magnitude relatively.
+ * Squared norms below FLT_MIN give a 0 magnitude
+ *
+ * @param dx		Horizontal differences
+ * @param dy		Vertical differences
+ * @param magnitude	Output magnitudes
+ * @param angle		Output angles in degrees, in [0, 360)
+ */
+SIFT_TARGET_SSE2
+static inline void fastGradientSSE2(__m128 dx, __m128 dy, __m128& magnitude, __m128& angle)
+{
+	const __m128 sign = _mm_set1_ps(-0.0f), zero = _mm_setzero_ps();
+	const __m128 tiny = _mm_set1_ps(FLT_MIN);
+	__m128 ax = _mm_andnot_ps(sign, dx), ay = _mm_andnot_ps(sign, dy);
+	__m128 a = _mm_div_ps(_mm_min_ps(ax, ay), _mm_max_ps(_mm_max_ps(ax, ay), tiny));
+	__m128 s = _mm_mul_ps(a, a);
+
+	__m128 p = _mm_add_ps(_mm_set1_ps(SIFT_ATAN_C7), _mm_mul_ps(s, _mm_set1_ps(SIFT_ATAN_C9)));
+	p = _mm_add_ps(_mm_set1_ps(SIFT_ATAN_C5), _mm_mul_ps(s, p));
+	p = _mm_add_ps(_mm_set1_ps(SIFT_ATAN_C3), _mm_mul_ps(s, p));
+	p = _mm_add_ps(_mm_set1_ps(SIFT_ATAN_C1), _mm_mul_ps(s, p));
+	__m128 r = _mm_mul_ps(_mm_mul_ps(a, p), _mm_set1_ps((float) (180 / CV_PI)));
+
+	/* Reflections, selected by masks */
+	__m128 mask = _mm_cmpgt_ps(ay, ax);
+	r = _mm_or_ps(_mm_and_ps(mask, _mm_sub_ps(_mm_set1_ps(90), r)), _mm_andnot_ps(mask, r));
+	mask = _mm_cmplt_ps(dx, zero);
+	r = _mm_or_ps(_mm_and_ps(mask, _mm_sub_ps(_mm_set1_ps(180), r)), _mm_andnot_ps(mask, r));
+	mask = _mm_cmplt_ps(dy, zero);
+	r = _mm_or_ps(_mm_and_ps(mask, _mm_sub_ps(_mm_set1_ps(360), r)), _mm_andnot_ps(mask, r));
+	angle = _mm_and_ps(r, _mm_cmplt_ps(r, _mm_set1_ps(360)));
+
+	__m128 squared = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+	__m128 y = _mm_rsqrt_ps(squared);
+	y = _mm_mul_ps(y, _mm_sub_ps(_mm_set1_ps(1.5f),
+			_mm_mul_ps(_mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f), squared), y), y)));
+	magnitude = _mm_and_ps(_mm_mul_ps(squared, y), _mm_cmpge_ps(squared, tiny));
+}
+
+
+
+/** SSE2 version of fastGradientRowScalar with the approximate magnitudes, 4 pixels per iteration **/
+SIFT_TARGET_SSE2
+static void fastGradientRowSSE2(const float* above, const float* row, const float* below, float* magnitude,
+		float* angle, int begin, int end)
+{
+	__m128 m, g;
+	int z = begin;
+
+	for (; z + 4 <= end; z += 4)
+	{
+		__m128 dx = _mm_sub_ps(_mm_loadu_ps(row + z + 1), _mm_loadu_ps(row + z - 1));
+		__m128 dy = _mm_sub_ps(_mm_loadu_ps(below + z), _mm_loadu_ps(above + z));
+
+		fastGradientSSE2(dx, dy, m, g);
+		_mm_storeu_ps(magnitude + z, m);
+		_mm_storeu_ps(angle + z, g);
+	}
+
+	/* The tail goes through a padded copy, so every pixel gets the same arithmetic */
+	if (z < end)
+	{
+		float a[4] = { 0 }, r[6] = { 0 }, b[4] = { 0 }, ms[4], gs[4];
+		int n = end - z;
+		for (int k = 0; k < n; k++)
+		{
+			a[k] = above[z + k];
+			b[k] = below[z + k];
+		}
+		for (int k = 0; k < n + 2; k++)
+			r[k] = row[z + k - 1];
+
+		fastGradientSSE2(_mm_sub_ps(_mm_loadu_ps(r + 2), _mm_loadu_ps(r)), _mm_sub_ps(_mm_loadu_ps(b),
+				_mm_loadu_ps(a)), m, g);
+		_mm_storeu_ps(ms, m);
+		_mm_storeu_ps(gs, g);
+		for (int k = 0; k < n; k++)
+		{
+			magnitude[z + k] = ms[k];
+			angle[z + k] = gs[k];
+		}
+	}
+}
+
+
+
+/** AVX version of fastGradientSSE2, 8 gradients **/
+SIFT_TARGET_AVX
+static inline void fastGradientAVX(__m256 dx, __m256 dy, __m256& magnitude, __m256& angle)
+{
+	const __m256 sign = _mm256_set1_ps(-0.0f), zero = _mm256_setzero_ps();
+	const __m256 tiny = _mm256_set1_ps(FLT_MIN);
+	__m256 ax = _mm256_andnot_ps(sign, dx), ay = _mm256_andnot_ps(sign, dy);
+	__m256 a = _mm256_div_ps(_mm256_min_ps(ax, ay), _mm256_max_ps(_mm256_max_ps(ax, ay), tiny));
+	__m256 s = _mm256_mul_ps(a, a);
+
+	__m256 p = _mm256_add_ps(_mm256_set1_ps(SIFT_ATAN_C7), _mm256_mul_ps(s, _mm256_set1_ps(SIFT_ATAN_C9)));
+	p = _mm256_add_ps(_mm256_set1_ps(SIFT_ATAN_C5), _mm256_mul_ps(s, p));
+	p = _mm256_add_ps(_mm256_set1_ps(SIFT_ATAN_C3), _mm256_mul_ps(s, p));
+	p = _mm256_add_ps(_mm256_set1_ps(SIFT_ATAN_C1), _mm256_mul_ps(s, p));
+	__m256 r = _mm256_mul_ps(_mm256_mul_ps(a, p), _mm256_set1_ps((float) (180 / CV_PI)));
+
+	/* Reflections, selected by masks */
+	__m256 mask = _mm256_cmp_ps(ay, ax, _CMP_GT_OQ);
+	r = _mm256_or_ps(_mm256_and_ps(mask, _mm256_sub_ps(_mm256_set1_ps(90), r)), _mm256_andnot_ps(mask, r));
+	mask = _mm256_cmp_ps(dx, zero, _CMP_LT_OQ);
+	r = _mm256_or_ps(_mm256_and_ps(mask, _mm256_sub_ps(_mm256_set1_ps(180), r)), _mm256_andnot_ps(mask, r));
+	mask = _mm256_cmp_ps(dy, zero, _CMP_LT_OQ);
+	r = _mm256_or_ps(_mm256_and_ps(mask, _mm256_sub_ps(_mm256_set1_ps(360), r)), _mm256_andnot_ps(mask, r));
+	angle = _mm256_and_ps(r, _mm256_cmp_ps(r, _mm256_set1_ps(360), _CMP_LT_OQ));
+
+	__m256 squared = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+	__m256 y = _mm256_rsqrt_ps(squared);
+	y = _mm256_mul_ps(y, _mm256_sub_ps(_mm256_set1_ps(1.5f),
+			_mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(0.5f), squared), y), y)));
+	magnitude = _mm256_and_ps(_mm256_mul_ps(squared, y), _mm256_cmp_ps(squared, tiny, _CMP_GE_OQ));
+}
+
+
+
+/** AVX version of fastGradientRowSSE2, 8 pixels per iteration **/
+SIFT_TARGET_AVX
+static void fastGradientRowAVX(const float* above, const float* row, const float* below, float* magnitude,
+		float* angle, int begin, int end)
+{
+	__m256 m, g;
+	int z = begin;
+
+	for (; z + 8 <= end; z += 8)
+	{
+		__m256 dx = _mm256_sub_ps(_mm256_loadu_ps(row + z + 1), _mm256_loadu_ps(row + z - 1));
+		__m256 dy = _mm256_sub_ps(_mm256_loadu_ps(below + z), _mm256_loadu_ps(above + z));
+
+		fastGradientAVX(dx, dy, m, g);
+		_mm256_storeu_ps(magnitude + z, m);
+		_mm256_storeu_ps(angle + z, g);
+	}
+
+	/* The tail goes through a padded copy, so every pixel gets the same arithmetic */
+	if (z < end)
+	{
+		float a[8] = { 0 }, r[10] = { 0 }, b[8] = { 0 }, ms[8], gs[8];
+		int n = end - z;
+		for (int k = 0; k < n; k++)
+		{
+			a[k] = above[z + k];
+			b[k] = below[z + k];
+		}
+		for (int k = 0; k < n + 2; k++)
+			r[k] = row[z + k - 1];
+
+		fastGradientAVX(_mm256_sub_ps(_mm256_loadu_ps(r + 2), _mm256_loadu_ps(r)),
+				_mm256_sub_ps(_mm256_loadu_ps(b), _mm256_loadu_ps(a)), m, g);
+		_mm256_storeu_ps(ms, m);
+		_mm256_storeu_ps(gs, g);
+		for (int k = 0; k < n; k++)
+		{
+			magnitude[z + k] = ms[k];
+			angle[z + k] = gs[k];
+		}
+	}
+}
+#endif
+
+
+
+/**
+ * Approximates the gradient magnitude and angle of
+ * a row on the given kernel path, with a polynomial
+ * arctangent and, on SSE2 and AVX, a reciprocal
+ * square root estimate instead of atan2f and sqrt.
+ * Angles are within 0.001 degrees and magnitudes
+ * within 2^-21 relatively of gradientRow. SSE2 and
+ * AVX give the same angles, the magnitudes follow
+ * the rsqrt estimate of the CPU
+ *
+ * @param above		Row above
+ * @param row		Row of the gradients
+ * @param below		Row below
+ * @param magnitude	Output magnitudes
+ * @param angle		Output angles in degrees, in [0, 360)
+ * @param begin		First pixel
+ * @param end		Pixel past the last one
+ * @param path		Kernel path, must be supported
+ *
+ * @return	Updates magnitude and angle in [begin, end)
+ */
+void fastGradientRow(const float* above, const float* row, const float* below, float* magnitude, float* angle,
+		int begin, int end, KernelPath path)
+{
+#ifdef SIFT_HAVE_X86
+	if (path >= KERNEL_AVX)
+		return fastGradientRowAVX(above, row, below, magnitude, angle, begin, end);
+	if (path == KERNEL_SSE2)
+		return fastGradientRowSSE2(above, row, below, magnitude, angle, begin, end);
+#endif
+
+	fastGradientRowScalar(above, row, below, magnitude, angle, begin, end);
+}
+
+
+
+/**
+ * Dot products of up to 4 query rows with a run of
+ * train rows. Every train row is loaded once for
+ * all the queries
+ *
+ * @param queries		Up to 4 query rows
+ * @param nQueries		Number of query rows
+ * @param train			First train row
+ * @param trainStep		Distance between train rows in floats
+ * @param nTrain		Number of train rows
+ * @param dims			Length of the rows
+ * @param out			nQueries x nTrain products, row major
+ *
+ * @return	Updates out
+ */
+static void dotProductsScalar(const float* const* queries, int nQueries, const float* train, size_t trainStep,
+		int nTrain, int dims, float* out)
+{
+	for (int t = 0; t < nTrain; t++)
+	{
+		const float* row = train + t * trainStep;
+
+		for (int q = 0; q < nQueries; q++)
+		{
+			float sum = 0;
+			for (int d = 0; d < dims; d++)
+				sum += queries[q][d] * row[d];
+			out[q * nTrain + t] = sum;
+		}
+	}
+}
+
+
+
+#ifdef SIFT_HAVE_X86
+/** Sums the 4 lanes of an SSE register **/
+SIFT_TARGET_SSE2
+static inline float horizontalSum(__m128 v)
+{
+	v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+	v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 1));
+	return _mm_cvtss_f32(v);
+}
+
+
+
+/** SSE2 version of dotProductsScalar, 4 dimensions per step **/
+SIFT_TARGET_SSE2
+static void dotProductsSSE2(const float* const* queries, int nQueries, const float* train, size_t trainStep,
+		int nTrain, int dims, float* out)
+{
+	const float* q[4];
+	for (int k = 0; k < 4; k++)
+		q[k] = queries[std::min(k, nQueries - 1)];
+
+	int vectorDims = dims & ~3;
+	for (int t = 0; t < nTrain; t++)
+	{
+		const float* row = train + t * trainStep;
+		__m128 s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps(), s2 = _mm_setzero_ps(), s3 = _mm_setzero_ps();
+
+		for (int d = 0; d < vectorDims; d += 4)
+		{
+			__m128 r = _mm_loadu_ps(row + d);
+			s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(q[0] + d), r));
+			s1 = _mm_add_ps(s1, _mm_mul_ps(_mm_loadu_ps(q[1] + d), r));
+			s2 = _mm_add_ps(s2, _mm_mul_ps(_mm_loadu_ps(q[2] + d), r));
+			s3 = _mm_add_ps(s3, _mm_mul_ps(_mm_loadu_ps(q[3] + d), r));
+		}
+
+		float sums[4] = { horizontalSum(s0), horizontalSum(s1), horizontalSum(s2), horizontalSum(s3) };
+		for (int k = 0; k < nQueries; k++)
+		{
+			for (int d = vectorDims; d < dims; d++)
+				sums[k] += q[k][d] * row[d];
+			out[k * nTrain + t] = sums[k];
+		}
+	}
+}
+
+
+
+/** AVX version of dotProductsScalar, 8 dimensions per step **/
+SIFT_TARGET_AVX
+static void dotProductsAVX(const float* const* queries, int nQueries, const float* train, size_t trainStep,
+		int nTrain, int dims, float* out)
+{
+	const float* q[4];
+	for (int k = 0; k < 4; k++)
+		q[k] = queries[std::min(k, nQueries - 1)];
+
+	int vectorDims = dims & ~7;
+	for (int t = 0; t < nTrain; t++)
+	{
+		const float* row = train + t * trainStep;
+		__m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+		__m256 s2 = _mm256_setzero_ps(), s3 = _mm256_setzero_ps();
+
+		for (int d = 0; d < vectorDims; d += 8)
+		{
+			__m256 r = _mm256_loadu_ps(row + d);
+			s0 = _mm256_add_ps(s0, _mm256_mul_ps(_mm256_loadu_ps(q[0] + d), r));
+			s1 = _mm256_add_ps(s1, _mm256_mul_ps(_mm256_loadu_ps(q[1] + d), r));
+			s2 = _mm256_add_ps(s2, _mm256_mul_ps(_mm256_loadu_ps(q[2] + d), r));
+			s3 = _mm256_add_ps(s3, _mm256_mul_ps(_mm256_loadu_ps(q[3] + d), r));
+		}
+
+		/* Transposing add of the four accumulators, lane k of the result holds query k */
+		__m256 s01 = _mm256_hadd_ps(s0, s1);
+		__m256 s23 = _mm256_hadd_ps(s2, s3);
+		__m256 s0123 = _mm256_hadd_ps(s01, s23);
+		__m128 total = _mm_add_ps(_mm256_castps256_ps128(s0123), _mm256_extractf128_ps(s0123, 1));
+
+		float sums[4];
+		_mm_storeu_ps(sums, total);
+		for (int k = 0; k < nQueries; k++)
+		{
+			for (int d = vectorDims; d < dims; d++)
+				sums[k] += q[k][d] * row[d];
+			out[k * nTrain + t] = sums[k];
+		}
+	}
+}
+#endif
+
+
+
+/**
+ * Dot products of up to 4 query rows with a run of
+ * train rows on the given kernel path, see
+ * dotProductsScalar
+ *
+ * @param queries		Up to 4 query rows
+ * @param nQueries		Number of query rows, 1 to 4
+ * @param train			First train row
+ * @param trainStep		Distance between train rows in floats
+ * @param nTrain		Number of train rows
+ * @param dims			Length of the rows
+ * @param out			nQueries x nTrain products, row major
+ * @param path			Kernel path, must be supported
+ *
+ * @return	Updates out
+ */
+void dotProducts(const float* const* queries, int nQueries, const float* train, size_t trainStep, int nTrain,
+		int dims, float* out, KernelPath path)
+{
+	CV_Assert(nQueries >= 1 && nQueries <= 4);
+
+#ifdef SIFT_HAVE_X86
+	if (path >= KERNEL_AVX)
+		return dotProductsAVX(queries, nQueries, train, trainStep, nTrain, dims, out);
+	if (path == KERNEL_SSE2)
+		return dotProductsSSE2(queries, nQueries, train, trainStep, nTrain, dims, out);
+#endif
+
+	dotProductsScalar(queries, nQueries, train, trainStep, nTrain, dims, out);
+}
+
+
+
+/**
+ * Squared L2 distance of two float rows
+ *
+ * @param a			First row
+ * @param b			Second row
+ * @param dims		Length of the rows
+ *
+ * @return	Returns the sum of the squared differences
+ */
+static float squaredDistanceScalar(const float* a, const float* b, int dims)
+{
+	float sum = 0;
+	for (int d = 0; d < dims; d++)
+	{
+		float diff = a[d] - b[d];
+		sum += diff * diff;
+	}
+
+	return sum;
+}
+
+
+
+#ifdef SIFT_HAVE_X86
+/** SSE2 version of squaredDistanceScalar, 4 dimensions per step **/
+SIFT_TARGET_SSE2
+static float squaredDistanceSSE2(const float* a, const float* b, int dims)
+{
+	int vectorDims = dims & ~3;
+	__m128 sum = _mm_setzero_ps();
+
+	for (int d = 0; d < vectorDims; d += 4)
+	{
+		__m128 diff = _mm_sub_ps(_mm_loadu_ps(a + d), _mm_loadu_ps(b + d));
+		sum = _mm_add_ps(sum, _mm_mul_ps(diff, diff));
+	}
+
+	return horizontalSum(sum) + squaredDistanceScalar(a + vectorDims, b + vectorDims, dims - vectorDims);
+}
+
+
+
+/** AVX version of squaredDistanceScalar, 16 dimensions per step in two chains **/
+SIFT_TARGET_AVX
+static float squaredDistanceAVX(const float* a, const float* b, int dims)
+{
+	int vectorDims = dims & ~15;
+	__m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+
+	for (int d = 0; d < vectorDims; d += 16)
+	{
+		__m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + d), _mm256_loadu_ps(b + d));
+		__m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(a + d + 8), _mm256_loadu_ps(b + d + 8));
+		s0 = _mm256_add_ps(s0, _mm256_mul_ps(d0, d0));
+		s1 = _mm256_add_ps(s1, _mm256_mul_ps(d1, d1));
+	}
+
+	__m256 s = _mm256_add_ps(s0, s1);
+	__m128 total = _mm_add_ps(_mm256_castps256_ps128(s), _mm256_extractf128_ps(s, 1));
+	return horizontalSum(total) + squaredDistanceScalar(a + vectorDims, b + vectorDims, dims - vectorDims);
+}
+#endif
+
+
+
+/**
+ * Squared L2 distance of two float rows on the
+ * given kernel path
+ *
+ * @param a			First row
+ * @param b			Second row
+ * @param dims		Length of the rows
+ * @param path		Kernel path, must be supported
+ *
+ * @return	Returns the sum of the squared differences
+ */
+float squaredDistance(const float* a, const float* b, int dims, KernelPath path)
+{
+#ifdef SIFT_HAVE_X86
+	if (path >= KERNEL_AVX)
+		return squaredDistanceAVX(a, b, dims);
+	if (path == KERNEL_SSE2)
+		return squaredDistanceSSE2(a, b, dims);
+#endif
+
+	return squaredDistanceScalar(a, b, dims);
+}
+
+
+
+/**
+ * Asymmetric distances of blocks of 8 PQ codes.
+ * A block stores code j of its 8 vectors at
+ * [8 j, 8 j + 8), the distance of a vector is the
+ * sum over j of table[256 j + code]
+ *
+ * @param table		nSub x 256 squared distances of the query
+ * @param nSub		Number of sub-quantizers
+ * @param codes		First block
+ * @param nBlocks	Number of blocks
+ * @param out		8 * nBlocks distances
+ *
+ * @return	Updates out
+ */
+static void adcDistancesScalar(const float* table, int nSub, const uchar* codes, int nBlocks, float* out)
+{
+	for (int b = 0; b < nBlocks; b++)
+	{
+		const uchar* block = codes + b * nSub * 8;
+
+		for (int v = 0; v < 8; v++)
+		{
+			float sum = 0;
+			for (int j = 0; j < nSub; j++)
+				sum += table[j * 256 + block[j * 8 + v]];
+			out[b * 8 + v] = sum;
+		}
+	}
+}
+
+
+
+#ifdef SIFT_HAVE_X86
+/** AVX2 version of adcDistancesScalar, one gather per sub-quantizer for the 8 vectors of a block **/
+SIFT_TARGET_AVX2
+static void adcDistancesAVX2(const float* table, int nSub, const uchar* codes, int nBlocks, float* out)
+{
+	for (int b = 0; b < nBlocks; b++)
+	{
+		const uchar* block = codes + b * nSub * 8;
+		__m256 sum = _mm256_setzero_ps();
+
+		for (int j = 0; j < nSub; j++)
+		{
+			__m256i index = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*) (block + j * 8)));
+			sum = _mm256_add_ps(sum, _mm256_i32gather_ps(table + j * 256, index, 4));
+		}
+
+		_mm256_storeu_ps(out + b * 8, sum);
+	}
+}
+#endif
+
+
+
+/**
+ * Asymmetric distances of blocks of 8 PQ codes on
+ * the given kernel path, see adcDistancesScalar.
+ * Only AVX2 has a gather, the other paths run the
+ * scalar lookups. All paths add in the same order
+ *
+ * @param table		nSub x 256 squared distances of the query
+ * @param nSub		Number of sub-quantizers
+ * @param codes		First block
+ * @param nBlocks	Number of blocks
+ * @param out		8 * nBlocks distances
+ * @param path		Kernel path, must be supported
+ *
+ * @return	Updates out
+ */
+void adcDistances(const float* table, int nSub, const uchar* codes, int nBlocks, float* out, KernelPath path)
+{
+#ifdef SIFT_HAVE_X86
+	if (path == KERNEL_AVX2)
+		return adcDistancesAVX2(table, nSub, codes, nBlocks, out);
+#endif
+
+	adcDistancesScalar(table, nSub, codes, nBlocks, out);
+}
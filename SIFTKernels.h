@@ -0,0 +1,80 @@
+/*
+ * SIFTKernels.h
+ *
+ *  Created on: Oct 15, 2026
+ */
+
+#ifndef SIFT_KERNELS_H
+#define SIFT_KERNELS_H
+
+#include "opencv2/opencv.hpp"
+
+using namespace cv;
+
+#define SIFT_MAX_KSIZE						127
+#define SIFT_WEIGHT_SHIFT					15
+
+/** Instruction sets a kernel can be dispatched to **/
+enum KernelPath
+{
+	KERNEL_SCALAR = 0,
+	KERNEL_SSE2 = 1,
+	KERNEL_AVX = 2,
+	KERNEL_AVX2 = 3
+};
+
+/** Returns the widest kernel path supported by the compiler and the running CPU **/
+KernelPath bestKernelPath();
+
+/** Returns true if the given kernel path can run on this machine **/
+bool kernelPathSupported(KernelPath path);
+
+/** Runs body over range on the OpenCV pool with at most threads of it busy, in chunks pulled on demand **/
+void runParallel(const Range& range, const ParallelLoopBody& body, int threads);
+
+/** Marks the 3x3x3 extremas of a DOG row, rows holds the 9 neighbouring rows **/
+void extremaRow(const float* const* rows, uchar* mask, int begin, int end,
+		KernelPath path = bestKernelPath());
+
+/** Blurs and decimates by two in one pass, rowBuffer holds src.cols floats **/
+void blurDecimate(const Mat& src, Mat& dst, double sigma, float* rowBuffer, Rect region = Rect());
+
+/** Blurs a 16 bit fixed point image with integer taps of SIFT_WEIGHT_SHIFT fraction bits **/
+void gaussianBlur16(const Mat& src, Mat& dst, double sigma, Rect region = Rect(),
+		KernelPath path = bestKernelPath());
+
+/** Blurs and decimates a 16 bit fixed point image by two in one pass **/
+void blurDecimate16(const Mat& src, Mat& dst, double sigma, KernelPath path = bestKernelPath());
+
+/** Marks the 3x3x3 extremas of a 16 bit DOG row, rows holds the 9 neighbouring rows **/
+void extremaRow16(const short* const* rows, uchar* mask, int begin, int end,
+		KernelPath path = bestKernelPath());
+
+/** Solves H offset = -g for n symmetric 3x3 systems, one term per row: xx, yy, ss, xy, xs, ys **/
+void solveHessians(const float* const* hessian, const float* const* gradient, float* const* offset, int n,
+		KernelPath path = bestKernelPath());
+
+/** Verdicts of n candidates, 0 kept, 1 low contrast, 2 edge, one term per row: value, xx, yy, xy **/
+void edgeTests(const float* const* terms, uchar* verdicts, int n, float contrast, float curvature,
+		float determinant, KernelPath path = bestKernelPath());
+
+/** Gradient magnitudes and angles in degrees of a row from central differences **/
+void gradientRow(const float* above, const float* row, const float* below, float* magnitude, float* angle,
+		int begin, int end, KernelPath path = bestKernelPath());
+
+/** Approximate gradientRow with a polynomial arctangent and rsqrt, within 0.001 degrees and 2^-21 **/
+void fastGradientRow(const float* above, const float* row, const float* below, float* magnitude, float* angle,
+		int begin, int end, KernelPath path = bestKernelPath());
+
+/** Dot products of up to 4 query rows with nTrain train rows, out is nQueries x nTrain **/
+void dotProducts(const float* const* queries, int nQueries, const float* train, size_t trainStep, int nTrain,
+		int dims, float* out, KernelPath path = bestKernelPath());
+
+/** Squared L2 distance of two float rows **/
+float squaredDistance(const float* a, const float* b, int dims, KernelPath path = bestKernelPath());
+
+/** Sums the table entries of nBlocks interleaved blocks of 8 PQ codes, out holds 8 * nBlocks distances **/
+void adcDistances(const float* table, int nSub, const uchar* codes, int nBlocks, float* out,
+		KernelPath path = bestKernelPath());
+
+#endif
@@ -0,0 +1,543 @@
+/*
+ * VocabularyTree.cpp
+ *
+ *  Created on: Oct 15, 2026
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <float.h>
+#include <algorithm>
+#include "VocabularyTree.h"
+#include "SIFTKernels.h"
+#include "FeatureFile.h"
+
+/**
+ * Quantizes a block of descriptor rows per task
+ */
+class VocabularyTree::QuantizeInvoker : public ParallelLoopBody
+{
+public:
+	QuantizeInvoker(const VocabularyTree& _tree, const Mat& _rows, vector<int>& _wordIds) :
+			tree(_tree), rows(_rows), wordIds(_wordIds)
+	{
+	}
+
+	void operator()(const Range& range) const
+	{
+		for (int block = range.start; block < range.end; block++)
+		{
+			int end = min((block + 1) * SIFT_VOCAB_QUANTIZE_BLOCK, rows.rows);
+			for (int i = block * SIFT_VOCAB_QUANTIZE_BLOCK; i < end; i++)
+				wordIds[i] = tree.wordOf(rows.ptr<float>(i));
+		}
+	}
+
+private:
+	const VocabularyTree& tree;
+	const Mat& rows;
+	vector<int>& wordIds;
+};
+
+
+
+/** Node of the tree waiting to be split, with its range of the sample order **/
+struct PendingNode
+{
+	int node;
+	int level;
+	int begin;
+	int end;
+};
+
+
+
+VocabularyTree::VocabularyTree(int branchFactor, int depth, int threads)
+{
+	branching = max(branchFactor, 2);
+	levels = max(depth, 1);
+	nWords = 0;
+	nImages = 0;
+	weighted = true;
+	setThreadCount(threads);
+}
+
+
+
+/**
+ * Sets the largest number of OpenCV pool threads
+ * descriptor rows are quantized on at once, see
+ * runParallel
+ *
+ * @param threads	Number of threads, 1 for serial
+ */
+void VocabularyTree::setThreadCount(int threads)
+{
+	nThreads = max(threads, 1);
+}
+
+
+
+/**
+ * Learns the tree by hierarchical k-means: the
+ * samples of a node are clustered into branching
+ * children, level by level. A node becomes a leaf
+ * and a word at the last level or when it has too
+ * few samples to be split. The database is emptied
+ *
+ * @param samples	Training rows, CV_32F or CV_8U
+ */
+void VocabularyTree::train(const Mat& samples)
+{
+	CV_Assert(samples.type() == CV_32F || samples.type() == CV_8U);
+	CV_Assert(samples.rows >= branching);
+
+	release();
+
+	Mat rows;
+	samples.convertTo(rows, CV_32F);
+
+	vector<float> centerData(rows.cols, 0.f);
+	vector<int> order(rows.rows), sorted(rows.rows);
+	for (int i = 0; i < rows.rows; i++)
+		order[i] = i;
+
+	VocabularyNode root = { 0, 0, -1 };
+	PendingNode first = { 0, 0, 0, rows.rows };
+	nodes.push_back(root);
+	vector<PendingNode> pending(1, first);
+
+	TermCriteria criteria(TermCriteria::COUNT + TermCriteria::EPS, SIFT_VOCAB_ITERATIONS, 1e-3);
+	for (size_t p = 0; p < pending.size(); p++)
+	{
+		PendingNode current = pending[p];
+		int count = current.end - current.begin;
+
+		if (current.level == levels || count < branching)
+		{
+			nodes[current.node].word = nWords++;
+			continue;
+		}
+
+		Mat members(count, rows.cols, CV_32F);
+		for (int i = 0; i < count; i++)
+			memcpy(members.ptr<float>(i), rows.ptr<float>(order[current.begin + i]), rows.cols * sizeof(float));
+
+		Mat labels, clusters;
+		kmeans(members, branching, labels, criteria, 1, KMEANS_PP_CENTERS, clusters);
+
+		/* Children are appended together and their samples ordered by cluster */
+		nodes[current.node].firstChild = nodes.size();
+		nodes[current.node].children = branching;
+
+		int position = current.begin;
+		for (int c = 0; c < branching; c++)
+		{
+			VocabularyNode child = { 0, 0, -1 };
+			PendingNode next = { (int) nodes.size(), current.level + 1, position, position };
+
+			for (int i = 0; i < count; i++)
+				if (labels.at<int>(i) == c)
+					sorted[next.end++] = order[current.begin + i];
+
+			nodes.push_back(child);
+			centerData.insert(centerData.end(), clusters.ptr<float>(c), clusters.ptr<float>(c) + rows.cols);
+			pending.push_back(next);
+			position = next.end;
+		}
+		copy(sorted.begin() + current.begin, sorted.begin() + current.end, order.begin() + current.begin);
+	}
+
+	centers.create(nodes.size(), rows.cols, CV_32F);
+	for (int i = 0; i < centers.rows; i++)
+		memcpy(centers.ptr<float>(i), &centerData[i * rows.cols], rows.cols * sizeof(float));
+
+	idf.assign(nWords, 0.f);
+	postings.assign(nWords, vector<VocabularyPosting>());
+}
+
+
+
+/**
+ * Descends the tree to the nearest child center
+ * at every level
+ *
+ * @param row	Float descriptor row
+ *
+ * @return	Returns the word of the reached leaf
+ */
+int VocabularyTree::wordOf(const float* row) const
+{
+	KernelPath path = bestKernelPath();
+	int node = 0;
+
+	while (nodes[node].children > 0)
+	{
+		int best = nodes[node].firstChild;
+		float nearest = FLT_MAX;
+
+		for (int c = nodes[node].firstChild; c < nodes[node].firstChild + nodes[node].children; c++)
+		{
+			float distance = squaredDistance(row, centers.ptr<float>(c), centers.cols, path);
+			if (distance < nearest)
+			{
+				nearest = distance;
+				best = c;
+			}
+		}
+		node = best;
+	}
+
+	return nodes[node].word;
+}
+
+
+
+/**
+ * Quantizes every descriptor row to its visual
+ * word, blocks of rows are spread over the threads
+ *
+ * @param descriptors	Descriptor rows, CV_32F or CV_8U
+ * @param wordIds		Word of every row
+ *
+ * @return	Replaces wordIds
+ */
+void VocabularyTree::quantize(const Mat& descriptors, vector<int>& wordIds) const
+{
+	CV_Assert(!nodes.empty());
+	CV_Assert(descriptors.type() == CV_32F || descriptors.type() == CV_8U);
+	CV_Assert(descriptors.empty() || descriptors.cols == centers.cols);
+
+	wordIds.resize(descriptors.rows);
+	if (descriptors.empty())
+		return;
+
+	Mat rows = descriptors;
+	if (descriptors.type() != CV_32F)
+		descriptors.convertTo(rows, CV_32F);
+
+	int nBlocks = (rows.rows + SIFT_VOCAB_QUANTIZE_BLOCK - 1) / SIFT_VOCAB_QUANTIZE_BLOCK;
+	QuantizeInvoker invoker(*this, rows, wordIds);
+
+	runParallel(Range(0, nBlocks), invoker, nThreads);
+}
+
+
+
+/**
+ * Adds an image to the database by quantizing its
+ * descriptors
+ *
+ * @param descriptors	Descriptor rows of the image
+ *
+ * @return	Returns the image id, the images are numbered in order
+ */
+int VocabularyTree::addImage(const Mat& descriptors)
+{
+	vector<int> wordIds;
+	quantize(descriptors, wordIds);
+	return addImage(wordIds);
+}
+
+
+
+/**
+ * Adds an image to the database by its visual
+ * words, one posting per distinct word. The
+ * weights are stale until updateWeights()
+ *
+ * @param wordIds	Visual words of the image features
+ *
+ * @return	Returns the image id, the images are numbered in order
+ */
+int VocabularyTree::addImage(const vector<int>& wordIds)
+{
+	vector<int> sortedWords(wordIds);
+	sort(sortedWords.begin(), sortedWords.end());
+
+	for (size_t i = 0; i < sortedWords.size();)
+	{
+		size_t next = i;
+		while (next < sortedWords.size() && sortedWords[next] == sortedWords[i])
+			next++;
+
+		CV_Assert(sortedWords[i] >= 0 && sortedWords[i] < nWords);
+		VocabularyPosting posting = { nImages, (int) (next - i), 0.f };
+		postings[sortedWords[i]].push_back(posting);
+		i = next;
+	}
+
+	weighted = false;
+	return nImages++;
+}
+
+
+
+/**
+ * Recomputes the inverse document frequency of
+ * every word, log(images / images with the word),
+ * and the posting weights: TF-IDF values of the
+ * image vectors normalized to unit L2 length
+ */
+void VocabularyTree::updateWeights()
+{
+	vector<double> norms(nImages, 0.0);
+
+	for (int w = 0; w < nWords; w++)
+	{
+		idf[w] = postings[w].empty() ? 0.f : (float) log(nImages / (double) postings[w].size());
+		for (size_t i = 0; i < postings[w].size(); i++)
+		{
+			double weight = postings[w][i].count * idf[w];
+			norms[postings[w][i].image] += weight * weight;
+		}
+	}
+
+	for (int i = 0; i < nImages; i++)
+		norms[i] = norms[i] > 0 ? 1 / sqrt(norms[i]) : 0;
+
+	for (int w = 0; w < nWords; w++)
+		for (size_t i = 0; i < postings[w].size(); i++)
+			postings[w][i].weight = (float) (postings[w][i].count * idf[w] * norms[postings[w][i].image]);
+
+	weighted = true;
+}
+
+
+
+/** Orders results by decreasing score, then by image **/
+static bool higherScore(const pair<int, float>& a, const pair<int, float>& b)
+{
+	return a.second > b.second || (a.second == b.second && a.first < b.first);
+}
+
+
+
+/**
+ * Finds the most similar images of a set of
+ * descriptors
+ *
+ * @param descriptors	Descriptor rows of the query image
+ * @param results		Image id and score, see query by words
+ * @param top			Maximum number of results
+ *
+ * @return	Replaces results
+ */
+void VocabularyTree::query(const Mat& descriptors, vector<pair<int, float> >& results, int top) const
+{
+	vector<int> wordIds;
+	quantize(descriptors, wordIds);
+	query(wordIds, results, top);
+}
+
+
+
+/**
+ * Finds the most similar images of a set of
+ * visual words. The query vector is weighted like
+ * the images, and only the postings of its words
+ * are visited to accumulate the cosine similarity
+ *
+ * @param wordIds	Visual words of the query features
+ * @param results	Image id and cosine similarity in (0, 1], best first
+ * @param top		Maximum number of results
+ *
+ * @return	Replaces results
+ */
+void VocabularyTree::query(const vector<int>& wordIds, vector<pair<int, float> >& results, int top) const
+{
+	CV_Assert(weighted);
+
+	results.clear();
+	vector<int> sortedWords(wordIds);
+	sort(sortedWords.begin(), sortedWords.end());
+
+	vector<pair<int, float> > queryWeights;
+	double norm = 0;
+	for (size_t i = 0; i < sortedWords.size();)
+	{
+		size_t next = i;
+		while (next < sortedWords.size() && sortedWords[next] == sortedWords[i])
+			next++;
+
+		CV_Assert(sortedWords[i] >= 0 && sortedWords[i] < nWords);
+		float weight = (next - i) * idf[sortedWords[i]];
+		if (weight > 0)
+		{
+			queryWeights.push_back(make_pair(sortedWords[i], weight));
+			norm += weight * weight;
+		}
+		i = next;
+	}
+
+	if (queryWeights.empty())
+		return;
+
+	vector<float> scores(nImages, 0.f);
+	vector<int> touched;
+	float scale = (float) (1 / sqrt(norm));
+	for (size_t i = 0; i < queryWeights.size(); i++)
+	{
+		const vector<VocabularyPosting>& list = postings[queryWeights[i].first];
+		float weight = queryWeights[i].second * scale;
+
+		for (size_t p = 0; p < list.size(); p++)
+		{
+			if (scores[list[p].image] == 0)
+				touched.push_back(list[p].image);
+			scores[list[p].image] += weight * list[p].weight;
+		}
+	}
+
+	results.resize(touched.size());
+	for (size_t i = 0; i < touched.size(); i++)
+		results[i] = make_pair(touched[i], scores[touched[i]]);
+
+	int kept = min(top, (int) results.size());
+	partial_sort(results.begin(), results.begin() + kept, results.end(), higherScore);
+	results.resize(kept);
+}
+
+
+
+/**
+ * Frees the tree and the database
+ */
+void VocabularyTree::release()
+{
+	centers.release();
+	nodes.clear();
+	idf.clear();
+	postings.clear();
+	nWords = 0;
+	nImages = 0;
+	weighted = true;
+}
+
+
+
+/**
+ * Number of visual words
+ *
+ * @return	Returns 0 if no tree is trained
+ */
+int VocabularyTree::words() const
+{
+	return nWords;
+}
+
+
+
+/**
+ * Number of images of the database
+ *
+ * @return	Returns 0 if no image was added
+ */
+int VocabularyTree::images() const
+{
+	return nImages;
+}
+
+
+
+/**
+ * Writes the tree, centers and nodes, to a
+ * versioned binary file. The database is not
+ * saved, it is rebuilt from the feature files
+ *
+ * @param path		File path
+ *
+ * @return	false if no tree is trained or the file cannot be written
+ */
+bool VocabularyTree::save(const string& path) const
+{
+	if (nodes.empty())
+		return false;
+
+	VocabularyHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, VOCABULARY_MAGIC, sizeof(header.magic));
+
+	size_t rowBytes = centers.cols * sizeof(float);
+	header.version = VOCABULARY_VERSION;
+	header.headerSize = sizeof(VocabularyHeader);
+	header.dims = centers.cols;
+	header.branching = branching;
+	header.levels = levels;
+	header.nodeCount = nodes.size();
+	header.nodeSize = sizeof(VocabularyNode);
+	header.wordCount = nWords;
+	header.centerOffset = alignSize(sizeof(VocabularyHeader), FEATURE_FILE_ALIGN);
+	header.nodeOffset = alignSize(header.centerOffset + (uint64) centers.rows * rowBytes, FEATURE_FILE_ALIGN);
+	header.fileSize = header.nodeOffset + (uint64) nodes.size() * sizeof(VocabularyNode);
+
+	FILE* f = fopen(path.c_str(), "wb");
+	if (!f)
+		return false;
+
+	static const char zeros[FEATURE_FILE_ALIGN] = { 0 };
+	fwrite(&header, sizeof(header), 1, f);
+	fwrite(zeros, 1, header.centerOffset - sizeof(header), f);
+	for (int i = 0; i < centers.rows; i++)
+		fwrite(centers.ptr<float>(i), 1, rowBytes, f);
+	fwrite(zeros, 1, header.nodeOffset - header.centerOffset - centers.rows * rowBytes, f);
+	fwrite(&nodes[0], sizeof(VocabularyNode), nodes.size(), f);
+
+	bool ok = !ferror(f);
+	ok = fclose(f) == 0 && ok;
+	return ok;
+}
+
+
+
+/**
+ * Reads a tree written by save() and validates
+ * its header, bounds and node links. The database
+ * is emptied
+ *
+ * @param path		File path
+ *
+ * @return	false if the file is missing, truncated, corrupt or of another version
+ */
+bool VocabularyTree::load(const string& path)
+{
+	release();
+
+	MappedFile file;
+	if (!file.open(path) || file.size() < sizeof(VocabularyHeader))
+		return false;
+
+	const uchar* base = file.data();
+	const VocabularyHeader* h = (const VocabularyHeader*) base;
+	bool valid = memcmp(h->magic, VOCABULARY_MAGIC, sizeof(h->magic)) == 0
+			&& h->version == VOCABULARY_VERSION
+			&& h->headerSize == sizeof(VocabularyHeader)
+			&& h->nodeSize == sizeof(VocabularyNode)
+			&& h->nodeCount > 0
+			&& h->fileSize == file.size()
+			&& h->centerOffset + (uint64) h->nodeCount * h->dims * sizeof(float) <= h->nodeOffset
+			&& h->nodeOffset + (uint64) h->nodeCount * sizeof(VocabularyNode) <= h->fileSize;
+	if (!valid)
+		return false;
+
+	const VocabularyNode* fileNodes = (const VocabularyNode*) (base + h->nodeOffset);
+	for (unsigned int i = 0; i < h->nodeCount && valid; i++)
+	{
+		const VocabularyNode& node = fileNodes[i];
+		if (node.children > 0)
+			valid = node.firstChild > (int) i && node.firstChild + node.children <= (int) h->nodeCount;
+		else
+			valid = node.word >= 0 && node.word < (int) h->wordCount;
+	}
+	if (!valid)
+		return false;
+
+	nodes.assign(fileNodes, fileNodes + h->nodeCount);
+	centers = Mat(h->nodeCount, h->dims, CV_32F, (void*) (base + h->centerOffset)).clone();
+	branching = h->branching;
+	levels = h->levels;
+	nWords = h->wordCount;
+	idf.assign(nWords, 0.f);
+	postings.assign(nWords, vector<VocabularyPosting>());
+	return true;
+}
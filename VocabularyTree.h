@@ -0,0 +1,131 @@
+/*
+ * VocabularyTree.h
+ *
+ *  Created on: Oct 15, 2026
+ */
+
+#ifndef VOCABULARY_TREE_H
+#define VOCABULARY_TREE_H
+
+#include "opencv2/opencv.hpp"
+
+using namespace std;
+using namespace cv;
+
+#define VOCABULARY_MAGIC					"SIFTVOCB"
+#define VOCABULARY_VERSION					1
+#define SIFT_VOCAB_BRANCHING				10
+#define SIFT_VOCAB_LEVELS					6
+#define SIFT_VOCAB_ITERATIONS				10
+#define SIFT_VOCAB_QUANTIZE_BLOCK			256
+
+/**
+ * Header at offset 0 of a vocabulary file. Blocks
+ * are stored in native byte order at 64 byte
+ * aligned offsets: one center row per node and
+ * the node records
+ */
+struct VocabularyHeader
+{
+	char magic[8];
+	unsigned int version;
+	unsigned int headerSize;
+	unsigned int dims;
+	unsigned int branching;
+	unsigned int levels;
+	unsigned int nodeCount;
+	unsigned int nodeSize;
+	unsigned int wordCount;
+	uint64 centerOffset;
+	uint64 nodeOffset;
+	uint64 fileSize;
+};
+
+/** Node of the tree, children are stored consecutively, a leaf has no children and a word **/
+struct VocabularyNode
+{
+	int firstChild;
+	int children;
+	int word;
+};
+
+/** Image of the inverted index of a word **/
+struct VocabularyPosting
+{
+	int image;
+	int count;
+	float weight;
+};
+
+/**
+ * Bag of visual words image database. A tree of
+ * hierarchical k-means clusters quantizes every
+ * descriptor to a leaf, its visual word. Images
+ * are TF-IDF weighted, L2 normalized word count
+ * vectors kept in an inverted index, so a query
+ * only visits the images sharing a word with it
+ * and scores them by cosine similarity
+ */
+class VocabularyTree
+{
+private:
+	int branching;
+	int levels;
+	int nThreads;
+	Mat centers;
+	vector<VocabularyNode> nodes;
+	int nWords;
+	int nImages;
+	bool weighted;
+	vector<float> idf;
+	vector<vector<VocabularyPosting> > postings;
+
+	class QuantizeInvoker;
+
+	/** Word of one descriptor row **/
+	int wordOf(const float* row) const;
+
+public:
+	VocabularyTree(int branchFactor = SIFT_VOCAB_BRANCHING, int depth = SIFT_VOCAB_LEVELS, int threads = 1);
+
+	/** Most pool threads descriptors are quantized on at once **/
+	void setThreadCount(int threads);
+
+	/** Learns the tree by hierarchical k-means and empties the database **/
+	void train(const Mat& samples);
+
+	/** Writes the tree to a file **/
+	bool save(const string& path) const;
+
+	/** Reads a tree written by save and empties the database **/
+	bool load(const string& path);
+
+	/** Frees the tree and the database **/
+	void release();
+
+	/** Number of visual words, the leaves of the tree **/
+	int words() const;
+
+	/** Number of images of the database **/
+	int images() const;
+
+	/** Visual word of every descriptor row **/
+	void quantize(const Mat& descriptors, vector<int>& wordIds) const;
+
+	/** Adds an image by its descriptors, returns the image id **/
+	int addImage(const Mat& descriptors);
+
+	/** Adds an image by its visual words, returns the image id **/
+	int addImage(const vector<int>& wordIds);
+
+	/** Recomputes the IDF weights and the image vectors after adding images **/
+	void updateWeights();
+
+	/** The top most similar images of a set of descriptors **/
+	void query(const Mat& descriptors, vector<pair<int, float> >& results, int top) const;
+
+	/** The top most similar images of a set of visual words **/
+	void query(const vector<int>& wordIds, vector<pair<int, float> >& results, int top) const;
+};
+
+#endif
@@ -0,0 +1,258 @@
+/*
+ * Workspace.cpp
+ *
+ *  Created on: Oct 15, 2026
+ */
+
+#include "Workspace.h"
+
+SIFTStats::SIFTStats()
+{
+	reset();
+}
+
+
+
+/**
+ * Clears every counter
+ */
+void SIFTStats::reset()
+{
+	frames = 0;
+	reallocations = 0;
+	lastMs = 0;
+	meanMs = 0;
+	maxMs = 0;
+	bytes = 0;
+}
+
+
+
+/**
+ * Accounts for one processed frame
+ *
+ * @param ms				Latency of the frame in milliseconds
+ * @param workspaceBytes	Bytes held by the workspace after the frame
+ */
+void SIFTStats::addFrame(double ms, size_t workspaceBytes)
+{
+	frames++;
+	lastMs = ms;
+	meanMs += (ms - meanMs) / frames;
+	maxMs = max(maxMs, ms);
+	bytes = workspaceBytes;
+}
+
+
+
+SIFTWorkspace::SIFTWorkspace()
+{
+}
+
+
+
+SIFTWorkspace::SIFTWorkspace(Size size, int nOctaves, int nIntervals)
+{
+	create(size, nOctaves, nIntervals);
+}
+
+
+
+/**
+ * Allocates the frame copies and the pyramids for
+ * the given geometry. Nothing is allocated if the
+ * geometry did not change
+ *
+ * @param size			Frame size
+ * @param nOctaves		Number of Octaves
+ * @param nIntervals	Number of Intervals
+ * @param type			CV_32F, or CV_16S for the fixed point pipeline
+ *
+ * @return	false if the buffers were already allocated
+ */
+bool SIFTWorkspace::create(Size size, int nOctaves, int nIntervals, int type)
+{
+	if (!pyramid.create(size, nOctaves, nIntervals, type))
+		return false;
+
+	gray.create(size, CV_8U);
+	image.create(size, type);
+	stats.reallocations++;
+	return true;
+}
+
+
+
+/**
+ * Makes room for the windows of count keypoints.
+ * The arena grows to at least twice its previous
+ * slots, so a detection with a few more keypoints
+ * than the last one does not reallocate, and it
+ * never shrinks. Growing moves no window, every
+ * header is pointed at the new arena
+ *
+ * @param count		Number of keypoints
+ * @param side		Side of a window in pixels
+ *
+ * @return	false if the arena already had count slots
+ */
+bool SIFTWorkspace::createWindows(int count, int side)
+{
+	int slots = gradientWindows.size();
+	if (count <= slots && windows.cols == side)
+		return false;
+
+	slots = max(count, 2 * slots);
+	windows.create(slots * 2 * side, side, CV_32F);
+	gradientWindows.resize(slots);
+	magnitudeWindows.resize(slots);
+	oriented.resize(slots);
+	for (int z = 0; z < slots; z++)
+	{
+		gradientWindows[z] = windows.rowRange(2 * z * side, (2 * z + 1) * side);
+		magnitudeWindows[z] = windows.rowRange((2 * z + 1) * side, (2 * z + 2) * side);
+	}
+
+	return true;
+}
+
+
+
+/**
+ * Releases every buffer, the statistics are kept
+ */
+void SIFTWorkspace::release()
+{
+	gray.release();
+	image.release();
+	pyramid.release();
+	windows.release();
+	gradientWindows.clear();
+	magnitudeWindows.clear();
+	oriented.clear();
+}
+
+
+
+/**
+ * Bytes held by the workspace buffers
+ *
+ * @return	Frame copies, pyramid and window arenas in bytes
+ */
+size_t SIFTWorkspace::bytes() const
+{
+	return gray.total() * gray.elemSize() + image.total() * image.elemSize() + pyramid.bytes()
+			+ windows.total() * windows.elemSize();
+}
+
+
+
+SIFTStreamStats::SIFTStreamStats()
+{
+	reset();
+}
+
+
+
+/**
+ * Clears every counter
+ */
+void SIFTStreamStats::reset()
+{
+	frames = 0;
+	keyframes = 0;
+	tiles = 0;
+	dirtyTiles = 0;
+	carried = 0;
+	lastWork = 0;
+	pixels = 0;
+	fullPixels = 0;
+}
+
+
+
+/**
+ * Accounts for one frame of a stream
+ *
+ * @param frameTiles		Tiles of the frame
+ * @param frameDirty		Tiles that differ from the reference
+ * @param frameCarried		Keypoints carried over from the previous frame
+ * @param framePixels		Pyramid pixels written and DOG pixels scanned
+ * @param frameFullPixels	The same count for the full detector
+ */
+void SIFTStreamStats::addFrame(int frameTiles, int frameDirty, int frameCarried, double framePixels,
+		double frameFullPixels)
+{
+	frames++;
+	tiles += frameTiles;
+	dirtyTiles += frameDirty;
+	carried = frameCarried;
+	lastWork = frameFullPixels > 0 ? framePixels / frameFullPixels : 0;
+	pixels += framePixels;
+	fullPixels += frameFullPixels;
+}
+
+
+
+/**
+ * Fraction of the work of the full detector done
+ * over all frames, keyframes included
+ *
+ * @return	Pixels processed over pixels of the full detector
+ */
+double SIFTStreamStats::work() const
+{
+	return fullPixels > 0 ? pixels / fullPixels : 0;
+}
+
+
+
+SIFTStream::SIFTStream(int diffThreshold, double maxDirtyRatio)
+{
+	threshold = diffThreshold;
+	keyframeRatio = maxDirtyRatio;
+	scale = 1;
+	shift = 0;
+	valid = false;
+}
+
+
+
+/**
+ * Makes the next frame a keyframe. The buffers are
+ * kept, the statistics too
+ */
+void SIFTStream::reset()
+{
+	valid = false;
+}
+
+
+
+/**
+ * Releases every buffer and the keypoints, the
+ * statistics are kept
+ */
+void SIFTStream::release()
+{
+	workspace.release();
+	reference.release();
+	difference.release();
+	keypoints.clear();
+	gradients.clear();
+	magnitudes.clear();
+	valid = false;
+}
+
+
+
+/**
+ * Bytes held by the stream buffers
+ *
+ * @return	Workspace, reference and difference frames in bytes
+ */
+size_t SIFTStream::bytes() const
+{
+	return workspace.bytes() + reference.total() * reference.elemSize()
+			+ difference.total() * difference.elemSize();
+}
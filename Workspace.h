@@ -0,0 +1,173 @@
+/*
+ * Workspace.h
+ *
+ *  Created on: Oct 15, 2026
+ */
+
+#ifndef WORKSPACE_H
+#define WORKSPACE_H
+
+#include "opencv2/opencv.hpp"
+#include "Pyramid.h"
+
+using namespace std;
+using namespace cv;
+
+#define SIFT_STREAM_TILE					32
+#define SIFT_STREAM_THRESHOLD				8
+#define SIFT_STREAM_KEYFRAME_RATIO			0.5
+
+/** Per-frame latency and memory of a workspace **/
+struct SIFTStats
+{
+	int frames;
+	int reallocations;
+	double lastMs;
+	double meanMs;
+	double maxMs;
+	size_t bytes;
+
+	SIFTStats();
+
+	/** Clears every counter **/
+	void reset();
+
+	/** Accounts for one processed frame **/
+	void addFrame(double ms, size_t workspaceBytes);
+};
+
+/**
+ * Buffers of the detector sized once for a frame
+ * resolution and reused for every frame of that
+ * resolution: grayscale and normalized copies of
+ * the frame, the scale space pyramids and the
+ * gradient windows of the keypoints
+ */
+class SIFTWorkspace
+{
+public:
+	/** 8 bit grayscale copy of the frame **/
+	Mat gray;
+
+	/** Frame normalized to [0, 1], in float or in SIFT_FIXED_SHIFT bits fixed point **/
+	Mat image;
+
+	/** Guassian and DOG pyramids of the frame **/
+	Pyramid pyramid;
+
+	/** Arena of the keypoint windows, a gradient and a magnitude window per keypoint slot **/
+	Mat windows;
+
+	/** Headers of the gradient and magnitude window of every slot into the arena **/
+	vector<Mat> gradientWindows;
+	vector<Mat> magnitudeWindows;
+
+	/** Whether the keypoint of every slot got its windows **/
+	vector<uchar> oriented;
+
+	/** Latency and memory of the processed frames **/
+	SIFTStats stats;
+
+	SIFTWorkspace();
+	SIFTWorkspace(Size size, int nOctaves, int nIntervals);
+
+	/** Allocates CV_32F or CV_16S buffers for the given geometry, returns false if unchanged **/
+	bool create(Size size, int nOctaves, int nIntervals, int type = CV_32F);
+
+	/** Grows the window arena to count square windows of the given side, returns false if large enough **/
+	bool createWindows(int count, int side);
+
+	/** Releases every buffer **/
+	void release();
+
+	/** Bytes held by the workspace buffers **/
+	size_t bytes() const;
+};
+
+/**
+ * Work done by a stream compared to running the full
+ * detector on every frame. Tiles and pixels are summed
+ * over the frames, carried and lastWork are those of
+ * the last frame
+ */
+struct SIFTStreamStats
+{
+	int frames;
+	int keyframes;
+	double tiles;
+	double dirtyTiles;
+	int carried;
+	double lastWork;
+	double pixels;
+	double fullPixels;
+
+	SIFTStreamStats();
+
+	/** Clears every counter **/
+	void reset();
+
+	/** Accounts for one frame, pixels are pyramid pixels written plus DOG pixels scanned **/
+	void addFrame(int frameTiles, int frameDirty, int frameCarried, double framePixels, double frameFullPixels);
+
+	/** Fraction of the full detector work done over all frames **/
+	double work() const;
+};
+
+/**
+ * State of the detector over the frames of a fixed
+ * camera. The pyramids, the frame they were built
+ * from and the oriented keypoints are kept between
+ * frames, so a frame only recomputes the tiles that
+ * differ from the reference by more than threshold
+ * gray levels and carries the other keypoints over.
+ * The frames are normalized with the range of the
+ * last keyframe
+ */
+class SIFTStream
+{
+public:
+	/** Buffers and pyramids of the last frame **/
+	SIFTWorkspace workspace;
+
+	/** 8 bit frame the pyramids were built from **/
+	Mat reference;
+
+	/** Absolute difference of the frame and the reference **/
+	Mat difference;
+
+	/** Oriented keypoints of the last frame in detector order **/
+	vector<KeyPoint> keypoints;
+
+	/** Gradient and magnitude windows of the keypoints **/
+	vector<Mat> gradients;
+	vector<Mat> magnitudes;
+
+	/** Normalization of the last keyframe, image = gray * scale + shift **/
+	double scale;
+	double shift;
+
+	/** Gray level difference marking a tile dirty **/
+	int threshold;
+
+	/** Fraction of dirty tiles above which the whole frame is recomputed **/
+	double keyframeRatio;
+
+	/** False until a keyframe was processed **/
+	bool valid;
+
+	/** Work saved over the processed frames **/
+	SIFTStreamStats stats;
+
+	SIFTStream(int diffThreshold = SIFT_STREAM_THRESHOLD, double maxDirtyRatio = SIFT_STREAM_KEYFRAME_RATIO);
+
+	/** Makes the next frame a keyframe, needed after changing the detector settings **/
+	void reset();
+
+	/** Releases every buffer and the keypoints **/
+	void release();
+
+	/** Bytes held by the stream buffers **/
+	size_t bytes() const;
+};
+
+#endif